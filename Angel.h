@@ -31,15 +31,26 @@
 //     copies of open-soruce project headers in the "GL" directory local
 //     this this "include" directory.
 //
+//   Headless code (the physics library and its command-line tools) defines
+//     ANGEL_NO_GL before including this file.  It then gets the GL scalar
+//     types and the vector/matrix classes without any GL or GLUT headers.
+//
 
-#ifdef __APPLE__  // include Mac OS X verions of headers
+#ifdef ANGEL_NO_GL
+typedef float          GLfloat;
+typedef double         GLdouble;
+typedef int            GLint;
+typedef unsigned int   GLuint;
+typedef unsigned int   GLenum;
+typedef void           GLvoid;
+#elif defined(__APPLE__)  // include Mac OS X verions of headers
 #  include <OpenGL/OpenGL.h>
 #  include <GLUT/glut.h>
 #else // non-Mac OS X operating systems
 #  include <GL/glew.h>
 #  include <GL/freeglut.h>
 #  include <GL/freeglut_ext.h>
-#endif  // __APPLE__
+#endif  // ANGEL_NO_GL
 
 // Define a helpful macro for handling offsets into buffer objects
 #define BUFFER_OFFSET( offset )   ((GLvoid*) (offset))
@@ -67,7 +78,9 @@ const GLfloat  DegreesToRadians = M_PI / 180.0;
 
 #include "vec.h"
 #include "mat.h"
+#ifndef ANGEL_NO_GL
 #include "CheckError.h"
+#endif
 
 #define Print(x)  do { std::cerr << #x " = " << (x) << std::endl; } while(0)
 
@@ -0,0 +1,141 @@
+/******************************************************************************
+ *  BallStore.h
+ *
+ *  Structure-of-arrays storage for the simulation objects.  The fields
+ *  read on every step (position, velocity, radius, inverse mass and the
+ *  pocketed, ignored and sleeping flags) are kept in their own contiguous
+ *  arrays, so the integrate and collide loops stream through only the
+ *  data they use.  Everything else about an object goes in the cold info
+ *  table.  The arrays are sized to the object count and drawn from
+ *  BlockPool, so tables of any size cost memory in proportion to their
+ *  objects.
+ ******************************************************************************/
+
+#ifndef __BALL_STORE_H__
+#define __BALL_STORE_H__
+
+#include "Angel.h"
+#include "PoolAllocator.h"
+#include <vector>
+#include <stdint.h>
+
+
+typedef vec3 Color;
+
+typedef std::vector<double, PoolAllocator<double> > BallArray;
+
+
+/* One bit per object, packed 64 to a word. */
+
+class FlagBits
+{
+public:
+   void resize(int n, bool value = false)
+      { words.assign((n + 63) / 64, value ? ~(uint64_t) 0 : 0); }
+
+   bool test(int i) const
+      { return (words[i >> 6] >> (i & 63)) & 1; }
+
+   void set(int i, bool value)
+   {
+      uint64_t bit = (uint64_t) 1 << (i & 63);
+      if(value)
+         words[i >> 6] |= bit;
+      else
+         words[i >> 6] &= ~bit;
+   }
+
+   std::vector<uint64_t, PoolAllocator<uint64_t> > words;
+};
+
+
+/* Bookkeeping attributes that the physics loops never read.  oPosition
+ * is the racked position the object returns to when the board is
+ * re-racked.
+ */
+
+typedef struct BallInfo
+{
+   dvec2 oPosition;
+   Color color;
+   double mass;
+   int hasBeenShot;
+} BallInfo;
+
+
+class BallStore
+{
+public:
+   BallStore() : count(0) {}
+
+   int size(void) const
+      { return count; }
+
+   /* Resize every array to exactly n objects, giving back any space a
+    * larger table used.  Every object is zeroed, and asleep until
+    * something wakes it.
+    */
+
+   void resize(int n)
+   {
+      count = n;
+      BallArray(n, 0.0).swap(px);
+      BallArray(n, 0.0).swap(py);
+      BallArray(n, 0.0).swap(vx);
+      BallArray(n, 0.0).swap(vy);
+      BallArray(n, 0.0).swap(r);
+      BallArray(n, 0.0).swap(invMass);
+      BallArray(n, 0.0).swap(stillTime);
+      pocketed = FlagBits();
+      ignored = FlagBits();
+      sleeping = FlagBits();
+      pocketed.resize(n);
+      ignored.resize(n);
+      sleeping.resize(n, true);
+      std::vector<BallInfo, PoolAllocator<BallInfo> >(n, BallInfo()).swap(info);
+   }
+
+   /* Bytes held by the arrays. */
+
+   size_t bytes(void) const
+   {
+      return (px.capacity() + py.capacity() + vx.capacity() + vy.capacity() +
+              r.capacity() + invMass.capacity() + stillTime.capacity()) *
+             sizeof(double) +
+             (pocketed.words.capacity() + ignored.words.capacity() +
+              sleeping.words.capacity()) * sizeof(uint64_t) +
+             info.capacity() * sizeof(BallInfo);
+   }
+
+   void setMass(int i, double mass)
+   {
+      info[i].mass = mass;
+      invMass[i] = (mass > 0.0) ? 1.0 / mass : 0.0;
+   }
+
+   /* Hot data. */
+
+   BallArray px, py;
+   BallArray vx, vy;
+   BallArray r;
+   BallArray invMass;
+   FlagBits pocketed;
+   FlagBits ignored;
+
+   /* Sleeping objects are skipped by the step loops.  Pocketed and
+    * ignored objects always sleep.  stillTime is how long a ball has been
+    * below REST_SPEED (see PoolWorld::updateSleep()).
+    */
+
+   FlagBits sleeping;
+   BallArray stillTime;
+
+   /* Cold data. */
+
+   std::vector<BallInfo, PoolAllocator<BallInfo> > info;
+
+private:
+   int count;
+};
+
+#endif // __BALL_STORE_H__
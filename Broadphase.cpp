@@ -0,0 +1,126 @@
+/******************************************************************************
+ *  Broadphase.cpp
+ *
+ *  Uniform-grid broadphase.  build() is a counting sort of the objects by
+ *  bucket, so objects within a bucket stay in increasing index order.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "Broadphase.h"
+#include <algorithm>
+
+
+UniformGrid::UniformGrid()
+{
+   cellSize = 1.0;
+   mask = 0;
+   bucketStart.assign(2, 0);
+}
+
+
+unsigned UniformGrid::bucket(int ix, int iy) const
+{
+   return ((unsigned) ix * 73856093u ^ (unsigned) iy * 19349663u) & mask;
+}
+
+
+double UniformGrid::cellSizeFor(const BallStore& balls, int count)
+{
+   double maxRadius = 0.0;
+
+   for(int i = 0; i < count; i++)
+   {
+      if(!balls.ignored.test(i) && balls.r[i] > maxRadius)
+         maxRadius = balls.r[i];
+   }
+   return (maxRadius > 0.0) ? 2.0 * maxRadius : 1.0;
+}
+
+
+void UniformGrid::build(const BallStore& balls,
+                        const std::vector<int>& objects, double size)
+{
+   int count = (int) objects.size();
+
+   cellSize = size;
+   double invCell = 1.0 / cellSize;
+
+   /* Keep the load factor at or below one half. */
+
+   unsigned numBuckets = 64;
+   while(numBuckets < 2u * (unsigned) count)
+      numBuckets <<= 1;
+   mask = numBuckets - 1;
+
+   objectBucket.resize(count);
+   bucketStart.assign(numBuckets + 1, 0);
+
+   /* Count the objects in each bucket... */
+
+   int live = 0;
+   for(int n = 0; n < count; n++)
+   {
+      int i = objects[n];
+      if(balls.ignored.test(i))
+      {
+         objectBucket[n] = numBuckets;
+         continue;
+      }
+      objectBucket[n] = bucket((int) std::floor(balls.px[i] * invCell),
+                               (int) std::floor(balls.py[i] * invCell));
+      bucketStart[objectBucket[n]]++;
+      live++;
+   }
+
+   /* ...turn the counts into start offsets... */
+
+   int sum = 0;
+   for(unsigned b = 0; b < numBuckets; b++)
+   {
+      int n = bucketStart[b];
+      bucketStart[b] = sum;
+      sum += n;
+   }
+
+   /* ...and scatter.  Each start is advanced to the next bucket's start
+    * as it fills, so shift them back down by one afterwards.
+    */
+
+   bucketObjects.resize(live);
+   for(int n = 0; n < count; n++)
+   {
+      if(objectBucket[n] != numBuckets)
+         bucketObjects[bucketStart[objectBucket[n]]++] = objects[n];
+   }
+   for(unsigned b = numBuckets; b > 0; b--)
+      bucketStart[b] = bucketStart[b - 1];
+   bucketStart[0] = 0;
+}
+
+
+void UniformGrid::candidates(double x, double y, std::vector<int>& out) const
+{
+   unsigned seen[9];
+   int numSeen = 0;
+   double invCell = 1.0 / cellSize;
+   int cx = (int) std::floor(x * invCell);
+   int cy = (int) std::floor(y * invCell);
+
+   for(int dx = -1; dx <= 1; dx++)
+   {
+      for(int dy = -1; dy <= 1; dy++)
+      {
+         unsigned b = bucket(cx + dx, cy + dy);
+
+         /* Neighbouring cells may hash to the same bucket. */
+
+         if(std::find(seen, seen + numSeen, b) != seen + numSeen)
+            continue;
+         seen[numSeen++] = b;
+
+         out.insert(out.end(), bucketObjects.begin() + bucketStart[b],
+                    bucketObjects.begin() + bucketStart[b + 1]);
+      }
+   }
+}
@@ -0,0 +1,56 @@
+/******************************************************************************
+ *  Broadphase.h
+ *
+ *  Uniform-grid broadphase for PoolWorld.  Objects are binned by the grid
+ *  cell holding their center.  The cells are twice the largest radius on
+ *  the table, so two objects can only touch if their cells are neighbours.
+ *  That only holds while no object binned or looked up is larger: a ball
+ *  that grows past cellSize / 2 needs the grids built again at the new
+ *  size (PoolWorld checks its awake balls every step).
+ *  Cells are hashed into a bucket table sized from the object count, so
+ *  the grid needs no table bounds and costs O(n) to rebuild.
+ ******************************************************************************/
+
+#ifndef __BROADPHASE_H__
+#define __BROADPHASE_H__
+
+#include "BallStore.h"
+
+
+class UniformGrid
+{
+public:
+   UniformGrid();
+
+   /* Twice the largest radius of objects 0 .. count-1, leaving out
+    * ignored ones.  This is the cell size build() should be given.
+    */
+
+   static double cellSizeFor(const BallStore& balls, int count);
+
+   /* Bin the objects listed into cells of the given size.  Ignored
+    * objects are left out.
+    */
+
+   void build(const BallStore& balls, const std::vector<int>& objects,
+              double size);
+
+   /* Append to out the index of every object binned in the cells around
+    * the point (x, y), bucket by bucket.  Hash collisions may add
+    * objects that are further away.
+    */
+
+   void candidates(double x, double y, std::vector<int>& out) const;
+
+   double cellSize;
+
+private:
+   unsigned bucket(int ix, int iy) const;
+
+   unsigned mask;
+   std::vector<unsigned> objectBucket;
+   std::vector<int> bucketStart;
+   std::vector<int> bucketObjects;
+};
+
+#endif // __BROADPHASE_H__
@@ -0,0 +1,194 @@
+/******************************************************************************
+ *  ContactSolver.cpp
+ *
+ *  The normal of a contact points from ball k to ball j, and its
+ *  impulse pushes j along it and k against it.  A contact's approach
+ *  speed is (vk - vj) . n, positive while the balls are closing.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "ContactSolver.h"
+#include <algorithm>
+
+
+ContactSolver::ContactSolver()
+{
+   maxIterations = SOLVER_ITERATIONS;
+   slop = 0.0;
+   contacts = 0;
+   iterations = 0;
+   residual = 0.0;
+   movedSleeping = false;
+}
+
+
+void ContactSolver::clear(void)
+{
+   list.clear();
+}
+
+
+void ContactSolver::add(int j, int k)
+{
+   Contact c;
+   c.j = j;
+   c.k = k;
+   c.key = (uint64_t) j << 32 | (uint32_t) k;
+   c.impulse = 0.0;
+   list.push_back(c);
+}
+
+
+/* Work out each contact's normal, mass and restitution target from the
+ * state at the start of the step.  Pairs that no longer touch, or that
+ * cannot be pushed apart, are dropped.  Only once every target is set
+ * from the same velocities is whatever impulse the same pair needed
+ * last step applied, so no contact's target depends on the order.
+ */
+
+void ContactSolver::warmStart(BallStore& balls, double elasticity)
+{
+   size_t n = 0, p = 0;
+
+   std::sort(list.begin(), list.end());
+
+   for(size_t i = 0; i < list.size(); i++)
+   {
+      Contact c = list[i];
+      double nx = balls.px[c.j] - balls.px[c.k];
+      double ny = balls.py[c.j] - balls.py[c.k];
+      double distance = std::sqrt(nx * nx + ny * ny);
+      double invMass = balls.invMass[c.j] + balls.invMass[c.k];
+
+      if(distance <= 0.0 || distance > balls.r[c.j] + balls.r[c.k] + slop ||
+         invMass <= 0.0)
+         continue;
+
+      c.nx = nx / distance;
+      c.ny = ny / distance;
+      c.mass = 1.0 / invMass;
+
+      double approach = (balls.vx[c.k] - balls.vx[c.j]) * c.nx +
+                        (balls.vy[c.k] - balls.vy[c.j]) * c.ny;
+      c.bias = (approach > 0.0) ? elasticity * approach : 0.0;
+
+      /* Both lists are in key order. */
+
+      while(p < previous.size() && previous[p].key < c.key)
+         p++;
+      if(p < previous.size() && previous[p].key == c.key)
+         c.impulse = previous[p].impulse;
+
+      list[n++] = c;
+   }
+   list.resize(n);
+
+   for(size_t i = 0; i < list.size(); i++)
+   {
+      const Contact& c = list[i];
+      balls.vx[c.j] += c.impulse * balls.invMass[c.j] * c.nx;
+      balls.vy[c.j] += c.impulse * balls.invMass[c.j] * c.ny;
+      balls.vx[c.k] -= c.impulse * balls.invMass[c.k] * c.nx;
+      balls.vy[c.k] -= c.impulse * balls.invMass[c.k] * c.ny;
+   }
+}
+
+
+/* Gauss-Seidel over the contacts: bring each one to its target, given
+ * what the others have done so far, keeping the accumulated impulse
+ * from ever pulling the balls together.
+ */
+
+void ContactSolver::solveVelocities(BallStore& balls)
+{
+   iterations = 0;
+   residual = 0.0;
+   if(list.empty())
+      return;
+
+   for(iterations = 0; iterations < maxIterations; )
+   {
+      iterations++;
+      residual = 0.0;
+
+      for(size_t i = 0; i < list.size(); i++)
+      {
+         Contact& c = list[i];
+         double approach = (balls.vx[c.k] - balls.vx[c.j]) * c.nx +
+                           (balls.vy[c.k] - balls.vy[c.j]) * c.ny;
+         double impulse = c.impulse + (approach + c.bias) * c.mass;
+
+         if(impulse < 0.0)
+            impulse = 0.0;
+
+         double change = impulse - c.impulse;
+         c.impulse = impulse;
+
+         balls.vx[c.j] += change * balls.invMass[c.j] * c.nx;
+         balls.vy[c.j] += change * balls.invMass[c.j] * c.ny;
+         balls.vx[c.k] -= change * balls.invMass[c.k] * c.nx;
+         balls.vy[c.k] -= change * balls.invMass[c.k] * c.ny;
+
+         double dv = std::fabs(change) / c.mass;
+         if(dv > residual)
+            residual = dv;
+      }
+      if(residual <= SOLVER_TOLERANCE)
+         break;
+   }
+}
+
+
+/* Move overlapping pairs apart in proportion to their inverse masses,
+ * recomputing each overlap from the positions as they now stand.
+ */
+
+void ContactSolver::solvePositions(BallStore& balls)
+{
+   for(int pass = 0; pass < maxIterations; pass++)
+   {
+      bool overlapping = false;
+
+      for(size_t i = 0; i < list.size(); i++)
+      {
+         const Contact& c = list[i];
+         double nx = balls.px[c.j] - balls.px[c.k];
+         double ny = balls.py[c.j] - balls.py[c.k];
+         double distance = std::sqrt(nx * nx + ny * ny);
+         double penetration = balls.r[c.j] + balls.r[c.k] - distance;
+
+         if(penetration <= SOLVER_TOLERANCE || distance <= 0.0)
+            continue;
+         overlapping = true;
+
+         double push = penetration * c.mass / distance;
+         balls.px[c.j] += push * balls.invMass[c.j] * nx;
+         balls.py[c.j] += push * balls.invMass[c.j] * ny;
+         balls.px[c.k] -= push * balls.invMass[c.k] * nx;
+         balls.py[c.k] -= push * balls.invMass[c.k] * ny;
+         if(balls.sleeping.test(c.j) || balls.sleeping.test(c.k))
+            movedSleeping = true;
+      }
+      if(!overlapping)
+         break;
+   }
+}
+
+
+void ContactSolver::solve(BallStore& balls, double elasticity)
+{
+   movedSleeping = false;
+   warmStart(balls, elasticity);
+
+   solveVelocities(balls);
+   solvePositions(balls);
+
+   contacts = (int) list.size();
+   previous.resize(list.size());
+   for(size_t i = 0; i < list.size(); i++)
+   {
+      previous[i].key = list[i].key;
+      previous[i].impulse = list[i].impulse;
+   }
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+ *  ContactSolver.h
+ *
+ *  Sequential-impulse contact solver for PoolWorld.  collide() gathers
+ *  every touching ball pair of a step into one list, and solve() then
+ *  works on all of them together, a projected Gauss-Seidel iteration
+ *  over the accumulated normal impulse of each contact.  A ball wedged in
+ *  the rack gets the combined push of all its neighbours instead of
+ *  whichever pair the loop happened to reach last.  Impulses are carried
+ *  over from the previous step to warm start the next one.
+ ******************************************************************************/
+
+#ifndef __CONTACT_SOLVER_H__
+#define __CONTACT_SOLVER_H__
+
+#include "BallStore.h"
+#include <stdint.h>
+
+
+/* SOLVER_ITERATIONS is the default bound on the velocity and the
+ * position passes of solve(), each.  The velocity pass stops early once
+ * no impulse changes a pair's relative velocity by more than
+ * SOLVER_TOLERANCE, the position pass once no pair overlaps by more.
+ */
+
+const int SOLVER_ITERATIONS = 16;
+const double SOLVER_TOLERANCE = 1e-6;
+
+
+class ContactSolver
+{
+public:
+   ContactSolver();
+
+   /* Start a new step's contact list. */
+
+   void clear(void);
+
+   /* Forget the impulses kept for warm starting. */
+
+   void reset(void)
+      { previous.clear(); }
+
+   /* Add a contact between balls j < k. */
+
+   void add(int j, int k);
+
+   /* Resolve every contact added since clear(): first the velocities,
+    * so that no pair is left approaching and each pair separates at
+    * elasticity times its approach speed, then the positions, so that
+    * no pair is left overlapping.
+    */
+
+   void solve(BallStore& balls, double elasticity);
+
+   int maxIterations;
+
+   /* Pairs up to slop apart still count as touching; 0 by default. */
+
+   double slop;
+
+   /* Statistics of the last solve(): contacts, velocity iterations run
+    * and the largest velocity change in the last of them.
+    */
+
+   int contacts;
+   int iterations;
+   double residual;
+
+   /* Set by the last solve() if its position pass moved a sleeping
+    * ball, which the caller's record of resting balls must take in.
+    */
+
+   bool movedSleeping;
+
+   /* The pairs of the last solve(), j < k. */
+
+   struct Contact
+   {
+      int j, k;
+      uint64_t key;
+      double nx, ny;
+      double mass;
+      double bias;
+      double impulse;
+
+      bool operator < (const Contact& c) const
+         { return key < c.key; }
+   };
+
+   std::vector<Contact> list;
+
+private:
+   struct Cached
+   {
+      uint64_t key;
+      double impulse;
+   };
+
+   void warmStart(BallStore& balls, double elasticity);
+   void solveVelocities(BallStore& balls);
+   void solvePositions(BallStore& balls);
+
+   std::vector<Cached> previous;
+};
+
+#endif // __CONTACT_SOLVER_H__
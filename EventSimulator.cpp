@@ -0,0 +1,364 @@
+/******************************************************************************
+ *  EventSimulator.cpp
+ *
+ *  Contacts are predicted in "travel" units: a ball with velocity v now
+ *  is at x + v * tau after (1 - e^(-f dt)) / f = tau seconds' worth of
+ *  friction.  Every ball shares the same tau, so relative motion is
+ *  linear in tau and each contact time is the root of a line or a
+ *  quadratic.  elapsedToTravel() turns tau back into seconds.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "EventSimulator.h"
+#include <algorithm>
+#include <limits>
+
+
+/* Codes for the cushions in Event::other.  Pocket p is FIRST_POCKET - p. */
+
+const int LEFT_CUSHION = -1;
+const int RIGHT_CUSHION = -2;
+const int BOTTOM_CUSHION = -3;
+const int TOP_CUSHION = -4;
+const int FIRST_POCKET = -5;
+
+const double NEVER = std::numeric_limits<double>::infinity();
+
+/* Balls this close to touching at a contact are in it too. */
+
+const double CONTACT_SLOP = 1e-6;
+
+
+EventSimulator::EventSimulator(PoolWorld& world)
+   : world(world), balls(world.balls)
+{
+   events = 0;
+   maxEvents = MAX_EVENTS;
+   steppedFinish = false;
+   now = 0.0;
+   solver.slop = CONTACT_SLOP;
+}
+
+
+/* Balls still in play.  Ignored objects and balls that have already
+ * dropped take no part.
+ */
+
+bool EventSimulator::isLive(int i) const
+{
+   return i < world.numBalls && !balls.ignored.test(i) &&
+          !world.isPocketed(i);
+}
+
+
+long EventSimulator::count(int i) const
+{
+   return (i >= 0) ? counts[i] : 0;
+}
+
+
+/***********************************************************************
+ * Time keeping
+ ***********************************************************************/
+
+double EventSimulator::elapsedToTravel(double tau) const
+{
+   double f = world.friction;
+
+   if(f <= 0.0)
+      return tau;
+   if(f * tau >= 1.0)
+      return NEVER;
+   return -std::log1p(-f * tau) / f;
+}
+
+
+/* When the fastest ball will drop below REST_SPEED. */
+
+double EventSimulator::restTime(void) const
+{
+   double fastest = 0.0;
+
+   for(int i = 0; i < world.numBalls; i++)
+   {
+      if(!isLive(i))
+         continue;
+      double speed = std::sqrt(balls.vx[i] * balls.vx[i] +
+                               balls.vy[i] * balls.vy[i]);
+      if(speed > fastest)
+         fastest = speed;
+   }
+   if(fastest < REST_SPEED)
+      return now;
+   if(world.friction <= 0.0)
+      return NEVER;
+   return now + std::log(fastest / REST_SPEED) / world.friction;
+}
+
+
+/* Move every live ball along its line to time t. */
+
+void EventSimulator::advanceTo(double t)
+{
+   double dt = t - now;
+   double f = world.friction;
+   double decay = (f > 0.0) ? std::exp(-f * dt) : 1.0;
+   double tau = (f > 0.0) ? (1.0 - decay) / f : dt;
+
+   for(int i = 0; i < world.numBalls; i++)
+   {
+      if(!isLive(i))
+         continue;
+      balls.px[i] += balls.vx[i] * tau;
+      balls.py[i] += balls.vy[i] * tau;
+      balls.vx[i] *= decay;
+      balls.vy[i] *= decay;
+   }
+   now = t;
+}
+
+
+/***********************************************************************
+ * Prediction
+ ***********************************************************************/
+
+void EventSimulator::schedule(double tau, int ball, int other)
+{
+   double dt = elapsedToTravel(tau < 0.0 ? 0.0 : tau);
+
+   if(dt == NEVER)
+      return;
+
+   Event e;
+   e.time = now + dt;
+   e.ball = ball;
+   e.other = other;
+   e.ballCount = count(ball);
+   e.otherCount = count(other);
+   queue.push(e);
+}
+
+
+/* Earliest tau >= 0 at which d + w * tau has length reach, moving
+ * inwards, or NEVER.  Already inside counts as now.
+ */
+
+static double closingTime(double dx, double dy, double wx, double wy,
+                          double reach)
+{
+   double b = dx * wx + dy * wy;
+   if(b >= 0.0)
+      return NEVER;
+
+   double c = dx * dx + dy * dy - reach * reach;
+   if(c <= 0.0)
+      return 0.0;
+
+   double a = wx * wx + wy * wy;
+   double disc = b * b - a * c;
+   if(disc < 0.0)
+      return NEVER;
+   return (-b - std::sqrt(disc)) / a;
+}
+
+
+void EventSimulator::predict(int i)
+{
+   const double x = balls.px[i], y = balls.py[i];
+   const double vx = balls.vx[i], vy = balls.vy[i];
+   const double r = balls.r[i];
+   const Table& table = world.table;
+   double tau;
+
+   /* Other balls. */
+
+   for(int j = 0; j < world.numBalls; j++)
+   {
+      if(j == i || !isLive(j))
+         continue;
+      tau = closingTime(x - balls.px[j], y - balls.py[j],
+                        vx - balls.vx[j], vy - balls.vy[j], r + balls.r[j]);
+      if(tau != NEVER)
+         schedule(tau, i, j);
+   }
+
+   /* Pockets swallow a ball once its center is inside them, as
+    * sinkBalls() does, even one already inside and heading out.
+    */
+
+   const Pockets& pockets = world.pockets;
+   for(int p = 0; p < pockets.size(); p++)
+   {
+      double dx = x - pockets.cx[p], dy = y - pockets.cy[p];
+      if(dx * dx + dy * dy <= pockets.radius[p] * pockets.radius[p])
+         tau = 0.0;
+      else
+         tau = closingTime(dx, dy, vx, vy, pockets.radius[p]);
+      if(tau != NEVER)
+         schedule(tau, i, FIRST_POCKET - p);
+   }
+
+   /* Cushions. */
+
+   if(vx > 0.0)
+      schedule((table.ur.x - r - x) / vx, i, RIGHT_CUSHION);
+   else if(vx < 0.0)
+      schedule((table.ll.x + r - x) / vx, i, LEFT_CUSHION);
+
+   if(vy > 0.0)
+      schedule((table.ur.y - r - y) / vy, i, TOP_CUSHION);
+   else if(vy < 0.0)
+      schedule((table.ll.y + r - y) / vy, i, BOTTOM_CUSHION);
+}
+
+
+/***********************************************************************
+ * Contacts
+ ***********************************************************************/
+
+/* Grow cluster, the two balls of a contact, by every ball touching one
+ * already in it, and resolve every touching pair among them at once.
+ * Pairs are added from whichever ball of the two was reached first.
+ */
+
+void EventSimulator::resolveContacts(void)
+{
+   solver.clear();
+   solver.reset();
+
+   for(size_t c = 0; c < cluster.size(); c++)
+   {
+      int a = cluster[c];
+      for(int b = 0; b < world.numBalls; b++)
+      {
+         if(b == a || !isLive(b))
+            continue;
+
+         double dx = balls.px[a] - balls.px[b];
+         double dy = balls.py[a] - balls.py[b];
+         double reach = balls.r[a] + balls.r[b] + CONTACT_SLOP;
+         if(dx * dx + dy * dy > reach * reach)
+            continue;
+
+         size_t seen = std::find(cluster.begin(), cluster.end(), b) -
+                       cluster.begin();
+         if(seen == cluster.size())
+            cluster.push_back(b);
+         if(seen > c)
+            solver.add(std::min(a, b), std::max(a, b));
+      }
+   }
+   solver.solve(balls, world.elasticity);
+}
+
+
+/***********************************************************************
+ * Main loop
+ ***********************************************************************/
+
+/* Out of events: tick the rest of the run on the fixed timestep, from
+ * the moment reached, with every ball awake.
+ */
+
+double EventSimulator::finishStepped(double maxTime)
+{
+   steppedFinish = true;
+   world.wakeAll();
+
+   while(now < maxTime && world.isMoving())
+   {
+      world.tick();
+      now += world.tickDt;
+   }
+   return now;
+}
+
+double EventSimulator::simulateUntilRest(double maxTime)
+{
+   const Table& table = world.table;
+
+   now = 0.0;
+   events = 0;
+   steppedFinish = false;
+   counts.assign(world.numBalls, 0);
+   queue = std::priority_queue<Event>();
+
+   for(int i = 0; i < world.numBalls; i++)
+   {
+      if(isLive(i))
+         predict(i);
+   }
+
+   while(true)
+   {
+      double limit = restTime();
+      if(limit > maxTime)
+         limit = maxTime;
+
+      /* Drop events made stale by an earlier contact. */
+
+      while(!queue.empty() &&
+            (queue.top().ballCount != count(queue.top().ball) ||
+             queue.top().otherCount != count(queue.top().other)))
+         queue.pop();
+
+      if(queue.empty() || queue.top().time > limit)
+      {
+         advanceTo(limit);
+         break;
+      }
+      if(events >= maxEvents)
+         return finishStepped(maxTime);
+
+      Event e = queue.top();
+      queue.pop();
+      advanceTo(e.time);
+
+      int i = e.ball;
+      cluster.assign(1, i);
+      switch(e.other)
+      {
+         case LEFT_CUSHION:
+            balls.vx[i] = -balls.vx[i];
+            balls.px[i] = table.ll.x + balls.r[i];
+            break;
+         case RIGHT_CUSHION:
+            balls.vx[i] = -balls.vx[i];
+            balls.px[i] = table.ur.x - balls.r[i];
+            break;
+         case BOTTOM_CUSHION:
+            balls.vy[i] = -balls.vy[i];
+            balls.py[i] = table.ll.y + balls.r[i];
+            break;
+         case TOP_CUSHION:
+            balls.vy[i] = -balls.vy[i];
+            balls.py[i] = table.ur.y - balls.r[i];
+            break;
+         default:
+            if(e.other <= FIRST_POCKET)
+               world.sink(i, FIRST_POCKET - e.other);
+            else
+            {
+               cluster.push_back(e.other);
+               if(world.useContactSolver)
+                  resolveContacts();
+               else
+                  world.collisionResponse(i, e.other);
+               world.contacts++;
+            }
+            break;
+      }
+      events++;
+
+      /* Everything in the contact moves off on a new line. */
+
+      for(size_t c = 0; c < cluster.size(); c++)
+      {
+         counts[cluster[c]]++;
+         if(isLive(cluster[c]))
+            predict(cluster[c]);
+      }
+   }
+   return now;
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *  EventSimulator.h
+ *
+ *  Event-driven engine for PoolWorld.  With the friction model of tick()
+ *  taken to its continuous limit, v(t) = v0 e^(-ft), every ball moves in a
+ *  straight line and covers (1 - e^(-ft)) / f times its velocity by time
+ *  t.  The next ball-ball, ball-cushion and ball-pocket contacts can then
+ *  be solved for in closed form.  Predicted contacts wait in a priority
+ *  queue and the simulation jumps straight from one to the next, so the
+ *  cost of a shot depends on the number of contacts rather than on its
+ *  length, and nothing can tunnel however hard the cue ball is hit.
+ *  With the world's useContactSolver, contacts that happen at the same
+ *  moment (ball 4 meeting 6 and 7 on the break) go through the contact
+ *  solver together, as one step of the stepped engine resolves them,
+ *  rather than one pair after the other.
+ ******************************************************************************/
+
+#ifndef __EVENT_SIMULATOR_H__
+#define __EVENT_SIMULATOR_H__
+
+#include "PoolWorld.h"
+#include <queue>
+#include <vector>
+
+
+/* MAX_EVENTS is the default budget of contacts for one run.  Balls
+ * resting against each other can meet again and again with no time
+ * passing between, which would otherwise keep the run going forever.
+ */
+
+const long MAX_EVENTS = 100000;
+
+
+class EventSimulator
+{
+public:
+   EventSimulator(PoolWorld& world);
+
+   /* Run the world's current state until every ball has stopped, as
+    * PoolWorld::isMoving() defines it, or until maxTime seconds have
+    * passed.  Returns the simulated time.  Once maxEvents contacts have
+    * been resolved, the rest of the run is ticked on the world's fixed
+    * timestep instead, and steppedFinish is set.
+    */
+
+   double simulateUntilRest(double maxTime = MAX_SHOT_TIME);
+
+   long maxEvents;
+
+   /* Contacts resolved by the last run, and whether it ran out of them. */
+
+   long events;
+   bool steppedFinish;
+
+private:
+   /* other is a ball index, or one of the cushion or pocket codes in
+    * EventSimulator.cpp.  The counts are those of the two balls
+    * when the event was predicted; if either ball has been in a contact
+    * since, the event is stale.
+    */
+
+   struct Event
+   {
+      double time;
+      int ball, other;
+      long ballCount, otherCount;
+
+      bool operator < (const Event& e) const
+         { return time > e.time; }
+   };
+
+   void advanceTo(double t);
+   double finishStepped(double maxTime);
+   double elapsedToTravel(double tau) const;
+   double restTime(void) const;
+   void predict(int i);
+   void resolveContacts(void);
+   void schedule(double dt, int ball, int other);
+   bool isLive(int i) const;
+   long count(int i) const;
+
+   PoolWorld& world;
+   BallStore& balls;
+   double now;
+   std::vector<long> counts;
+   std::priority_queue<Event> queue;
+   ContactSolver solver;
+   std::vector<int> cluster;
+};
+
+#endif // __EVENT_SIMULATOR_H__
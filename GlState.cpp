@@ -0,0 +1,138 @@
+/******************************************************************************
+ *  GlState.cpp
+ ******************************************************************************/
+
+#include "GlState.h"
+#include <cstring>
+
+
+GlState::GlState()
+{
+   issued = skipped = 0;
+   frameIssued = frameSkipped = 0;
+   frameStartIssued = frameStartSkipped = 0;
+   reset();
+}
+
+
+void GlState::reset(void)
+{
+   program = vao = 0;
+   arrayBuffer = uniformBuffer = pixelBuffer = 0;
+   ints.clear();
+   attributes.clear();
+   memset(&constants, 0, sizeof(constants));
+   constants.outlineWidth = -1.0;
+}
+
+
+void GlState::useProgram(GLuint p)
+{
+   if(p == program && skip())
+      return;
+   glUseProgram(p);
+   program = p;
+   issued++;
+}
+
+
+void GlState::bindVertexArray(GLuint v)
+{
+   if(v == vao && skip())
+      return;
+   glBindVertexArray(v);
+   vao = v;
+   issued++;
+}
+
+
+/* Only the targets the renderers use are cached; the element array
+ * binding belongs to the vertex array, so it is not.
+ */
+
+void GlState::bindBuffer(GLenum target, GLuint buffer)
+{
+   GLuint* bound = target == GL_ARRAY_BUFFER ? &arrayBuffer :
+                   target == GL_UNIFORM_BUFFER ? &uniformBuffer :
+                   target == GL_PIXEL_PACK_BUFFER ? &pixelBuffer : NULL;
+
+   if(bound != NULL && *bound == buffer && skip())
+      return;
+   glBindBuffer(target, buffer);
+   if(bound != NULL)
+      *bound = buffer;
+   issued++;
+}
+
+
+void GlState::uniform1i(GLint location, GLint value)
+{
+   std::pair<GLuint, GLint> key(program, location);
+   std::map<std::pair<GLuint, GLint>, GLint>::iterator u = ints.find(key);
+
+   if(u != ints.end() && u->second == value && skip())
+      return;
+   glUniform1i(location, value);
+   ints[key] = value;
+   issued++;
+}
+
+
+void GlState::vertexAttrib4f(GLuint index, GLfloat x, GLfloat y, GLfloat z,
+                             GLfloat w)
+{
+   vec4 v(x, y, z, w);
+   std::map<GLuint, vec4>::iterator a = attributes.find(index);
+
+   if(a != attributes.end() && a->second.x == x && a->second.y == y &&
+      a->second.z == z && a->second.w == w && skip())
+      return;
+   glVertexAttrib4f(index, x, y, z, w);
+   attributes[index] = v;
+   issued++;
+}
+
+
+GLuint GlState::createFrameBlock(GpuResources& gpu, GLuint p)
+{
+   GLuint block = gpu.createBuffer(GL_UNIFORM_BUFFER, sizeof(FrameConstants),
+                                   NULL, GL_DYNAMIC_DRAW);
+   uniformBuffer = block;
+
+   GLuint index = glGetUniformBlockIndex(p, "Frame");
+   glUniformBlockBinding(p, index, FRAME_BLOCK_BINDING);
+   glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, block);
+   return block;
+}
+
+
+void GlState::frameConstants(GLuint block, const mat4& projection,
+                             GLfloat outlineWidth)
+{
+   FrameConstants c;
+
+   memset(&c, 0, sizeof(c));
+   for(int r = 0; r < 4; r++)
+   {
+      for(int k = 0; k < 4; k++)
+         c.projection[4 * r + k] = projection[r][k];
+   }
+   c.outlineWidth = outlineWidth;
+
+   if(memcmp(&c, &constants, sizeof(c)) == 0 && skip())
+      return;
+
+   bindBuffer(GL_UNIFORM_BUFFER, block);
+   glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(c), &c);
+   constants = c;
+   issued++;
+}
+
+
+void GlState::endFrame(void)
+{
+   frameIssued = issued - frameStartIssued;
+   frameSkipped = skipped - frameStartSkipped;
+   frameStartIssued = issued;
+   frameStartSkipped = skipped;
+}
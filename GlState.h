@@ -0,0 +1,87 @@
+/******************************************************************************
+ *  GlState.h
+ *
+ *  A thin cache in front of the GL state the renderers change every
+ *  frame: the program, vertex array, buffer bindings, integer uniforms
+ *  and generic vertex attributes.  A call that would set what is already
+ *  set is skipped.  The per-frame constants (projection and pixel width)
+ *  live in a uniform buffer shared by both shaders and are uploaded only
+ *  when they change.
+ *
+ *  Every call made through the cache, and every call counted with
+ *  issue(), is tallied, so the calls a frame issues and the ones it
+ *  skipped can be reported.  State changed behind its back must be
+ *  followed by reset().
+ ******************************************************************************/
+
+#ifndef __GL_STATE_H__
+#define __GL_STATE_H__
+
+#include "GpuResources.h"
+
+
+/* The Frame uniform block of vshader41.glsl and fshader41.glsl, laid
+ * out std140 with the matrix in rows, bound at FRAME_BLOCK_BINDING.
+ */
+
+typedef struct FrameConstants
+{
+   GLfloat projection[16];
+   GLfloat outlineWidth;
+   GLfloat pad[3];
+} FrameConstants;
+
+const GLuint FRAME_BLOCK_BINDING = 0;
+
+
+class GlState
+{
+public:
+   GlState();
+
+   void useProgram(GLuint program);
+   void bindVertexArray(GLuint vao);
+   void bindBuffer(GLenum target, GLuint buffer);
+   void uniform1i(GLint location, GLint value);
+   void vertexAttrib4f(GLuint index, GLfloat x, GLfloat y, GLfloat z,
+                       GLfloat w);
+
+   /* Create program's Frame block in a buffer owned by gpu, bound at
+    * FRAME_BLOCK_BINDING, and set the constants in it.
+    */
+
+   GLuint createFrameBlock(GpuResources& gpu, GLuint program);
+   void frameConstants(GLuint block, const mat4& projection,
+                       GLfloat outlineWidth);
+
+   /* Count calls made straight to GL. */
+
+   void issue(int calls = 1)
+      { issued += calls; }
+
+   /* Forget everything cached. */
+
+   void reset(void);
+
+   /* Close a frame: frameIssued and frameSkipped become the calls since
+    * the last endFrame().  issued and skipped are the running totals.
+    */
+
+   void endFrame(void);
+
+   long issued, skipped;
+   long frameIssued, frameSkipped;
+
+private:
+   bool skip(void)
+      { skipped++; return true; }
+
+   GLuint program, vao;
+   GLuint arrayBuffer, uniformBuffer, pixelBuffer;
+   std::map<std::pair<GLuint, GLint>, GLint> ints;
+   std::map<GLuint, vec4> attributes;
+   FrameConstants constants;
+   long frameStartIssued, frameStartSkipped;
+};
+
+#endif // __GL_STATE_H__
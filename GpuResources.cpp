@@ -0,0 +1,211 @@
+/******************************************************************************
+ *  GpuResources.cpp
+ ******************************************************************************/
+
+#include "GpuResources.h"
+#include <cstddef>
+#include <cstring>
+
+const int MESH_CIRCLE = 0;
+const int MESH_QUAD = 1;
+
+
+bool MeshKey::operator < (const MeshKey& k) const
+{
+   if(kind != k.kind)
+      return kind < k.kind;
+   if(slices != k.slices)
+      return slices < k.slices;
+   if(primitive != k.primitive)
+      return primitive < k.primitive;
+   return memcmp(corners, k.corners, sizeof(corners)) < 0;
+}
+
+
+GpuResources::GpuResources()
+{
+   liveMeshes = 0;
+   totalBytes = 0;
+}
+
+
+int GpuResources::circle(GLuint program, int slices, GLenum primitive)
+{
+   MeshKey key = { MESH_CIRCLE, slices, primitive, { 0.0, 0.0, 0.0, 0.0 } };
+
+   int h = find(key);
+   if(h >= 0)
+      return h;
+
+   std::vector<vec4> points;
+   GLfloat sliceAngle = 2.0 * M_PI / (GLfloat) slices;
+
+   if(primitive == GL_TRIANGLE_STRIP)
+   {
+      for(int i = 0; i <= slices; i++)
+      {
+         GLfloat angle = (i % slices) * sliceAngle;
+         points.push_back(vec4(cos(angle), sin(angle), 0.0, 1.0));
+         points.push_back(vec4(cos(angle), sin(angle), 1.0, 1.0));
+      }
+   }
+   else
+   {
+      for(int i = 0; i < slices; i++)
+      {
+         GLfloat angle = i * sliceAngle;
+         points.push_back(vec4(cos(angle), sin(angle), 1.0, 1.0));
+      }
+   }
+   return build(key, program, points);
+}
+
+
+int GpuResources::quad(GLuint program, const vec2& ll, const vec2& ur)
+{
+   MeshKey key = { MESH_QUAD, 4, GL_TRIANGLE_FAN,
+                   { ll.x, ll.y, ur.x, ur.y } };
+
+   int h = find(key);
+   if(h >= 0)
+      return h;
+
+   std::vector<vec4> points;
+   points.push_back(vec4(ll.x, ll.y, 1.0, 1.0));
+   points.push_back(vec4(ur.x, ll.y, 1.0, 1.0));
+   points.push_back(vec4(ur.x, ur.y, 1.0, 1.0));
+   points.push_back(vec4(ll.x, ur.y, 1.0, 1.0));
+   return build(key, program, points);
+}
+
+
+void GpuResources::retain(int handle)
+{
+   meshes[handle].references++;
+}
+
+
+void GpuResources::release(int handle)
+{
+   Mesh& m = meshes[handle];
+   if(m.references == 0 || --m.references > 0)
+      return;
+
+   glDeleteVertexArrays(1, &m.vao);
+   deleteBuffer(m.buffer);
+   byKey.erase(keys[handle]);
+   m.vao = m.buffer = 0;
+   liveMeshes--;
+}
+
+
+GLuint GpuResources::createBuffer(GLenum target, GLsizeiptr bytes,
+                                  const void* data, GLenum usage)
+{
+   GLuint buffer;
+
+   glGenBuffers(1, &buffer);
+   glBindBuffer(target, buffer);
+   glBufferData(target, bytes, data, usage);
+
+   bufferBytes[buffer] = bytes;
+   totalBytes += bytes;
+   return buffer;
+}
+
+
+GLuint GpuResources::createStorage(GLenum target, GLsizeiptr bytes,
+                                   GLbitfield flags)
+{
+   GLuint buffer;
+
+   glGenBuffers(1, &buffer);
+   glBindBuffer(target, buffer);
+   glBufferStorage(target, bytes, NULL, flags);
+
+   bufferBytes[buffer] = bytes;
+   totalBytes += bytes;
+   return buffer;
+}
+
+
+void GpuResources::deleteBuffer(GLuint buffer)
+{
+   std::map<GLuint, GLsizeiptr>::iterator b = bufferBytes.find(buffer);
+   if(b == bufferBytes.end())
+      return;
+
+   totalBytes -= b->second;
+   bufferBytes.erase(b);
+   glDeleteBuffers(1, &buffer);
+}
+
+
+/* The live mesh built from key, with one more reference, or -1. */
+
+int GpuResources::find(const MeshKey& key)
+{
+   std::map<MeshKey, int>::iterator k = byKey.find(key);
+   if(k == byKey.end())
+      return -1;
+
+   retain(k->second);
+   return k->second;
+}
+
+
+/* Upload points as a new mesh for key, in the first free slot. */
+
+int GpuResources::build(const MeshKey& key, GLuint program,
+                        const std::vector<vec4>& points)
+{
+   int h = 0;
+   while(h < (int) meshes.size() && meshes[h].references > 0)
+      h++;
+   if(h == (int) meshes.size())
+   {
+      meshes.push_back(Mesh());
+      keys.push_back(key);
+   }
+
+   Mesh& m = meshes[h];
+   m.primitive = key.primitive;
+   m.numVertices = points.size();
+   m.bytes = points.size() * sizeof(vec4);
+   m.references = 1;
+
+   glGenVertexArrays(1, &m.vao);
+   glBindVertexArray(m.vao);
+   m.buffer = createBuffer(GL_ARRAY_BUFFER, m.bytes, &points[0],
+                           GL_STATIC_DRAW);
+
+   GLuint vPosition = glGetAttribLocation(program, "vPosition");
+   glEnableVertexAttribArray(vPosition);
+   glVertexAttribPointer(vPosition, 4, GL_FLOAT, GL_FALSE, 0,
+                         BUFFER_OFFSET(0));
+
+   keys[h] = key;
+   byKey[key] = h;
+   liveMeshes++;
+   return h;
+}
+
+
+void bindCircleInstances(GLuint program, GLuint buffer)
+{
+   glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+   GLuint vInstance = glGetAttribLocation(program, "vInstance");
+   glEnableVertexAttribArray(vInstance);
+   glVertexAttribPointer(vInstance, 4, GL_FLOAT, GL_FALSE,
+                         sizeof(CircleInstance),
+                         BUFFER_OFFSET(offsetof(CircleInstance, x)));
+   glVertexAttribDivisor(vInstance, 1);
+
+   GLuint vColor = glGetAttribLocation(program, "vColor");
+   glEnableVertexAttribArray(vColor);
+   glVertexAttribPointer(vColor, 4, GL_FLOAT, GL_FALSE,
+                         sizeof(CircleInstance),
+                         BUFFER_OFFSET(offsetof(CircleInstance, r)));
+   glVertexAttribDivisor(vColor, 1);
+}
@@ -0,0 +1,115 @@
+/******************************************************************************
+ *  GpuResources.h
+ *
+ *  Owns the GL buffers and vertex arrays the game draws with.  Meshes are
+ *  built once per distinct shape and shared: asking again for a circle
+ *  with the same slices and primitive, or a quad with the same corners,
+ *  hands back the mesh already built with its reference count raised.
+ *  release() drops a reference and deletes the vertex array and buffer
+ *  with the last one.  Other buffers (the instance stream) are created
+ *  and deleted here too, so the counts and bytes reported are everything
+ *  the game holds on the GPU.
+ *
+ *  Meshes are unit shapes in vPosition (a vec4): radius and position
+ *  come from the instance, see vshader41.glsl.
+ ******************************************************************************/
+
+#ifndef __GPU_RESOURCES_H__
+#define __GPU_RESOURCES_H__
+
+#include "Angel.h"
+#include "InstanceShadow.h"
+#include <map>
+#include <vector>
+
+
+typedef struct Mesh
+{
+   GLuint vao;
+   GLuint buffer;
+   GLenum primitive;
+   GLsizei numVertices;
+   GLsizeiptr bytes;
+   int references;
+} Mesh;
+
+
+/* What a mesh is built from; meshes with equal keys are the same mesh. */
+
+typedef struct MeshKey
+{
+   int kind;
+   int slices;
+   GLenum primitive;
+   GLfloat corners[4];
+
+   bool operator < (const MeshKey& k) const;
+} MeshKey;
+
+
+class GpuResources
+{
+public:
+   GpuResources();
+
+   /* A unit circle of slices segments, with vPosition bound for program.
+    * As a GL_TRIANGLE_STRIP it alternates hub and rim vertices, with
+    * vPosition.z 0 at the hub and 1 on the rim; as a GL_TRIANGLE_FAN or
+    * GL_LINE_LOOP it is just the rim.  Returns a handle holding one
+    * reference.
+    */
+
+   int circle(GLuint program, int slices, GLenum primitive);
+
+   /* The rectangle from ll to ur as a GL_TRIANGLE_FAN, each corner with
+    * vPosition.z 1 so it draws as a circle of radius 1 at the origin.
+    */
+
+   int quad(GLuint program, const vec2& ll, const vec2& ur);
+
+   const Mesh& mesh(int handle) const
+      { return meshes[handle]; }
+
+   void retain(int handle);
+   void release(int handle);
+
+   /* A buffer of bytes bound to target, filled from data (which may be
+    * NULL) with glBufferData; createStorage() makes an immutable one
+    * with glBufferStorage and flags instead.  Either is left bound.
+    */
+
+   GLuint createBuffer(GLenum target, GLsizeiptr bytes, const void* data,
+                       GLenum usage);
+   GLuint createStorage(GLenum target, GLsizeiptr bytes, GLbitfield flags);
+   void deleteBuffer(GLuint buffer);
+
+   /* What is held now. */
+
+   int buffers(void) const
+      { return (int) bufferBytes.size(); }
+   int vertexArrays(void) const
+      { return liveMeshes; }
+   GLsizeiptr bytes(void) const
+      { return totalBytes; }
+
+private:
+   int find(const MeshKey& key);
+   int build(const MeshKey& key, GLuint program,
+             const std::vector<vec4>& points);
+
+   std::vector<Mesh> meshes;
+   std::vector<MeshKey> keys;
+   std::map<MeshKey, int> byKey;
+   std::map<GLuint, GLsizeiptr> bufferBytes;
+   int liveMeshes;
+   GLsizeiptr totalBytes;
+};
+
+
+/* Feed program's vInstance and vColor in the bound vao from the
+ * CircleInstance array in buffer, advancing once per circle.
+ */
+
+void bindCircleInstances(GLuint program, GLuint buffer);
+
+#endif // __GPU_RESOURCES_H__
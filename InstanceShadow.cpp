@@ -0,0 +1,139 @@
+/******************************************************************************
+ *  InstanceShadow.cpp
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "InstanceShadow.h"
+#include <algorithm>
+#include <cstring>
+
+
+/* Add circle k to the runs if it differs from the shadow.  Circles past
+ * the known ones were never written, so they count as changed.
+ */
+
+void InstanceShadow::compare(const CircleInstance* circles, int k, int known)
+{
+   if(k < known &&
+      memcmp(&circles[k], &shadow[k], sizeof(CircleInstance)) == 0)
+      return;
+
+   if(!changed.empty())
+   {
+      InstanceRun& last = changed.back();
+      if(k - (last.first + last.count) <= RUN_GAP)
+      {
+         last.count = k - last.first + 1;
+         return;
+      }
+   }
+   InstanceRun run = { k, 1 };
+   changed.push_back(run);
+}
+
+
+size_t InstanceShadow::write(const CircleInstance* circles,
+                             CircleInstance* buffer)
+{
+   size_t bytes = 0;
+
+   for(size_t r = 0; r < changed.size(); r++)
+   {
+      const InstanceRun& run = changed[r];
+      size_t size = run.count * sizeof(CircleInstance);
+
+      memcpy(&shadow[run.first], &circles[run.first], size);
+      if(buffer != NULL)
+         memcpy(buffer + run.first, &circles[run.first], size);
+      bytes += size;
+   }
+   return bytes;
+}
+
+
+size_t InstanceShadow::update(const CircleInstance* circles, int n,
+                              CircleInstance* buffer)
+{
+   int known = (int) shadow.size();
+   if(known < n)
+      shadow.resize(n);
+
+   changed.clear();
+   for(int k = 0; k < n; k++)
+   {
+      compare(circles, k, known);
+   }
+   written = 0;
+   return write(circles, buffer);
+}
+
+
+size_t InstanceShadow::update(const CircleInstance* circles, int n,
+                              CircleInstance* buffer, const int* listed,
+                              int count, long since, long serial)
+{
+   int known = (int) shadow.size();
+
+   /* A buffer that is unknown or older than the list is compared whole. */
+
+   if(written <= 0 || written < since || known < n)
+   {
+      size_t bytes = update(circles, n, buffer);
+      written = serial;
+      return bytes;
+   }
+
+   changed.clear();
+   for(int c = 0; c < count && listed[c] < n; c++)
+   {
+      compare(circles, listed[c], known);
+   }
+   written = serial;
+   return write(circles, buffer);
+}
+
+
+/***********************************************************************
+ * InstanceChanges
+ ***********************************************************************/
+
+void InstanceChanges::resize(int n)
+{
+   int old = (int) stamps.size();
+
+   stamps.resize(n, current - WINDOW);
+   for(int k = old; k < n; k++)
+   {
+      mark(k);
+   }
+}
+
+
+void InstanceChanges::markAll(void)
+{
+   for(int k = 0; k < (int) stamps.size(); k++)
+   {
+      mark(k);
+   }
+}
+
+
+/* Finish the serial being marked: drop the circles last marked
+ * WINDOW serials ago or more, and put the rest back in order.
+ */
+
+void InstanceChanges::close(void)
+{
+   current++;
+
+   size_t kept = 0;
+   for(size_t c = 0; c < recent.size(); c++)
+   {
+      if(recent[c] < (int) stamps.size() &&
+         stamps[recent[c]] > current - WINDOW)
+         recent[kept++] = recent[c];
+   }
+   recent.resize(kept);
+   std::sort(recent.begin(), recent.end());
+}
@@ -0,0 +1,140 @@
+/******************************************************************************
+ *  InstanceShadow.h
+ *
+ *  Keeps a copy of the circles last written to one instance buffer (or
+ *  one region of the ring), so the next frame only writes the circles
+ *  that changed since.  Comparing against what the buffer holds catches
+ *  every kind of change, a ball moving, growing in ballSizeUp(), going
+ *  into a pocket or being racked, with nothing for those to report, and
+ *  stays right for a ring region that was last written several frames
+ *  ago.  No GL here: the caller writes into mapped memory or uploads the
+ *  runs itself.
+ *
+ *  Comparing every circle costs more than copying it, so a caller that
+ *  knows which circles can have changed keeps an InstanceChanges as well:
+ *  then only the circles it lists are compared, and balls at rest cost
+ *  nothing.
+ ******************************************************************************/
+
+#ifndef __INSTANCE_SHADOW_H__
+#define __INSTANCE_SHADOW_H__
+
+#include "Angel.h"
+#include <cstddef>
+#include <vector>
+
+
+/* One circle in an instanced draw: its centre, radius, color and
+ * geometry flag.  outline is 1 for a circle drawn as just its rim (the
+ * aiming circle), 0 for a filled one.
+ */
+
+typedef struct CircleInstance
+{
+   GLfloat x, y;
+   GLfloat radius;
+   GLfloat outline;
+   GLfloat r, g, b, a;
+} CircleInstance;
+
+
+/* A run of changed circles: count of them from first. */
+
+typedef struct InstanceRun
+{
+   int first;
+   int count;
+} InstanceRun;
+
+
+class InstanceShadow
+{
+public:
+   /* Changed circles up to RUN_GAP apart are written as one run, with
+    * the unchanged ones between, to keep the number of uploads down.
+    */
+
+   static const int RUN_GAP = 8;
+
+   InstanceShadow()
+      : written(0) {}
+
+   /* Bring the buffer shadowed here up to date with circles[0, n): each
+    * run that differs is copied to buffer, unless it is NULL, and to the
+    * shadow, and listed in runs().  Returns the bytes written.
+    */
+
+   size_t update(const CircleInstance* circles, int n,
+                 CircleInstance* buffer);
+
+   /* The same as of serial, given listed[0, count), in increasing order,
+    * as every circle that changed after since (an InstanceChanges' list(),
+    * since() and serial()).  Only those are compared if the buffer was
+    * last brought up to date at since or later.
+    */
+
+   size_t update(const CircleInstance* circles, int n,
+                 CircleInstance* buffer, const int* listed, int count,
+                 long since, long serial);
+
+   const std::vector<InstanceRun>& runs(void) const
+      { return changed; }
+
+   /* The buffer's contents are unknown: write everything next time. */
+
+   void invalidate(void)
+      { shadow.clear(); written = 0; }
+
+private:
+   void compare(const CircleInstance* circles, int k, int known);
+   size_t write(const CircleInstance* circles, CircleInstance* buffer);
+
+   std::vector<CircleInstance> shadow;
+   long written;
+   std::vector<InstanceRun> changed;
+};
+
+
+/* Which circles changed over the last WINDOW serials.  Whoever builds
+ * the circles marks each one that may have changed, then close()s the
+ * serial; list() then holds every circle marked after since(), in
+ * increasing order.  Marking only the balls that are awake, or were at
+ * the last serial, keeps the cost to the balls that move.
+ */
+
+class InstanceChanges
+{
+public:
+   static const long WINDOW = 16;
+
+   InstanceChanges()
+      : current(0) {}
+
+   /* Track n circles.  Any added are marked. */
+
+   void resize(int n);
+
+   void mark(int k)
+   {
+      if(stamps[k] <= current - WINDOW)
+         recent.push_back(k);
+      stamps[k] = current + 1;
+   }
+
+   void markAll(void);
+   void close(void);
+
+   const std::vector<int>& list(void) const
+      { return recent; }
+   long since(void) const
+      { return current - WINDOW; }
+   long serial(void) const
+      { return current; }
+
+private:
+   long current;
+   std::vector<long> stamps;
+   std::vector<int> recent;
+};
+
+#endif // __INSTANCE_SHADOW_H__
@@ -0,0 +1,310 @@
+/******************************************************************************
+ *  Kernels.cpp
+ *
+ *  Scalar, SSE2 and AVX2 versions of the integrate and cushion loops.  The
+ *  vector versions are compiled with per-function target attributes, so
+ *  no special compiler flags are needed and the binary still runs on CPUs
+ *  without AVX2.  Neither uses fused multiply-add, which keeps them
+ *  bit-identical to the scalar code.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "Kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+/***********************************************************************
+ * Scalar
+ ***********************************************************************/
+
+static void integrateScalar(double* px, double* py, double* vx, double* vy,
+                            int n, double dt, double damping)
+{
+   for (int i = 0; i < n; ++i)
+   {
+      px[i] += vx[i] * dt;
+      py[i] += vy[i] * dt;
+      vx[i] *= damping;
+      vy[i] *= damping;
+   }
+}
+
+static inline void bounceOne(double& x, double& y, double& u, double& v,
+                             double r, double llx, double lly,
+                             double urx, double ury)
+{
+   if (x + r > urx)
+   {
+      u = -u;
+      x = urx - r;
+   }
+   else if (y + r > ury)
+   {
+      v = -v;
+      y = ury - r;
+   }
+   else if (x - r < llx)
+   {
+      u = -u;
+      x = llx + r;
+   }
+   else if (y - r < lly)
+   {
+      v = -v;
+      y = lly + r;
+   }
+}
+
+void bounceBall(double& x, double& y, double& u, double& v, double r,
+                double llx, double lly, double urx, double ury)
+{
+   bounceOne(x, y, u, v, r, llx, lly, urx, ury);
+}
+
+static void bounceScalar(double* px, double* py, double* vx, double* vy,
+                         const double* r, const FlagBits& skip, int n,
+                         double llx, double lly, double urx, double ury)
+{
+   for(int j = 0; j < n; j++)
+   {
+      if(!skip.test(j))
+         bounceOne(px[j], py[j], vx[j], vy[j], r[j], llx, lly, urx, ury);
+   }
+}
+
+static const Kernels scalar = { "scalar", integrateScalar, bounceScalar };
+
+const Kernels* scalarKernels(void)
+{
+   return &scalar;
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/* The skip bits for balls i .. i+lanes-1, i a multiple of lanes. */
+
+static inline unsigned skipBits(const FlagBits& skip, int i, int lanes)
+{
+   return (unsigned) (skip.words[i >> 6] >> (i & 63)) & ((1u << lanes) - 1);
+}
+
+
+/***********************************************************************
+ * SSE2: two balls per instruction.  SSE2 has no blend, so selects are
+ * done with and/andnot/or.
+ ***********************************************************************/
+
+__attribute__((target("sse2")))
+static inline __m128d select2(__m128d mask, __m128d a, __m128d b)
+{
+   return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+__attribute__((target("sse2")))
+static void integrateSSE2(double* px, double* py, double* vx, double* vy,
+                          int n, double dt, double damping)
+{
+   const __m128d h = _mm_set1_pd(dt);
+   const __m128d d = _mm_set1_pd(damping);
+   int i = 0;
+
+   for (; i + 2 <= n; i += 2)
+   {
+      __m128d x = _mm_loadu_pd(px + i), y = _mm_loadu_pd(py + i);
+      __m128d u = _mm_loadu_pd(vx + i), v = _mm_loadu_pd(vy + i);
+      _mm_storeu_pd(px + i, _mm_add_pd(x, _mm_mul_pd(u, h)));
+      _mm_storeu_pd(py + i, _mm_add_pd(y, _mm_mul_pd(v, h)));
+      _mm_storeu_pd(vx + i, _mm_mul_pd(u, d));
+      _mm_storeu_pd(vy + i, _mm_mul_pd(v, d));
+   }
+   integrateScalar(px + i, py + i, vx + i, vy + i, n - i, dt, damping);
+}
+
+__attribute__((target("sse2")))
+static void bounceSSE2(double* px, double* py, double* vx, double* vy,
+                       const double* r, const FlagBits& skip, int n,
+                       double llx, double lly, double urx, double ury)
+{
+   const __m128d left = _mm_set1_pd(llx), bottom = _mm_set1_pd(lly);
+   const __m128d right = _mm_set1_pd(urx), top = _mm_set1_pd(ury);
+   const __m128d sign = _mm_set1_pd(-0.0);
+   int i = 0;
+
+   for (; i + 2 <= n; i += 2)
+   {
+      __m128d x = _mm_loadu_pd(px + i), y = _mm_loadu_pd(py + i);
+      __m128d u = _mm_loadu_pd(vx + i), v = _mm_loadu_pd(vy + i);
+      __m128d rad = _mm_loadu_pd(r + i);
+
+      /* done marks lanes already handled: skipped balls, then each
+       * cushion in turn, so only the first cushion crossed counts.
+       */
+
+      unsigned bits = skipBits(skip, i, 2);
+      __m128d done = _mm_castsi128_pd(_mm_set_epi64x(
+         (bits & 2) ? -1 : 0, (bits & 1) ? -1 : 0));
+
+      __m128d hitR = _mm_andnot_pd(done,
+                        _mm_cmpgt_pd(_mm_add_pd(x, rad), right));
+      done = _mm_or_pd(done, hitR);
+      __m128d hitT = _mm_andnot_pd(done,
+                        _mm_cmpgt_pd(_mm_add_pd(y, rad), top));
+      done = _mm_or_pd(done, hitT);
+      __m128d hitL = _mm_andnot_pd(done,
+                        _mm_cmplt_pd(_mm_sub_pd(x, rad), left));
+      done = _mm_or_pd(done, hitL);
+      __m128d hitB = _mm_andnot_pd(done,
+                        _mm_cmplt_pd(_mm_sub_pd(y, rad), bottom));
+
+      x = select2(hitR, _mm_sub_pd(right, rad), x);
+      x = select2(hitL, _mm_add_pd(left, rad), x);
+      y = select2(hitT, _mm_sub_pd(top, rad), y);
+      y = select2(hitB, _mm_add_pd(bottom, rad), y);
+      u = _mm_xor_pd(u, _mm_and_pd(_mm_or_pd(hitR, hitL), sign));
+      v = _mm_xor_pd(v, _mm_and_pd(_mm_or_pd(hitT, hitB), sign));
+
+      _mm_storeu_pd(px + i, x);
+      _mm_storeu_pd(py + i, y);
+      _mm_storeu_pd(vx + i, u);
+      _mm_storeu_pd(vy + i, v);
+   }
+   for (; i < n; i++)
+   {
+      if(!skip.test(i))
+         bounceOne(px[i], py[i], vx[i], vy[i], r[i], llx, lly, urx, ury);
+   }
+}
+
+static const Kernels sse2 = { "sse2", integrateSSE2, bounceSSE2 };
+
+
+/***********************************************************************
+ * AVX2: four balls per instruction.
+ ***********************************************************************/
+
+__attribute__((target("avx2")))
+static void integrateAVX2(double* px, double* py, double* vx, double* vy,
+                          int n, double dt, double damping)
+{
+   const __m256d h = _mm256_set1_pd(dt);
+   const __m256d d = _mm256_set1_pd(damping);
+   int i = 0;
+
+   for (; i + 4 <= n; i += 4)
+   {
+      __m256d x = _mm256_loadu_pd(px + i), y = _mm256_loadu_pd(py + i);
+      __m256d u = _mm256_loadu_pd(vx + i), v = _mm256_loadu_pd(vy + i);
+      _mm256_storeu_pd(px + i, _mm256_add_pd(x, _mm256_mul_pd(u, h)));
+      _mm256_storeu_pd(py + i, _mm256_add_pd(y, _mm256_mul_pd(v, h)));
+      _mm256_storeu_pd(vx + i, _mm256_mul_pd(u, d));
+      _mm256_storeu_pd(vy + i, _mm256_mul_pd(v, d));
+   }
+   integrateScalar(px + i, py + i, vx + i, vy + i, n - i, dt, damping);
+}
+
+__attribute__((target("avx2")))
+static void bounceAVX2(double* px, double* py, double* vx, double* vy,
+                       const double* r, const FlagBits& skip, int n,
+                       double llx, double lly, double urx, double ury)
+{
+   const __m256d left = _mm256_set1_pd(llx), bottom = _mm256_set1_pd(lly);
+   const __m256d right = _mm256_set1_pd(urx), top = _mm256_set1_pd(ury);
+   const __m256d sign = _mm256_set1_pd(-0.0);
+   const __m256i laneBit = _mm256_set_epi64x(8, 4, 2, 1);
+   int i = 0;
+
+   for (; i + 4 <= n; i += 4)
+   {
+      __m256d x = _mm256_loadu_pd(px + i), y = _mm256_loadu_pd(py + i);
+      __m256d u = _mm256_loadu_pd(vx + i), v = _mm256_loadu_pd(vy + i);
+      __m256d rad = _mm256_loadu_pd(r + i);
+
+      /* done marks lanes already handled: skipped balls, then each
+       * cushion in turn, so only the first cushion crossed counts.
+       */
+
+      __m256i bits = _mm256_set1_epi64x(skipBits(skip, i, 4));
+      __m256d done = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                        _mm256_and_si256(bits, laneBit), laneBit));
+
+      __m256d hitR = _mm256_andnot_pd(done, _mm256_cmp_pd(
+                        _mm256_add_pd(x, rad), right, _CMP_GT_OQ));
+      done = _mm256_or_pd(done, hitR);
+      __m256d hitT = _mm256_andnot_pd(done, _mm256_cmp_pd(
+                        _mm256_add_pd(y, rad), top, _CMP_GT_OQ));
+      done = _mm256_or_pd(done, hitT);
+      __m256d hitL = _mm256_andnot_pd(done, _mm256_cmp_pd(
+                        _mm256_sub_pd(x, rad), left, _CMP_LT_OQ));
+      done = _mm256_or_pd(done, hitL);
+      __m256d hitB = _mm256_andnot_pd(done, _mm256_cmp_pd(
+                        _mm256_sub_pd(y, rad), bottom, _CMP_LT_OQ));
+
+      x = _mm256_blendv_pd(x, _mm256_sub_pd(right, rad), hitR);
+      x = _mm256_blendv_pd(x, _mm256_add_pd(left, rad), hitL);
+      y = _mm256_blendv_pd(y, _mm256_sub_pd(top, rad), hitT);
+      y = _mm256_blendv_pd(y, _mm256_add_pd(bottom, rad), hitB);
+      u = _mm256_xor_pd(u, _mm256_and_pd(_mm256_or_pd(hitR, hitL), sign));
+      v = _mm256_xor_pd(v, _mm256_and_pd(_mm256_or_pd(hitT, hitB), sign));
+
+      _mm256_storeu_pd(px + i, x);
+      _mm256_storeu_pd(py + i, y);
+      _mm256_storeu_pd(vx + i, u);
+      _mm256_storeu_pd(vy + i, v);
+   }
+   for (; i < n; i++)
+   {
+      if(!skip.test(i))
+         bounceOne(px[i], py[i], vx[i], vy[i], r[i], llx, lly, urx, ury);
+   }
+}
+
+static const Kernels avx2 = { "avx2", integrateAVX2, bounceAVX2 };
+
+#endif // HAVE_X86_KERNELS
+
+
+/***********************************************************************
+ * Dispatch
+ ***********************************************************************/
+
+const Kernels* sse2Kernels(void)
+{
+#ifdef HAVE_X86_KERNELS
+   if(__builtin_cpu_supports("sse2"))
+      return &sse2;
+#endif
+   return NULL;
+}
+
+const Kernels* avx2Kernels(void)
+{
+#ifdef HAVE_X86_KERNELS
+   if(__builtin_cpu_supports("avx2"))
+      return &avx2;
+#endif
+   return NULL;
+}
+
+static const Kernels* widestKernels(void)
+{
+   const Kernels* best = avx2Kernels();
+
+   if(best == NULL)
+      best = sse2Kernels();
+   if(best == NULL)
+      best = scalarKernels();
+   return best;
+}
+
+const Kernels* selectKernels(void)
+{
+   static const Kernels* best = widestKernels();
+
+   return best;
+}
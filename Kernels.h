@@ -0,0 +1,59 @@
+/******************************************************************************
+ *  Kernels.h
+ *
+ *  The per-ball inner loops of a simulation step: integrate-and-damp and
+ *  the cushion clamp/reflect.  There is a plain scalar version plus SSE2
+ *  (2 balls per instruction) and AVX2 (4 balls per instruction) versions
+ *  on x86.  The vector versions handle the cushions with masks instead of
+ *  branches.  selectKernels() picks the widest one the CPU supports at run
+ *  time.  Every version gives bit-identical results.
+ ******************************************************************************/
+
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include "BallStore.h"
+
+
+typedef struct Kernels
+{
+   const char* name;
+
+   /* p += v * dt, then v *= damping, for balls 0 .. n-1. */
+
+   void (*integrate)(double* px, double* py, double* vx, double* vy,
+                     int n, double dt, double damping);
+
+   /* For balls 0 .. n-1 not set in skip: a ball past a cushion is
+    * put back against it and its velocity reflected.  Only the first
+    * cushion crossed is handled, checked in the order right, top, left,
+    * bottom.
+    */
+
+   void (*bounce)(double* px, double* py, double* vx, double* vy,
+                  const double* r, const FlagBits& skip, int n,
+                  double llx, double lly, double urx, double ury);
+} Kernels;
+
+
+/* The scalar cushion check for a single ball, for callers that only
+ * visit a scattered few.
+ */
+
+void bounceBall(double& x, double& y, double& u, double& v, double r,
+                double llx, double lly, double urx, double ury);
+
+
+/* The individual versions.  The SSE2 and AVX2 ones return NULL when the
+ * CPU (or compiler) does not support them.
+ */
+
+const Kernels* scalarKernels(void);
+const Kernels* sse2Kernels(void);
+const Kernels* avx2Kernels(void);
+
+/* The widest supported version. */
+
+const Kernels* selectKernels(void);
+
+#endif // __KERNELS_H__
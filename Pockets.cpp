@@ -0,0 +1,76 @@
+/******************************************************************************
+ *  Pockets.cpp
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "Pockets.h"
+#include <algorithm>
+
+
+Pockets::Pockets()
+{
+   clear();
+}
+
+
+void Pockets::clear(void)
+{
+   cx.clear();
+   cy.clear();
+   radius.clear();
+   color.clear();
+
+   /* With no pockets, nothing is ever near one. */
+
+   innerLeft = innerBottom = -HUGE_VAL;
+   innerRight = innerTop = HUGE_VAL;
+}
+
+
+void Pockets::add(double x, double y, double r, Color c)
+{
+   cx.push_back(x);
+   cy.push_back(y);
+   radius.push_back(r);
+   color.push_back(c);
+}
+
+
+/* A point inside pocket p is no further from p's nearest rail than p's
+ * center is, plus p's radius.  The band is the largest such reach.
+ */
+
+void Pockets::prepare(dvec2 ll, dvec2 ur)
+{
+   if(size() == 0)
+      return;
+
+   double band = 0.0;
+   for(int p = 0; p < size(); p++)
+   {
+      double rail = std::min(std::min(cx[p] - ll.x, ur.x - cx[p]),
+                             std::min(cy[p] - ll.y, ur.y - cy[p]));
+      band = std::max(band, rail + radius[p]);
+   }
+   innerLeft = ll.x + band;
+   innerBottom = ll.y + band;
+   innerRight = ur.x - band;
+   innerTop = ur.y - band;
+}
+
+
+int Pockets::find(double x, double y) const
+{
+   if(x > innerLeft && x < innerRight && y > innerBottom && y < innerTop)
+      return -1;
+
+   for(int p = 0; p < size(); p++)
+   {
+      double dx = x - cx[p];
+      double dy = y - cy[p];
+      if(dx * dx + dy * dy <= radius[p] * radius[p])
+         return p;
+   }
+   return -1;
+}
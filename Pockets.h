@@ -0,0 +1,47 @@
+/******************************************************************************
+ *  Pockets.h
+ *
+ *  The table's pockets, as static sensor zones rather than objects in the
+ *  ball table.  A ball has dropped once its center is inside a pocket's
+ *  circle.  Pockets sit on the rails, so a ball further from every rail
+ *  than any pocket reaches cannot be in one; find() rejects those with
+ *  four compares and only checks the pockets for balls near a rail.
+ ******************************************************************************/
+
+#ifndef __POCKETS_H__
+#define __POCKETS_H__
+
+#include "BallStore.h"
+
+
+class Pockets
+{
+public:
+   Pockets();
+
+   void clear(void);
+   void add(double x, double y, double r, Color c);
+
+   /* Work out the band along the rails of the table with corners ll and
+    * ur that the pockets reach into.  Call once every pocket is added.
+    */
+
+   void prepare(dvec2 ll, dvec2 ur);
+
+   int size(void) const
+      { return (int) radius.size(); }
+
+   /* The pocket whose circle holds the point (x, y), or -1. */
+
+   int find(double x, double y) const;
+
+   std::vector<double> cx, cy;
+   std::vector<double> radius;
+   std::vector<Color> color;
+
+   /* No pocket reaches inside this rectangle.  Set by prepare(). */
+
+   double innerLeft, innerBottom, innerRight, innerTop;
+};
+
+#endif // __POCKETS_H__
@@ -0,0 +1,182 @@
+/******************************************************************************
+ *  PoolAllocator.cpp
+ *
+ *  Each thread keeps its own free lists, so the common case of a worker
+ *  freeing one shot's world and allocating the next one's takes no lock.
+ *  A block freed on another thread than it came from just joins that
+ *  thread's lists.
+ ******************************************************************************/
+
+#include "PoolAllocator.h"
+#include <atomic>
+#include <cstdlib>
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+
+/* Size class c holds blocks of 64 << c bytes. */
+
+static const int NUM_CLASSES = 15;
+
+/* Bytes taken from the system and not yet given back.  Only touched on
+ * the slow paths.
+ */
+
+static std::atomic<size_t> heldBytes(0);
+
+
+/* Blocks aligned to POOL_ALIGN straight from the system.  Windows has
+ * no posix_memalign(), and its aligned blocks must be given back with
+ * _aligned_free(), not free().
+ */
+
+static void* alignedAllocate(size_t bytes)
+{
+#ifdef WIN32
+   return _aligned_malloc(bytes ? bytes : 1, POOL_ALIGN);
+#else
+   void* block = NULL;
+   if(posix_memalign(&block, POOL_ALIGN, bytes ? bytes : 1) != 0)
+      return NULL;
+   return block;
+#endif
+}
+
+static void alignedFree(void* block)
+{
+#ifdef WIN32
+   _aligned_free(block);
+#else
+   free(block);
+#endif
+}
+
+
+class ThreadCache
+{
+public:
+   ThreadCache()
+   {
+      for(int c = 0; c < NUM_CLASSES; c++)
+         count[c] = 0;
+      bytes = 0;
+   }
+
+   ~ThreadCache()
+   {
+      trim();
+      gone = true;
+   }
+
+   void trim(void)
+   {
+      for(int c = 0; c < NUM_CLASSES; c++)
+      {
+         for(int b = 0; b < count[c]; b++)
+            alignedFree(blocks[c][b]);
+         heldBytes -= (size_t) count[c] * (POOL_ALIGN << c);
+         count[c] = 0;
+      }
+      bytes = 0;
+   }
+
+   void* blocks[NUM_CLASSES][POOL_MAX_FREE];
+   int count[NUM_CLASSES];
+   size_t bytes;
+
+   /* Set once the cache is destroyed at thread exit, after which blocks
+    * freed by this thread go straight back to the system.
+    */
+
+   static thread_local bool gone;
+};
+
+thread_local bool ThreadCache::gone = false;
+static thread_local ThreadCache cache;
+
+
+static int sizeClass(size_t bytes)
+{
+   int c = 0;
+
+   while(((size_t) POOL_ALIGN << c) < bytes)
+      c++;
+   return c;
+}
+
+static void* systemAllocate(size_t bytes)
+{
+   void* block = alignedAllocate(bytes);
+
+   if(block == NULL)
+      throw std::bad_alloc();
+   heldBytes += bytes;
+   return block;
+}
+
+static void systemRelease(void* block, size_t bytes)
+{
+   alignedFree(block);
+   heldBytes -= bytes;
+}
+
+
+void* BlockPool::allocate(size_t bytes)
+{
+   if(bytes > POOL_MAX_BLOCK)
+      return systemAllocate(bytes);
+
+   int c = sizeClass(bytes);
+   size_t size = POOL_ALIGN << c;
+
+   if(!ThreadCache::gone && cache.count[c] > 0)
+   {
+      cache.bytes -= size;
+      return cache.blocks[c][--cache.count[c]];
+   }
+   return systemAllocate(size);
+}
+
+
+void BlockPool::release(void* block, size_t bytes)
+{
+   if(block == NULL)
+      return;
+
+   if(bytes > POOL_MAX_BLOCK)
+   {
+      systemRelease(block, bytes);
+      return;
+   }
+
+   int c = sizeClass(bytes);
+   size_t size = POOL_ALIGN << c;
+
+   if(!ThreadCache::gone && cache.count[c] < POOL_MAX_FREE)
+   {
+      cache.blocks[c][cache.count[c]++] = block;
+      cache.bytes += size;
+      return;
+   }
+   systemRelease(block, size);
+}
+
+
+size_t BlockPool::held(void)
+{
+   return heldBytes;
+}
+
+
+size_t BlockPool::cached(void)
+{
+   return ThreadCache::gone ? 0 : cache.bytes;
+}
+
+
+void BlockPool::trim(void)
+{
+   if(!ThreadCache::gone)
+      cache.trim();
+}
@@ -0,0 +1,88 @@
+/******************************************************************************
+ *  PoolAllocator.h
+ *
+ *  Pooled storage for the per-ball arrays.  BlockPool hands out blocks
+ *  rounded up to a power of two from 64 bytes to POOL_MAX_BLOCK, each
+ *  aligned for the widest vector loads, and keeps freed blocks on a
+ *  per-thread free list for each size, so the next world of the same
+ *  size reuses them without a lock or a trip to malloc.  Blocks bigger
+ *  than POOL_MAX_BLOCK are allocated at exactly the size asked for and
+ *  given straight back when freed, so a million-ball table costs memory
+ *  in proportion to its ball count and nothing once it is gone.
+ *
+ *  PoolAllocator is the std::vector allocator that draws from BlockPool.
+ ******************************************************************************/
+
+#ifndef __POOL_ALLOCATOR_H__
+#define __POOL_ALLOCATOR_H__
+
+#include <cstddef>
+#include <new>
+
+
+/* POOL_ALIGN is the alignment of every block.  POOL_MAX_BLOCK is the
+ * largest block kept on a free list, POOL_MAX_FREE the most blocks a
+ * thread keeps on any one list.
+ */
+
+const size_t POOL_ALIGN = 64;
+const size_t POOL_MAX_BLOCK = (size_t) 1 << 20;
+const int POOL_MAX_FREE = 64;
+
+
+class BlockPool
+{
+public:
+   /* Safe to call from any thread.  allocate() throws std::bad_alloc if
+    * the system is out of memory.
+    */
+
+   static void* allocate(size_t bytes);
+   static void release(void* block, size_t bytes);
+
+   /* Bytes the pool has taken from the system, in use or cached, and
+    * the bytes sitting on the calling thread's free lists.
+    */
+
+   static size_t held(void);
+   static size_t cached(void);
+
+   /* Give the calling thread's cached blocks back to the system.  A
+    * thread's cache is also emptied when the thread exits.
+    */
+
+   static void trim(void);
+};
+
+
+template <class T>
+class PoolAllocator
+{
+public:
+   typedef T value_type;
+
+   PoolAllocator() {}
+
+   template <class U>
+   PoolAllocator(const PoolAllocator<U>&) {}
+
+   T* allocate(size_t n)
+      { return static_cast<T*>(BlockPool::allocate(n * sizeof(T))); }
+
+   void deallocate(T* p, size_t n)
+      { BlockPool::release(p, n * sizeof(T)); }
+};
+
+template <class T, class U>
+bool operator == (const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+   return true;
+}
+
+template <class T, class U>
+bool operator != (const PoolAllocator<T>&, const PoolAllocator<U>&)
+{
+   return false;
+}
+
+#endif // __POOL_ALLOCATOR_H__
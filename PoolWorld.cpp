@@ -0,0 +1,849 @@
+/******************************************************************************
+ *  PoolWorld.cpp
+ *
+ *  Loading, collision detection and response, and time stepping for the
+ *  pool table.  The physics here was lifted out of the GLUT idle()
+ *  callback in pool.cpp so that shots can be simulated without a window.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "PoolWorld.h"
+#include "EventSimulator.h"
+#include "Kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+
+static_assert(std::is_trivially_copyable<WorldState>::value,
+              "WorldState must stay trivially copyable");
+
+
+PoolWorld::PoolWorld()
+{
+   table = Table();
+   friction = 0.0;
+   elasticity = 1.0;
+   powerValue = 0;
+   numBalls = 0;
+   useBroadphase = true;
+   useSleeping = true;
+   useContactSolver = true;
+   recordContacts = false;
+   restingStale = true;
+   engine = ENGINE_STEPPED;
+   steppedFinish = false;
+   kernels = selectKernels();
+   tickDt = 1.0 / TICK_RATE;
+   substeps = SUBSTEPS;
+   accumulator = 0.0;
+   ticks = 0;
+   contacts = 0;
+}
+
+
+/***********************************************************************
+ * File Reading
+ ***********************************************************************/
+
+/* Each object line is mass, radius, color, then a 3-D position and
+ * velocity.  The z components are unused in this 2-D simulation.
+ */
+
+typedef struct ObjectLine
+{
+   double mass, radius;
+   Color color;
+   dvec2 position, velocity;
+} ObjectLine;
+
+static ObjectLine readObject(std::istream& data)
+{
+   ObjectLine o;
+   double z;
+
+   data >> o.mass;
+   data >> o.radius;
+   data >> o.color;
+   data >> o.position;
+   data >> z;
+   data >> o.velocity;
+   data >> z;
+   return o;
+}
+
+/* Read count object lines into objects.  False if the file runs out
+ * first.  The lines are collected before anything is sized, so a
+ * corrupt count cannot make the table allocate more than the file
+ * holds.
+ */
+
+static bool readObjects(std::istream& data, int count,
+                        std::vector<ObjectLine>& objects)
+{
+   for(int i = 0; i < count; i++)
+   {
+      ObjectLine o = readObject(data);
+      if(!data)
+         return false;
+      objects.push_back(o);
+   }
+   return true;
+}
+
+bool PoolWorld::readFile(const char* fileName)
+{
+   std::ifstream data;
+   data.open(fileName);
+   if(!data.is_open())
+   {
+      return false;
+   }
+
+   Table t;
+   double e, f;
+   int threshold, power, count, numPockets;
+   std::vector<ObjectLine> objects, holes;
+
+   /* The first number was how many idle calls the game let pass between
+    * redraws; it now redraws whenever the simulation has moved on.
+    */
+
+   data >> threshold;
+   data >> t.ll.x;
+   data >> t.ll.y;
+   data >> t.ur.x;
+   data >> t.ur.y;
+   data >> t.boardColor;
+   data >> t.fringeWidth;
+   data >> t.fringeColor;
+   data >> e;
+   data >> f;
+   data >> power;
+   data >> count;
+
+   /* The markers and the cue ball must be there. */
+
+   if(!data || count <= CUE_BALL || !readObjects(data, count, objects))
+      return false;
+
+   /* Pockets have the same line format; only the position, radius and
+    * color mean anything.
+    */
+
+   data >> numPockets;
+   if(!data || numPockets < 0 || !readObjects(data, numPockets, holes))
+      return false;
+   data.close();
+
+   /* The whole file is good; replace the old table with it. */
+
+   table = t;
+   elasticity = e;
+   friction = f;
+   powerValue = power;
+   numBalls = count;
+   balls.resize(numBalls);
+
+   for(int i = 0; i < numBalls; i++)
+   {
+      const ObjectLine& o = objects[i];
+
+      balls.setMass(i, o.mass);
+      balls.r[i] = o.radius;
+      balls.px[i] = o.position.x;
+      balls.py[i] = o.position.y;
+      balls.vx[i] = o.velocity.x;
+      balls.vy[i] = o.velocity.y;
+      balls.info[i].color = o.color;
+      balls.info[i].oPosition = o.position;
+   }
+
+   pockets.clear();
+   for(size_t p = 0; p < holes.size(); p++)
+   {
+      const ObjectLine& o = holes[p];
+      pockets.add(o.position.x, o.position.y, o.radius, o.color);
+   }
+   pockets.prepare(table.ll, table.ur);
+
+   /* The markers and aimer are for display only. */
+
+   for(int i = 0; i < NUM_MARKERS; i++)
+   {
+      balls.ignored.set(i, true);
+   }
+   balls.info[CUE_BALL].hasBeenShot = 0;
+   wakeAll();
+   return true;
+}
+
+
+/***********************************************************************
+ * Racking
+ ***********************************************************************/
+
+void PoolWorld::rack(void)
+{
+   for(int i = 0; i < balls.size(); i++)
+   {
+      balls.pocketed.set(i, false);
+      setPosition(i, balls.info[i].oPosition);
+      setVelocity(i, dvec2(0.0));
+   }
+   balls.info[CUE_BALL].hasBeenShot = 0;
+   wakeAll();
+}
+
+void PoolWorld::rackCue(void)
+{
+   balls.info[CUE_BALL].hasBeenShot = 0;
+   balls.pocketed.set(CUE_BALL, false);
+   setVelocity(CUE_BALL, dvec2(0.0));
+   setPosition(CUE_BALL, balls.info[CUE_BALL].oPosition);
+}
+
+
+/***********************************************************************
+ * Snapshots
+ ***********************************************************************/
+
+static uint32_t packBits(const FlagBits& bits)
+{
+   return bits.words.empty() ? 0 : (uint32_t) bits.words[0];
+}
+
+/* Only for bits with at least one word; restore() checks. */
+
+static void unpackBits(FlagBits& bits, uint32_t packed)
+{
+   bits.words[0] = (bits.words[0] & ~(uint64_t) 0xffffffff) | packed;
+}
+
+bool PoolWorld::snapshot(WorldState& state) const
+{
+   int n = numBalls;
+
+   if(n > STATE_BALLS)
+      return false;
+
+   state.numBalls = n;
+   state.cueShot = (n > CUE_BALL) ? balls.info[CUE_BALL].hasBeenShot : 0;
+   state.elasticity = elasticity;
+   state.friction = friction;
+   state.accumulator = accumulator;
+   state.ticks = ticks;
+   state.contacts = contacts;
+   state.pocketed = packBits(balls.pocketed);
+   state.sleeping = packBits(balls.sleeping);
+   state.ignored = packBits(balls.ignored);
+   memcpy(state.px, &balls.px[0], n * sizeof(double));
+   memcpy(state.py, &balls.py[0], n * sizeof(double));
+   memcpy(state.vx, &balls.vx[0], n * sizeof(double));
+   memcpy(state.vy, &balls.vy[0], n * sizeof(double));
+   memcpy(state.r, &balls.r[0], n * sizeof(double));
+   memcpy(state.invMass, &balls.invMass[0], n * sizeof(double));
+   memcpy(state.stillTime, &balls.stillTime[0], n * sizeof(double));
+   return true;
+}
+
+bool PoolWorld::restore(const WorldState& state)
+{
+   int n = state.numBalls;
+
+   if(n != numBalls || n < 0 || n > STATE_BALLS || n > balls.size() ||
+      balls.pocketed.words.empty() || balls.sleeping.words.empty() ||
+      balls.ignored.words.empty())
+      return false;
+
+   if(n > CUE_BALL)
+      balls.info[CUE_BALL].hasBeenShot = state.cueShot;
+   elasticity = state.elasticity;
+   friction = state.friction;
+   accumulator = state.accumulator;
+   ticks = state.ticks;
+   contacts = state.contacts;
+   unpackBits(balls.pocketed, state.pocketed);
+   unpackBits(balls.sleeping, state.sleeping);
+   unpackBits(balls.ignored, state.ignored);
+   memcpy(&balls.px[0], state.px, n * sizeof(double));
+   memcpy(&balls.py[0], state.py, n * sizeof(double));
+   memcpy(&balls.vx[0], state.vx, n * sizeof(double));
+   memcpy(&balls.vy[0], state.vy, n * sizeof(double));
+   memcpy(&balls.r[0], state.r, n * sizeof(double));
+   memcpy(&balls.invMass[0], state.invMass, n * sizeof(double));
+   memcpy(&balls.stillTime[0], state.stillTime, n * sizeof(double));
+
+   /* Rebuild what follows from the flags; clear() keeps the capacity,
+    * so none of this allocates once the world has run a shot.
+    */
+
+   active.clear();
+   for(int i = 0; i < n; i++)
+   {
+      if(!balls.sleeping.test(i))
+         active.push_back(i);
+   }
+   woken.clear();
+   touching.clear();
+   wasTouching.clear();
+   pocketEvents.clear();
+   contactEvents.clear();
+   solver.reset();
+   restingStale = true;
+   return true;
+}
+
+
+/***********************************************************************
+ * Collision detection and response functions.
+ ***********************************************************************/
+
+int PoolWorld::collision(int j, int k) const
+{
+   /* Vector from center of ball k to center of ball j.  This vector is
+    * normal to the collision plane.
+    */
+
+   double nx = balls.px[j] - balls.px[k];
+   double ny = balls.py[j] - balls.py[k];
+   double distanceSquared = nx * nx + ny * ny;
+
+   /* Note that we're comparing square of distance, to avoid computing
+    * square roots.  We've had a collision if the distance between
+    * the centers of the balls is <= to the sum of their radii.
+    */
+
+   double reach = balls.r[j] + balls.r[k];
+
+   return (distanceSquared <= reach * reach) ? 1 : 0;
+}
+
+
+/***********************************************************************
+ * This function will determine the response to the collision between
+ * objects j and k and modify each ball's position and velocity to
+ * account for the collision response.
+ ***********************************************************************/
+
+void PoolWorld::collisionResponse(int j, int k)
+{
+   double radiusSum = balls.r[j] + balls.r[k];
+
+   /* Vector from center of ball k to center of ball j.  This vector is
+    * normal to the collision plane.
+    */
+
+   double nx = balls.px[j] - balls.px[k];
+   double ny = balls.py[j] - balls.py[k];
+
+   /* Penetration distance is sum of radii less distance between centers
+    * of the two balls.
+    */
+
+   double distance = std::sqrt(nx * nx + ny * ny);
+   double penetration = radiusSum - distance;
+
+   /* Coincident centers give no collision normal. */
+
+   if (distance <= 0.0)
+      return;
+
+   double rvx = balls.vx[k] - balls.vx[j];
+   double rvy = balls.vy[k] - balls.vy[j];
+
+   nx /= distance;
+   ny /= distance;
+
+   /* Readjust ball position by translating each ball by 1/2 the
+    * penetration distance along the collision normal.
+    */
+
+   balls.px[j] += 0.5 * penetration * nx;
+   balls.py[j] += 0.5 * penetration * ny;
+   balls.px[k] -= 0.5 * penetration * nx;
+   balls.py[k] -= 0.5 * penetration * ny;
+
+   /* Dot product of relative velocity and collision normal.  If this
+    * is negative, the balls are already moving apart, and we need not
+    * compute a collision response.
+    */
+
+   double vDOTn = rvx * nx + rvy * ny;
+
+   if (vDOTn < 0.0)
+      return;
+
+   /* Compute the collision impulse.  This is energy added to each ball
+    * to draw them apart following the collision.  The total energy in
+    * the system remains the same, or is less than before the collision
+    * if the collision is inelastic.
+    */
+
+   double impulse = -(1.0 + elasticity) * vDOTn /
+                    (balls.invMass[j] + balls.invMass[k]);
+
+   /* Apply the impulse to each ball. */
+
+   balls.vx[k] += impulse * balls.invMass[k] * nx;
+   balls.vy[k] += impulse * balls.invMass[k] * ny;
+   balls.vx[j] -= impulse * balls.invMass[j] * nx;
+   balls.vy[j] -= impulse * balls.invMass[j] * ny;
+}
+
+
+/***********************************************************************
+ * Shooting
+ ***********************************************************************/
+
+void PoolWorld::shoot(dvec2 aim, double power)
+{
+   balls.info[CUE_BALL].hasBeenShot = 1;
+   balls.vx[CUE_BALL] = aim.x * power;
+   balls.vy[CUE_BALL] = aim.y * power;
+   wake(CUE_BALL);
+}
+
+
+/***********************************************************************
+ * Sleeping.  A ball that has been slower than REST_SPEED for SLEEP_TIME
+ * is stopped dead and dropped from the active list.  Only awake balls
+ * are integrated and bounced, and only pairs with at least one awake
+ * ball are tested, so resting balls cost nothing until something runs
+ * into them.
+ ***********************************************************************/
+
+/* Balls, as opposed to pockets and display-only objects. */
+
+bool PoolWorld::isSimulated(int i) const
+{
+   return i >= 0 && i < numBalls && !balls.ignored.test(i);
+}
+
+void PoolWorld::wake(int i)
+{
+   if(!isSimulated(i) || !balls.sleeping.test(i))
+      return;
+
+   /* A pocketed ball stays down until it is racked. */
+
+   if(balls.pocketed.test(i))
+      return;
+
+   balls.sleeping.set(i, false);
+   balls.stillTime[i] = 0.0;
+   active.push_back(i);
+   restingStale = true;
+}
+
+void PoolWorld::setRadius(int i, double r, double mass)
+{
+   balls.r[i] = r;
+   balls.setMass(i, mass);
+   restingStale = true;
+   wake(i);
+}
+
+void PoolWorld::wakeAll(void)
+{
+   active.clear();
+   balls.sleeping.resize(balls.size(), true);
+   restingStale = true;
+   for(int i = 0; i < numBalls; i++)
+   {
+      wake(i);
+   }
+}
+
+void PoolWorld::updateSleep(double dt)
+{
+   size_t n = 0;
+
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int i = active[a];
+
+      /* Sunk during this step. */
+
+      if(balls.sleeping.test(i))
+         continue;
+
+      if(balls.vx[i] * balls.vx[i] + balls.vy[i] * balls.vy[i] >=
+         REST_SPEED * REST_SPEED || !useSleeping)
+      {
+         balls.stillTime[i] = 0.0;
+      }
+      else
+      {
+         balls.stillTime[i] += dt;
+         if(balls.stillTime[i] >= SLEEP_TIME)
+         {
+            balls.vx[i] = balls.vy[i] = 0.0;
+            balls.sleeping.set(i, true);
+            restingStale = true;
+            continue;
+         }
+      }
+      active[n++] = i;
+   }
+   active.resize(n);
+
+   /* Balls woken since the last step were appended at the end.  Keep the
+    * list in index order, which is the order the step loops expect.
+    */
+
+   if(!std::is_sorted(active.begin(), active.end()))
+      std::sort(active.begin(), active.end());
+}
+
+
+/***********************************************************************
+ * Narrowphase.  Every awake ball j is tested against the balls k
+ * around it.  A pair of awake balls is handled from the lower index
+ * only.  Both versions visit pairs in the same order; the grid just
+ * leaves out pairs that are too far apart to touch.
+ ***********************************************************************/
+
+/* A contact between awake ball j and ball k.  It goes to the solver
+ * when that is in use, and is resolved on the spot otherwise.
+ */
+
+void PoolWorld::touch(int j, int k)
+{
+   touching.push_back((uint64_t) std::min(j, k) << 32 | std::max(j, k));
+
+   if(useContactSolver)
+   {
+      solver.add(std::min(j, k), std::max(j, k));
+      return;
+   }
+   collisionResponse(std::min(j, k), std::max(j, k));
+   if(balls.sleeping.test(k))
+      restingStale = true;
+   settleSleeper(k);
+}
+
+/* A sleeping ball that was knocked to REST_SPEED or faster is woken once
+ * collide() is done; a slower nudge leaves it asleep, so resting balls
+ * in contact cannot keep waking each other.
+ */
+
+void PoolWorld::settleSleeper(int k)
+{
+   if(isSimulated(k) && balls.sleeping.test(k))
+   {
+      if(balls.vx[k] * balls.vx[k] + balls.vy[k] * balls.vy[k] >=
+         REST_SPEED * REST_SPEED)
+         woken.push_back(k);
+      else
+         balls.vx[k] = balls.vy[k] = 0.0;
+   }
+}
+
+void PoolWorld::collideAllPairs(void)
+{
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int j = active[a];
+      for(int k = 0; k < numBalls; k++)
+      {
+         if (k == j || balls.ignored.test(k) || balls.pocketed.test(k) ||
+             (k < j && !balls.sleeping.test(k)))
+            continue;
+         if (collision(j, k))
+         {
+            touch(j, k);
+         }
+      }
+   }
+}
+
+void PoolWorld::collideCandidatePairs(void)
+{
+   /* A sleeping ball changes size only through setRadius(), which marks
+    * the grids stale; an awake one may have been grown since the cell
+    * size was taken.
+    */
+
+   for(size_t a = 0; a < active.size() && !restingStale; a++)
+   {
+      if(2.0 * balls.r[active[a]] > restingGrid.cellSize)
+         restingStale = true;
+   }
+
+   if(restingStale)
+   {
+      resting.clear();
+      for(int i = 0; i < numBalls; i++)
+      {
+         if(balls.sleeping.test(i) && !balls.pocketed.test(i))
+            resting.push_back(i);
+      }
+      restingGrid.build(balls, resting,
+                        UniformGrid::cellSizeFor(balls, numBalls));
+      restingStale = false;
+   }
+   movingGrid.build(balls, active, restingGrid.cellSize);
+
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int j = active[a];
+
+      candidates.clear();
+      movingGrid.candidates(balls.px[j], balls.py[j], candidates);
+      restingGrid.candidates(balls.px[j], balls.py[j], candidates);
+      std::sort(candidates.begin(), candidates.end());
+
+      for(size_t c = 0; c < candidates.size(); c++)
+      {
+         int k = candidates[c];
+         if (k == j || (k < j && !balls.sleeping.test(k)))
+            continue;
+         if (collision(j, k))
+         {
+            touch(j, k);
+         }
+      }
+   }
+}
+
+
+/***********************************************************************
+ * This computes a simulation step.  Updated ball positions are computed
+ * using each ball's velocity.  Then, we check to see if the balls have
+ * collided.  If so, we compute the response.  Finally, any ball leaving
+ * the table is bounced off the cushion it crossed.
+ ***********************************************************************/
+
+void PoolWorld::step(double dt)
+{
+   if(active.empty())
+      return;
+
+   integrate(dt);
+   collide();
+   sinkBalls();
+   bounceOffCushions();
+   updateSleep(dt);
+
+   /* Once everything is asleep nothing is moving into anything.  Drop
+    * the remembered contacts, so the next shot starts the same way as
+    * from a snapshot of this table.
+    */
+
+   if(active.empty())
+   {
+      wasTouching.clear();
+      solver.reset();
+   }
+}
+
+
+/* integrate() and bounceOffCushions() run the vector kernels over every
+ * ball while at least half of them are awake; sleeping balls have no
+ * velocity, so integrating them changes nothing.  Otherwise they visit
+ * just the awake balls.
+ */
+
+void PoolWorld::integrate(double dt)
+{
+   double damping = 1 - friction * dt;
+
+   if(2 * active.size() >= (size_t) numBalls)
+   {
+      kernels->integrate(&balls.px[0], &balls.py[0], &balls.vx[0],
+                         &balls.vy[0], numBalls, dt, damping);
+      return;
+   }
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int i = active[a];
+      balls.px[i] += balls.vx[i] * dt;
+      balls.py[i] += balls.vy[i] * dt;
+      balls.vx[i] *= damping;
+      balls.vy[i] *= damping;
+   }
+}
+
+
+void PoolWorld::collide(void)
+{
+   solver.clear();
+
+   if(useBroadphase)
+      collideCandidatePairs();
+   else
+      collideAllPairs();
+
+   if(useContactSolver)
+   {
+      solver.solve(balls, elasticity);
+      if(solver.movedSleeping)
+         restingStale = true;
+      for(size_t c = 0; c < solver.list.size(); c++)
+      {
+         settleSleeper(solver.list[c].j);
+         settleSleeper(solver.list[c].k);
+      }
+   }
+
+   for(size_t w = 0; w < woken.size(); w++)
+      wake(woken[w]);
+   woken.clear();
+
+   /* Count the pairs that were not touching last step. */
+
+   std::sort(touching.begin(), touching.end());
+   size_t last = 0;
+   for(size_t t = 0; t < touching.size(); t++)
+   {
+      while(last < wasTouching.size() && wasTouching[last] < touching[t])
+         last++;
+      if(last == wasTouching.size() || wasTouching[last] != touching[t])
+      {
+         contacts++;
+         if(recordContacts)
+         {
+            ContactEvent e;
+            e.j = (int) (touching[t] >> 32);
+            e.k = (int) (touching[t] & 0xffffffff);
+            e.tick = ticks;
+            contactEvents.push_back(e);
+         }
+      }
+   }
+   wasTouching.swap(touching);
+   touching.clear();
+}
+
+
+void PoolWorld::bounceOffCushions(void)
+{
+   if(2 * active.size() >= (size_t) numBalls)
+   {
+      kernels->bounce(&balls.px[0], &balls.py[0], &balls.vx[0], &balls.vy[0],
+                      &balls.r[0], balls.sleeping, numBalls,
+                      table.ll.x, table.ll.y, table.ur.x, table.ur.y);
+      return;
+   }
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int i = active[a];
+      if(!balls.sleeping.test(i))
+         bounceBall(balls.px[i], balls.py[i], balls.vx[i], balls.vy[i],
+                    balls.r[i], table.ll.x, table.ll.y,
+                    table.ur.x, table.ur.y);
+   }
+}
+
+
+/* Sleeping balls are stopped, so only the awake ones need checking. */
+
+bool PoolWorld::isMoving(void) const
+{
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int i = active[a];
+      if(balls.vx[i] * balls.vx[i] + balls.vy[i] * balls.vy[i] >=
+         REST_SPEED * REST_SPEED)
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+
+/***********************************************************************
+ * Pockets.  A ball whose center has entered a pocket is taken out of
+ * play where it is and the drop is logged in pocketEvents.
+ ***********************************************************************/
+
+void PoolWorld::sink(int i, int p)
+{
+   PocketEvent e;
+   e.ball = i;
+   e.pocket = p;
+   e.tick = ticks;
+   pocketEvents.push_back(e);
+
+   balls.vx[i] = balls.vy[i] = 0.0;
+   balls.pocketed.set(i, true);
+   balls.sleeping.set(i, true);
+   restingStale = true;
+}
+
+
+void PoolWorld::sinkBalls(void)
+{
+   for(size_t a = 0; a < active.size(); a++)
+   {
+      int i = active[a];
+      int p = pockets.find(balls.px[i], balls.py[i]);
+
+      if(p >= 0 && !balls.pocketed.test(i))
+         sink(i, p);
+   }
+}
+
+
+/***********************************************************************
+ * Fixed timestep driver.
+ ***********************************************************************/
+
+void PoolWorld::tick(void)
+{
+   double dt = tickDt / substeps;
+
+   for(int s = 0; s < substeps; s++)
+   {
+      step(dt);
+   }
+   ticks++;
+}
+
+
+int PoolWorld::advance(double elapsed)
+{
+   int n = 0;
+
+   if(elapsed > MAX_FRAME_TIME)
+      elapsed = MAX_FRAME_TIME;
+
+   accumulator += elapsed;
+   while(accumulator >= tickDt)
+   {
+      tick();
+      accumulator -= tickDt;
+      n++;
+   }
+   return n;
+}
+
+
+double PoolWorld::simulateUntilRest(double maxTime)
+{
+   double t = 0.0;
+
+   if(engine == ENGINE_EVENTS)
+   {
+      /* The event engine keeps no sleep state of its own; start the
+       * stepped bookkeeping afresh from wherever it left the balls.
+       */
+
+      EventSimulator events(*this);
+      t = events.simulateUntilRest(maxTime);
+      steppedFinish = events.steppedFinish;
+      wakeAll();
+      return t;
+   }
+
+   while(t < maxTime && isMoving())
+   {
+      tick();
+      t += tickDt;
+   }
+   return t;
+}
@@ -0,0 +1,358 @@
+/******************************************************************************
+ *  PoolWorld.h
+ *
+ *  The headless simulation core.  Everything needed to load a table from
+ *  poolData.txt and advance it in time lives here, with no dependence on
+ *  GL or GLUT.  The GLUT front-end in pool.cpp is one client of this
+ *  class; the command-line tools (see poolSim.cpp) are another.
+ ******************************************************************************/
+
+#ifndef __POOL_WORLD_H__
+#define __POOL_WORLD_H__
+
+#include "Angel.h"
+#include "BallStore.h"
+#include "Broadphase.h"
+#include "ContactSolver.h"
+#include "Pockets.h"
+
+struct Kernels;
+
+
+/* MAX_SHOT_TIME bounds simulateUntilRest() so that a table which never
+ * settles cannot hang a batch job.  REST_SPEED is the speed below which
+ * a ball is considered to have stopped; one that stays below it for
+ * SLEEP_TIME seconds is put to sleep.  TICK_RATE and SUBSTEPS are the
+ * default fixed timestep (see tick()).  MAX_FRAME_TIME caps the time
+ * advance() will catch up on after a stall.
+ */
+
+const double MAX_SHOT_TIME = 120.0;
+const double REST_SPEED = 0.05;
+const double SLEEP_TIME = 0.5;
+const double TICK_RATE = 240.0;
+const int SUBSTEPS = 4;
+const double MAX_FRAME_TIME = 0.25;
+
+/* Engines for simulateUntilRest().  ENGINE_STEPPED ticks on the fixed
+ * timestep; ENGINE_EVENTS jumps from contact to contact (see
+ * EventSimulator.h).
+ */
+
+const int ENGINE_STEPPED = 0;
+const int ENGINE_EVENTS = 1;
+
+/* Fixed slots in poolData.txt.  Entries 0 through 3 are the two break
+ * markers, the aiming circle and the aiming ball.  They are drawn but
+ * never simulated.  Entry 4 is always the cue ball.
+ */
+
+const int AIM_CIRCLE = 2;
+const int AIM_BALL = 3;
+const int CUE_BALL = 4;
+const int NUM_MARKERS = 4;
+
+
+/* A ball dropping into a pocket, during tick number tick. */
+
+typedef struct PocketEvent
+{
+   int ball;
+   int pocket;
+   long tick;
+} PocketEvent;
+
+
+/* Balls j < k coming into contact during tick number tick. */
+
+typedef struct ContactEvent
+{
+   int j;
+   int k;
+   long tick;
+} ContactEvent;
+
+
+/* The table header of poolData.txt.  ll and ur are the lower left and
+ * upper right corners of the playing surface.
+ */
+
+typedef struct Table
+{
+   dvec2 ll, ur;
+   Color boardColor;
+   double fringeWidth;
+   Color fringeColor;
+} Table;
+
+
+/* The part of a PoolWorld that shots and the player can change: every
+ * ball's position, velocity, size, mass and flags, the physical
+ * constants and the clock.  The table, pockets, colors and racked
+ * positions are left out; a state is restored into a world that has
+ * loaded the same table.  It is trivially copyable and holds up to
+ * STATE_BALLS balls inline, so states can be kept by the thousand in a
+ * plain array and copied with memcpy.
+ */
+
+const int STATE_BALLS = 32;
+
+typedef struct WorldState
+{
+   int numBalls;
+   int cueShot;
+   double elasticity;
+   double friction;
+   double accumulator;
+   long ticks;
+   long contacts;
+   uint32_t pocketed, sleeping, ignored;
+   double px[STATE_BALLS], py[STATE_BALLS];
+   double vx[STATE_BALLS], vy[STATE_BALLS];
+   double r[STATE_BALLS];
+   double invMass[STATE_BALLS];
+   double stillTime[STATE_BALLS];
+} WorldState;
+
+
+class PoolWorld
+{
+public:
+   PoolWorld();
+
+   /* Load the table, physical constants and objects from a data file,
+    * sizing the ball table to the file.  Returns false, leaving the
+    * world as it was, if the file cannot be opened, is cut short, or has
+    * too few objects for the markers and cue ball.
+    */
+
+   bool readFile(const char* fileName);
+
+   /* Return every object to its racked position, at rest. */
+
+   void rack(void);
+
+   /* Return just the cue ball to its racked position. */
+
+   void rackCue(void);
+
+   /* Copy the changeable state into state.  Returns false, leaving
+    * state untouched, if there are more than STATE_BALLS balls.
+    */
+
+   bool snapshot(WorldState& state) const;
+
+   /* Put back a state taken from this world, or one with the same
+    * table.  Nothing is allocated and nothing is re-read.  The contact
+    * solver starts the next step cold, so a state taken mid-shot replays
+    * identically from every restore but may drift slightly from the run
+    * it was taken from.  Returns false, leaving the world as it was, if
+    * the state does not have this world's number of balls.
+    */
+
+   bool restore(const WorldState& state);
+
+   /* Hit the cue ball along aim, scaled by power. */
+
+   void shoot(dvec2 aim, double power);
+
+   /* Advance the simulation by dt seconds.  This is integrate(), then
+    * collide(), sinkBalls() and bounceOffCushions(), then the sleep
+    * bookkeeping.
+    * Only awake balls are stepped, so a table at rest costs next to
+    * nothing.
+    */
+
+   void step(double dt);
+   void integrate(double dt);
+   void collide(void);
+   void sinkBalls(void);
+   void bounceOffCushions(void);
+
+   /* Advance by one fixed tick of tickDt seconds, taken as substeps
+    * equal steps.  Identical starting states and shots give bit-identical
+    * results no matter how the ticks are spread over wall-clock time.
+    */
+
+   void tick(void);
+
+   /* Add elapsed wall-clock seconds to the accumulator and run as many
+    * whole ticks as it holds.  The remainder carries over to the next
+    * call.  Returns the number of ticks run.
+    */
+
+   int advance(double elapsed);
+
+   /* Run the current engine until every ball has stopped or maxTime
+    * seconds have been simulated.  Returns the simulated time.
+    */
+
+   double simulateUntilRest(double maxTime = MAX_SHOT_TIME);
+
+   /* True if any simulated ball is moving at REST_SPEED or faster. */
+
+   bool isMoving(void) const;
+
+   /* True when no ball is moving at REST_SPEED or faster, so the next
+    * shot may be taken.  Balls may still be awake, settling towards
+    * sleep.
+    */
+
+   bool isTableAtRest(void) const
+      { return !isMoving(); }
+
+   /* Wake ball i, or every ball.  A sleeping ball is woken by contact
+    * with an awake one; anything else that moves a ball or changes its
+    * size must wake it.  The accessors below do this themselves.
+    */
+
+   void wake(int i);
+   void wakeAll(void);
+
+   /* Number of awake balls. */
+
+   int awakeCount(void) const
+      { return (int) active.size(); }
+
+   /* The awake balls themselves, in index order after each step. */
+
+   const std::vector<int>& awakeBalls(void) const
+      { return active; }
+
+   /* True if ball i has dropped into a pocket.  It stays out of play,
+    * where it fell, until the table or the cue ball is re-racked.
+    */
+
+   bool isPocketed(int i) const
+      { return balls.pocketed.test(i); }
+
+   /* Take ball i out of play in pocket p and log a PocketEvent. */
+
+   void sink(int i, int p);
+
+   int collision(int j, int k) const;
+   void collisionResponse(int j, int k);
+
+   /* Convenience accessors for code outside the hot loops. */
+
+   dvec2 position(int i) const
+      { return dvec2(balls.px[i], balls.py[i]); }
+   dvec2 velocity(int i) const
+      { return dvec2(balls.vx[i], balls.vy[i]); }
+   void setPosition(int i, dvec2 p)
+      { balls.px[i] = p.x;  balls.py[i] = p.y;  wake(i); }
+   void setVelocity(int i, dvec2 v)
+      { balls.vx[i] = v.x;  balls.vy[i] = v.y;  wake(i); }
+
+   /* Give ball i radius r and mass, and resize the grids to fit, asleep
+    * or awake.  Anything that changes a ball's size must come through
+    * here.
+    */
+
+   void setRadius(int i, double r, double mass);
+
+   /* When set (the default), step() only tests the pairs reported by
+    * the uniform grids.  Otherwise every awake ball is tested against
+    * every object.
+    */
+
+   bool useBroadphase;
+
+   /* When set (the default), balls that stay slow for SLEEP_TIME are put
+    * to sleep.  Otherwise every ball stays awake.
+    */
+
+   bool useSleeping;
+
+   /* When set (the default), collide() gathers every touching pair and
+    * resolves them together with the contact solver.  Otherwise each
+    * pair goes through collisionResponse() as it is found.  The event
+    * engine follows the same setting.
+    */
+
+   bool useContactSolver;
+   ContactSolver solver;
+
+   /* ENGINE_STEPPED (the default) or ENGINE_EVENTS.  steppedFinish is
+    * set when the last simulateUntilRest() on the event engine ran out
+    * of events and finished on the fixed timestep.
+    */
+
+   int engine;
+   bool steppedFinish;
+
+   /* Inner loops used by integrate() and bounceOffCushions().  Defaults
+    * to the widest vector version the CPU supports (see Kernels.h).
+    */
+
+   const Kernels* kernels;
+
+   /* Fixed timestep configuration and state.  ticks counts every tick()
+    * since construction.
+    */
+
+   double tickDt;
+   int substeps;
+   double accumulator;
+   long ticks;
+
+   /* Ball-ball collisions since construction.  A pair counts once each
+    * time it comes into contact, however many steps the contact lasts.
+    */
+
+   long contacts;
+
+   Table table;
+   double friction;
+   double elasticity;
+   int powerValue;
+   int numBalls;
+   BallStore balls;
+   Pockets pockets;
+
+   /* Every ball sunk since a client last cleared this. */
+
+   std::vector<PocketEvent> pocketEvents;
+
+   /* With recordContacts set, every new contact counted in contacts is
+    * also logged here until a client clears it.  Off by default.
+    */
+
+   bool recordContacts;
+   std::vector<ContactEvent> contactEvents;
+
+private:
+   void collideAllPairs(void);
+   void collideCandidatePairs(void);
+   void touch(int j, int k);
+   void settleSleeper(int k);
+   void updateSleep(double dt);
+   bool isSimulated(int i) const;
+
+   /* The awake balls, and the sleeping balls hit during this collide()
+    * that are to be woken once it is done.
+    */
+
+   std::vector<int> active;
+   std::vector<int> woken;
+
+   /* The pairs in contact during this step and the last one, as
+    * j << 32 | k with j < k, for counting contacts.
+    */
+
+   std::vector<uint64_t> touching;
+   std::vector<uint64_t> wasTouching;
+
+   /* Awake balls are binned afresh every step.  Sleeping balls do not
+    * move, so their grid is only rebuilt once something has woken,
+    * fallen asleep or been sunk (restingStale).
+    */
+
+   UniformGrid movingGrid;
+   UniformGrid restingGrid;
+   std::vector<int> resting;
+   bool restingStale;
+   std::vector<int> candidates;
+};
+
+#endif // __POOL_WORLD_H__
@@ -0,0 +1,622 @@
+/******************************************************************************
+ *  ReplayLog.cpp
+ *
+ *  Varints are LEB128: seven bits a byte, low bits first, the top bit set
+ *  on every byte but the last.  Doubles are written as their eight raw
+ *  bytes in the machine's byte order, so they come back bit for bit.
+ *
+ *  A session record is the type byte, the tick delta from zero, the magic
+ *  "PLOG" and a version byte, then the number of balls, tickDt and
+ *  substeps.  A reader that meets one starts counting ticks afresh.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "ReplayLog.h"
+#include <algorithm>
+#include <cstring>
+
+
+static const char MAGIC[4] = { 'P', 'L', 'O', 'G' };
+static const int VERSION = 1;
+
+/* The most bytes a varint of 64 bits can take. */
+
+static const int MAX_VARINT = 10;
+
+
+/***********************************************************************
+ * Writing
+ ***********************************************************************/
+
+ReplayWriter::ReplayWriter()
+{
+   records = 0;
+   bytes = 0;
+   lastTick = 0;
+   shots = 0;
+   keyframeDue = false;
+}
+
+bool ReplayWriter::open(const char* fileName, const PoolWorld& world)
+{
+   close();
+   out.open(fileName, std::ios::binary | std::ios::app);
+   if(!out.is_open())
+      return false;
+
+   records = 0;
+   bytes = 0;
+   lastTick = 0;
+   shots = 0;
+   keyframeDue = false;
+
+   begin(RECORD_SESSION, world.ticks);
+   out.write(MAGIC, sizeof(MAGIC));
+   out.put((char) VERSION);
+   bytes += sizeof(MAGIC) + 1;
+   putVarint(world.numBalls);
+   putDouble(world.tickDt);
+   putVarint(world.substeps);
+   out.flush();
+   return out.good();
+}
+
+void ReplayWriter::close(void)
+{
+   if(out.is_open())
+      out.close();
+}
+
+void ReplayWriter::begin(int type, long tick)
+{
+   out.put((char) type);
+   bytes++;
+   putVarint(tick - lastTick);
+   lastTick = tick;
+   records++;
+}
+
+void ReplayWriter::putVarint(uint64_t v)
+{
+   while(v >= 0x80)
+   {
+      out.put((char) (v | 0x80));
+      v >>= 7;
+      bytes++;
+   }
+   out.put((char) v);
+   bytes++;
+}
+
+void ReplayWriter::putDouble(double d)
+{
+   char raw[sizeof(double)];
+
+   memcpy(raw, &d, sizeof(double));
+   out.write(raw, sizeof(double));
+   bytes += sizeof(double);
+}
+
+void ReplayWriter::putState(const WorldState& state)
+{
+   const double* arrays[] = { state.px, state.py, state.vx, state.vy,
+                              state.r, state.invMass, state.stillTime };
+   int n = state.numBalls;
+
+   putVarint(n);
+   putVarint(state.cueShot);
+   putDouble(state.elasticity);
+   putDouble(state.friction);
+   putDouble(state.accumulator);
+   putVarint(state.contacts);
+   putVarint(state.pocketed);
+   putVarint(state.sleeping);
+   putVarint(state.ignored);
+   for(int a = 0; a < 7; a++)
+   {
+      for(int i = 0; i < n; i++)
+         putDouble(arrays[a][i]);
+   }
+}
+
+
+void ReplayWriter::rack(const PoolWorld& world)
+{
+   if(!isOpen())
+      return;
+   begin(RECORD_RACK, world.ticks);
+}
+
+void ReplayWriter::rackCue(const PoolWorld& world)
+{
+   if(!isOpen())
+      return;
+   begin(RECORD_RACK_CUE, world.ticks);
+}
+
+void ReplayWriter::elasticity(const PoolWorld& world)
+{
+   if(!isOpen())
+      return;
+   begin(RECORD_ELASTICITY, world.ticks);
+   putDouble(world.elasticity);
+}
+
+void ReplayWriter::cue(const PoolWorld& world)
+{
+   if(!isOpen())
+      return;
+   begin(RECORD_CUE, world.ticks);
+   putDouble(world.balls.px[CUE_BALL]);
+   putDouble(world.balls.py[CUE_BALL]);
+   putDouble(world.balls.r[CUE_BALL]);
+   putDouble(world.balls.invMass[CUE_BALL]);
+}
+
+void ReplayWriter::shot(const PoolWorld& world, dvec2 aim, double power)
+{
+   if(!isOpen())
+      return;
+
+   /* A keyframe is only exact with every ball asleep: restore() starts
+    * the contact solver cold, which is how a table at rest already is.
+    * Otherwise wait for a later shot.
+    */
+
+   shots++;
+   if(shots > 1 && (shots - 1) % KEYFRAME_SHOTS == 0)
+      keyframeDue = true;
+
+   WorldState state;
+   if(keyframeDue && world.awakeCount() == 0 && world.snapshot(state))
+   {
+      begin(RECORD_KEYFRAME, world.ticks);
+      putState(state);
+      keyframeDue = false;
+   }
+
+   begin(RECORD_SHOT, world.ticks);
+   putDouble(aim.x);
+   putDouble(aim.y);
+   putDouble(power);
+   putDouble(world.balls.px[CUE_BALL]);
+   putDouble(world.balls.py[CUE_BALL]);
+   putDouble(world.balls.r[CUE_BALL]);
+   putDouble(world.balls.invMass[CUE_BALL]);
+   putDouble(world.elasticity);
+   out.flush();
+}
+
+void ReplayWriter::events(const PoolWorld& world)
+{
+   if(!isOpen())
+      return;
+
+   pending.clear();
+   mergeEvents(world, pending);
+   for(size_t e = 0; e < pending.size(); e++)
+   {
+      begin(pending[e].type, pending[e].tick);
+      putVarint(pending[e].ball);
+      putVarint(pending[e].other);
+   }
+}
+
+
+/***********************************************************************
+ * Reading
+ ***********************************************************************/
+
+bool ReplayReader::open(const char* fileName)
+{
+   if(in.is_open())
+      in.close();
+   in.open(fileName, std::ios::binary);
+   lastTick = 0;
+   return in.is_open();
+}
+
+std::streamoff ReplayReader::offset(void)
+{
+   return in.tellg();
+}
+
+void ReplayReader::seek(std::streamoff at, long base)
+{
+   in.clear();
+   in.seekg(at);
+   lastTick = base;
+}
+
+bool ReplayReader::getVarint(uint64_t& v)
+{
+   v = 0;
+   for(int b = 0; b < MAX_VARINT; b++)
+   {
+      int c = in.get();
+
+      if(c == EOF)
+         return false;
+      v |= (uint64_t) (c & 0x7f) << (7 * b);
+      if(!(c & 0x80))
+         return true;
+   }
+   return false;
+}
+
+bool ReplayReader::getDouble(double& d)
+{
+   char raw[sizeof(double)];
+
+   if(!in.read(raw, sizeof(double)))
+      return false;
+   memcpy(&d, raw, sizeof(double));
+   return true;
+}
+
+bool ReplayReader::getState(WorldState& state)
+{
+   double* arrays[] = { state.px, state.py, state.vx, state.vy,
+                        state.r, state.invMass, state.stillTime };
+   uint64_t n, cueShot, contacts, pocketed, sleeping, ignored;
+
+   if(!getVarint(n) || n > (uint64_t) STATE_BALLS || !getVarint(cueShot) ||
+      !getDouble(state.elasticity) || !getDouble(state.friction) ||
+      !getDouble(state.accumulator) || !getVarint(contacts) ||
+      !getVarint(pocketed) || !getVarint(sleeping) || !getVarint(ignored))
+      return false;
+
+   state.numBalls = (int) n;
+   state.cueShot = (int) cueShot;
+   state.contacts = (long) contacts;
+   state.pocketed = (uint32_t) pocketed;
+   state.sleeping = (uint32_t) sleeping;
+   state.ignored = (uint32_t) ignored;
+   for(int a = 0; a < 7; a++)
+   {
+      for(int i = 0; i < state.numBalls; i++)
+      {
+         if(!getDouble(arrays[a][i]))
+            return false;
+      }
+   }
+   return true;
+}
+
+bool ReplayReader::next(ReplayRecord& record)
+{
+   int type = in.get();
+   uint64_t delta, a, b;
+
+   if(type == EOF)
+      return false;
+   if(!getVarint(delta))
+      return false;
+
+   record.type = type;
+   if(type == RECORD_SESSION)
+      lastTick = 0;
+   lastTick += (long) delta;
+   record.tick = lastTick;
+
+   switch(type)
+   {
+   case RECORD_SESSION:
+   {
+      char magic[sizeof(MAGIC)];
+
+      if(!in.read(magic, sizeof(MAGIC)) ||
+         memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || in.get() != VERSION)
+         return false;
+      if(!getVarint(a) || !getDouble(record.tickDt) || !getVarint(b))
+         return false;
+      record.numBalls = (int) a;
+      record.substeps = (int) b;
+      return b > 0 && record.tickDt > 0.0;
+   }
+
+   case RECORD_RACK:
+   case RECORD_RACK_CUE:
+      return true;
+
+   case RECORD_ELASTICITY:
+      return getDouble(record.elasticity);
+
+   case RECORD_CUE:
+      return getDouble(record.cueX) && getDouble(record.cueY) &&
+             getDouble(record.radius) && getDouble(record.invMass);
+
+   case RECORD_SHOT:
+      return getDouble(record.aimX) && getDouble(record.aimY) &&
+             getDouble(record.power) &&
+             getDouble(record.cueX) && getDouble(record.cueY) &&
+             getDouble(record.radius) && getDouble(record.invMass) &&
+             getDouble(record.elasticity);
+
+   case RECORD_KEYFRAME:
+      if(!getState(record.state))
+         return false;
+      record.state.ticks = record.tick;
+      return true;
+
+   case RECORD_POCKET:
+   case RECORD_CONTACT:
+      if(!getVarint(a) || !getVarint(b))
+         return false;
+      record.ball = (int) a;
+      record.other = (int) b;
+      return true;
+   }
+   return false;
+}
+
+
+/***********************************************************************
+ * Events and inputs
+ ***********************************************************************/
+
+void mergeEvents(const PoolWorld& world, std::vector<ReplayEvent>& events)
+{
+   const std::vector<ContactEvent>& c = world.contactEvents;
+   const std::vector<PocketEvent>& p = world.pocketEvents;
+   size_t i = 0, j = 0;
+
+   /* Within a tick, collide() comes before sinkBalls(). */
+
+   while(i < c.size() || j < p.size())
+   {
+      ReplayEvent e;
+
+      if(j == p.size() || (i < c.size() && c[i].tick <= p[j].tick))
+      {
+         e.type = RECORD_CONTACT;
+         e.tick = c[i].tick;
+         e.ball = c[i].j;
+         e.other = c[i].k;
+         i++;
+      }
+      else
+      {
+         e.type = RECORD_POCKET;
+         e.tick = p[j].tick;
+         e.ball = p[j].ball;
+         e.other = p[j].pocket;
+         j++;
+      }
+      events.push_back(e);
+   }
+}
+
+void applyRecord(PoolWorld& world, const ReplayRecord& record)
+{
+   switch(record.type)
+   {
+   case RECORD_RACK:
+      world.rack();
+      break;
+
+   case RECORD_RACK_CUE:
+      world.rackCue();
+      break;
+
+   case RECORD_ELASTICITY:
+      world.elasticity = record.elasticity;
+      break;
+
+   case RECORD_CUE:
+      world.balls.px[CUE_BALL] = record.cueX;
+      world.balls.py[CUE_BALL] = record.cueY;
+      world.setRadius(CUE_BALL, record.radius,
+                      record.invMass > 0.0 ? 1.0 / record.invMass : 0.0);
+
+      /* The inverse mass as logged, bit for bit. */
+
+      world.balls.invMass[CUE_BALL] = record.invMass;
+      break;
+
+   case RECORD_SHOT:
+      world.shoot(dvec2(record.aimX, record.aimY), record.power);
+      break;
+   }
+}
+
+
+/***********************************************************************
+ * Replaying
+ ***********************************************************************/
+
+bool ReplayPlayer::open(const char* fileName, const PoolWorld& loaded)
+{
+   table = loaded;
+   sessions = shots = ticks = events = 0;
+   mismatches = diverged = 0;
+   fromKeyframe = false;
+   ticksReplayed = 0;
+   return log.open(fileName);
+}
+
+bool ReplayPlayer::startSession(const ReplayRecord& session)
+{
+   if(session.numBalls != table.numBalls)
+      return false;
+   world = table;
+   world.tickDt = session.tickDt;
+   world.substeps = session.substeps;
+   world.ticks = session.tick;
+   world.recordContacts = true;
+   return true;
+}
+
+/* Tick up to tick and count the events produced that differ, in order,
+ * from those expected.  Both lists are then emptied.
+ */
+
+long ReplayPlayer::checkEvents(long tick)
+{
+   long wrong = 0;
+
+   while(world.ticks < tick)
+      world.tick();
+
+   mergeEvents(world, produced);
+   world.pocketEvents.clear();
+   world.contactEvents.clear();
+
+   size_t n = std::min(expected.size(), produced.size());
+   for(size_t e = 0; e < n; e++)
+   {
+      if(expected[e].type != produced[e].type ||
+         expected[e].tick != produced[e].tick ||
+         expected[e].ball != produced[e].ball ||
+         expected[e].other != produced[e].other)
+         wrong++;
+   }
+   wrong += (long) (std::max(expected.size(), produced.size()) - n);
+   expected.clear();
+   produced.clear();
+   return wrong;
+}
+
+static bool matchesShot(const PoolWorld& world, const ReplayRecord& shot)
+{
+   return world.balls.px[CUE_BALL] == shot.cueX &&
+          world.balls.py[CUE_BALL] == shot.cueY &&
+          world.balls.r[CUE_BALL] == shot.radius &&
+          world.balls.invMass[CUE_BALL] == shot.invMass &&
+          world.elasticity == shot.elasticity;
+}
+
+bool ReplayPlayer::replayAll(void)
+{
+   bool inSession = false;
+   long lastEvent = -1;
+
+   /* Events a session logged after its last input happened on ticks the
+    * game ran before it was closed; run up to the last of them.
+    */
+
+   while(log.next(record))
+   {
+      if(record.type == RECORD_SESSION)
+      {
+         if(inSession)
+         {
+            mismatches += checkEvents(lastEvent + 1);
+            ticks += world.ticks;
+         }
+         if(!startSession(record))
+            return false;
+         ticks -= world.ticks;
+         inSession = true;
+         sessions++;
+         lastEvent = -1;
+         continue;
+      }
+      if(!inSession)
+         break;
+
+      switch(record.type)
+      {
+      case RECORD_POCKET:
+      case RECORD_CONTACT:
+      {
+         ReplayEvent e;
+
+         e.type = record.type;
+         e.tick = record.tick;
+         e.ball = record.ball;
+         e.other = record.other;
+         expected.push_back(e);
+         lastEvent = record.tick;
+         events++;
+         break;
+      }
+
+      case RECORD_KEYFRAME:
+         break;
+
+      default:
+         mismatches += checkEvents(record.tick);
+         if(record.type == RECORD_SHOT)
+         {
+            shots++;
+            if(!matchesShot(world, record))
+               diverged++;
+         }
+         applyRecord(world, record);
+         break;
+      }
+   }
+   if(inSession)
+   {
+      mismatches += checkEvents(lastEvent + 1);
+      ticks += world.ticks;
+   }
+   return true;
+}
+
+bool ReplayPlayer::seek(long shot)
+{
+   ReplayRecord session = ReplayRecord();
+   WorldState state;
+   bool haveSession = false;
+   std::streamoff resume = 0;
+   long resumeTick = 0, resumeShot = 0, count = 0;
+
+   /* Find the last session start or keyframe before the shot without
+    * simulating anything.
+    */
+
+   log.seek(0, 0);
+   fromKeyframe = false;
+   while(count < shot && log.next(record))
+   {
+      if(record.type == RECORD_SHOT)
+      {
+         count++;
+         continue;
+      }
+      if(record.type == RECORD_SESSION)
+      {
+         session = record;
+         haveSession = true;
+         fromKeyframe = false;
+      }
+      else if(record.type == RECORD_KEYFRAME)
+      {
+         state = record.state;
+         fromKeyframe = true;
+      }
+      else
+         continue;
+      resume = log.offset();
+      resumeTick = record.tick;
+      resumeShot = count;
+   }
+   if(count < shot || !haveSession || !startSession(session))
+      return false;
+   if(fromKeyframe && !world.restore(state))
+      return false;
+
+   long from = world.ticks;
+   log.seek(resume, resumeTick);
+   count = resumeShot;
+   while(log.next(record))
+   {
+      if(record.type == RECORD_POCKET || record.type == RECORD_CONTACT ||
+         record.type == RECORD_KEYFRAME)
+         continue;
+
+      while(world.ticks < record.tick)
+         world.tick();
+      if(record.type == RECORD_SHOT && ++count == shot)
+         break;
+      applyRecord(world, record);
+   }
+   world.pocketEvents.clear();
+   world.contactEvents.clear();
+   ticksReplayed = world.ticks - from;
+   diverged = (count == shot && !matchesShot(world, record)) ? 1 : 0;
+   return count == shot;
+}
@@ -0,0 +1,234 @@
+/******************************************************************************
+ *  ReplayLog.h
+ *
+ *  Compact, append-only binary log of a game.  The simulation is
+ *  deterministic in ticks, so a game is fully described by the inputs
+ *  that change the physics (racks, elasticity, cue ball moves and size,
+ *  shots), each stamped with the tick it arrived before.  Pocket drops
+ *  and new ball contacts are logged as well, so a replay can be checked
+ *  against what was seen live, and for analysis without re-simulating.
+ *
+ *  Every session starts with a header, so one file can hold a day of
+ *  games.  Records are a type byte, the tick as a varint delta from the
+ *  previous record, and a payload of varints and raw doubles.  Every
+ *  KEYFRAME_SHOTS shots, at the first shot taken with every ball
+ *  asleep, the whole WorldState is written before the shot so a reader
+ *  can seek to a shot without replaying from the rack.
+ ******************************************************************************/
+
+#ifndef __REPLAY_LOG_H__
+#define __REPLAY_LOG_H__
+
+#include "PoolWorld.h"
+#include <fstream>
+
+
+const int KEYFRAME_SHOTS = 8;
+
+const int RECORD_SESSION = 0;
+const int RECORD_RACK = 1;
+const int RECORD_RACK_CUE = 2;
+const int RECORD_ELASTICITY = 3;
+const int RECORD_CUE = 4;
+const int RECORD_SHOT = 5;
+const int RECORD_KEYFRAME = 6;
+const int RECORD_POCKET = 7;
+const int RECORD_CONTACT = 8;
+
+
+/* One record as read back.  Which fields mean anything depends on
+ * type:
+ *   RECORD_SESSION     numBalls, tickDt, substeps
+ *   RECORD_ELASTICITY  elasticity
+ *   RECORD_CUE         the cue ball's position, radius and inverse mass
+ *   RECORD_SHOT        aim, power, and the cue ball and elasticity as
+ *                      they were when it was taken
+ *   RECORD_KEYFRAME    state
+ *   RECORD_POCKET      ball, other (the pocket)
+ *   RECORD_CONTACT     ball, other (balls j < k)
+ * Input records take effect before tick number tick; pocket and contact
+ * records happened during it.
+ */
+
+typedef struct ReplayRecord
+{
+   int type;
+   long tick;
+
+   int numBalls;
+   double tickDt;
+   int substeps;
+
+   double elasticity;
+   double cueX, cueY, radius, invMass;
+   double aimX, aimY, power;
+
+   int ball, other;
+
+   WorldState state;
+} ReplayRecord;
+
+
+/* A pocket or contact record on its own, without the room for a
+ * keyframe.
+ */
+
+typedef struct ReplayEvent
+{
+   int type;
+   long tick;
+   int ball, other;
+} ReplayEvent;
+
+
+class ReplayWriter
+{
+public:
+   ReplayWriter();
+
+   /* Append to fileName, starting a new session for world, which should
+    * have just been loaded.  Returns false if the file cannot be opened.
+    */
+
+   bool open(const char* fileName, const PoolWorld& world);
+   void close(void);
+
+   bool isOpen(void) const
+      { return out.is_open(); }
+
+   /* Log an input, just before world acts on it (shot) or just after
+    * (the rest).
+    */
+
+   void rack(const PoolWorld& world);
+   void rackCue(const PoolWorld& world);
+   void elasticity(const PoolWorld& world);
+   void cue(const PoolWorld& world);
+   void shot(const PoolWorld& world, dvec2 aim, double power);
+
+   /* Log the pocket and contact events world has gathered, which the
+    * caller then clears.  Call after every batch of ticks, so they are
+    * logged before any input that follows.
+    */
+
+   void events(const PoolWorld& world);
+
+   /* Records and bytes written since open(). */
+
+   long records;
+   long bytes;
+
+private:
+   void begin(int type, long tick);
+   void putVarint(uint64_t v);
+   void putDouble(double d);
+   void putState(const WorldState& state);
+
+   std::ofstream out;
+   std::vector<ReplayEvent> pending;
+   long lastTick;
+   int shots;
+   bool keyframeDue;
+};
+
+
+class ReplayReader
+{
+public:
+   bool open(const char* fileName);
+
+   /* Read the next record.  False at the end of the file, or if the
+    * rest of it is damaged.
+    */
+
+   bool next(ReplayRecord& record);
+
+   /* The position of the next record, for seek(). */
+
+   std::streamoff offset(void);
+
+   /* Go back or ahead to a position given by offset(), where the record
+    * read just before it was stamped with tick base.
+    */
+
+   void seek(std::streamoff at, long base);
+
+private:
+   bool getVarint(uint64_t& v);
+   bool getDouble(double& d);
+   bool getState(WorldState& state);
+
+   std::ifstream in;
+   long lastTick;
+};
+
+
+/* Replays a log against the table it was recorded on. */
+
+class ReplayPlayer
+{
+public:
+   /* table is the freshly loaded table; it is copied at the start of
+    * every session.
+    */
+
+   bool open(const char* fileName, const PoolWorld& table);
+
+   /* Re-simulate every session, checking the pocket and contact events
+    * against the log.  Leaves world at the end of the last session.
+    * Returns false if the log was recorded on another table.
+    */
+
+   bool replayAll(void);
+
+   /* Leave world as it stood when shot number shot (from 1, over the
+    * whole log) was taken, with the shot in record but not yet applied.
+    * Starts from the last keyframe or session start before the shot, and
+    * returns false if there is no such shot or its keyframe does not fit
+    * the table.
+    */
+
+   bool seek(long shot);
+
+   PoolWorld world;
+   ReplayRecord record;
+
+   /* Counts from replayAll(): events that differ from the log, and shots
+    * taken from a different cue ball or elasticity than logged (seek()
+    * sets diverged to 1 if the shot it stops at was).
+    */
+
+   long sessions, shots, ticks, events;
+   long mismatches, diverged;
+
+   /* From seek(): whether it started from a keyframe, and the ticks it
+    * had to simulate.
+    */
+
+   bool fromKeyframe;
+   long ticksReplayed;
+
+private:
+   bool startSession(const ReplayRecord& session);
+   long checkEvents(long tick);
+
+   ReplayReader log;
+   PoolWorld table;
+   std::vector<ReplayEvent> expected, produced;
+};
+
+
+/* Append the events world has gathered to events, contacts and pockets
+ * merged in the order they happened, as they are written to the log.
+ */
+
+void mergeEvents(const PoolWorld& world, std::vector<ReplayEvent>& events);
+
+/* Make the change an input record describes: rack, re-rack the cue,
+ * set the elasticity or the cue ball, or take the shot.  Other records
+ * are ignored.
+ */
+
+void applyRecord(PoolWorld& world, const ReplayRecord& record);
+
+#endif // __REPLAY_LOG_H__
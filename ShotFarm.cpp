@@ -0,0 +1,46 @@
+/******************************************************************************
+ *  ShotFarm.cpp
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "ShotFarm.h"
+
+
+ShotFarm::ShotFarm(int threads)
+   : pool(threads)
+{
+}
+
+
+static void playShot(const PoolWorld& table, const Shot& shot,
+                     double maxTime, ShotOutcome& outcome)
+{
+   PoolWorld world(table);
+
+   world.pocketEvents.clear();
+   world.contacts = 0;
+   world.shoot(shot.aim, shot.power);
+   outcome.time = world.simulateUntilRest(maxTime);
+
+   outcome.pocketed.clear();
+   for(size_t e = 0; e < world.pocketEvents.size(); e++)
+      outcome.pocketed.push_back(world.pocketEvents[e].ball);
+   outcome.scratched = world.isPocketed(CUE_BALL);
+   outcome.cuePosition = world.position(CUE_BALL);
+   outcome.contacts = world.contacts;
+}
+
+
+std::vector<ShotOutcome> ShotFarm::evaluate(const PoolWorld& table,
+                                            const std::vector<Shot>& shots,
+                                            double maxTime)
+{
+   std::vector<ShotOutcome> outcomes(shots.size());
+
+   pool.parallelFor((int) shots.size(), [&](int i)
+   {
+      playShot(table, shots[i], maxTime, outcomes[i]);
+   });
+   return outcomes;
+}
@@ -0,0 +1,61 @@
+/******************************************************************************
+ *  ShotFarm.h
+ *
+ *  Batch shot evaluation.  Given a table and a list of candidate shots,
+ *  each shot is played to rest on its own copy of the table, the copies
+ *  spread over a ThreadPool, and the outcome of each is reported.  The
+ *  table passed in is never changed, and each outcome is the same as
+ *  playing that shot alone, whatever the number of threads.
+ ******************************************************************************/
+
+#ifndef __SHOT_FARM_H__
+#define __SHOT_FARM_H__
+
+#include "PoolWorld.h"
+#include "ThreadPool.h"
+
+
+/* A cue ball hit along aim at power, as PoolWorld::shoot() takes them. */
+
+typedef struct Shot
+{
+   dvec2 aim;
+   double power;
+} Shot;
+
+
+/* pocketed lists the balls sunk, in the order they dropped.  contacts is
+ * the number of ball-ball collisions and time the simulated seconds
+ * until the table came to rest.
+ */
+
+typedef struct ShotOutcome
+{
+   std::vector<int> pocketed;
+   bool scratched;
+   dvec2 cuePosition;
+   long contacts;
+   double time;
+} ShotOutcome;
+
+
+class ShotFarm
+{
+public:
+   /* Use the given number of threads, or one per core if zero. */
+
+   explicit ShotFarm(int threads = 0);
+
+   /* Play every shot from table and return the outcomes, in the order
+    * of shots.  Each shot runs with table's engine and timestep, for at
+    * most maxTime simulated seconds.
+    */
+
+   std::vector<ShotOutcome> evaluate(const PoolWorld& table,
+                                     const std::vector<Shot>& shots,
+                                     double maxTime = MAX_SHOT_TIME);
+
+   ThreadPool pool;
+};
+
+#endif // __SHOT_FARM_H__
@@ -0,0 +1,993 @@
+/******************************************************************************
+ *  TableBatch.cpp
+ *
+ *  The lane kernels follow PoolWorld::integrate(), collisionResponse(),
+ *  sinkBalls() and bounceOffCushions() operation for operation, with
+ *  masks in place of the early returns.  Like Kernels.cpp, the vector
+ *  versions are compiled with per-function target attributes and use no
+ *  fused multiply-add.  Each is a template over a struct of the vector
+ *  operations for one scalar type, so float and double share the code.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "TableBatch.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+/***********************************************************************
+ * Shared by every version
+ ***********************************************************************/
+
+/* Ball i of lane l is near a rail; drop it if it is in a pocket. */
+
+template <class T>
+static void sinkLane(BatchLanes<T>& b, int i, int l)
+{
+   int s = i * b.width + l;
+   int p = b.pockets->find(b.px[s], b.py[s]);
+
+   if(p < 0)
+      return;
+
+   PocketEvent e;
+   e.ball = i;
+   e.pocket = p;
+   e.tick = b.ticks[l];
+   b.events[l].push_back(e);
+
+   b.vx[s] = b.vy[s] = 0.0;
+   b.pocketed[i] |= (uint64_t) 1 << l;
+}
+
+/* Record which of a pair's lanes touch this step, and count the ones
+ * that did not touch last step.  bits and group are lane masks starting
+ * at lane0.
+ */
+
+template <class T>
+static inline void touchLanes(BatchLanes<T>& b, int p, int lane0,
+                              unsigned bits, unsigned group)
+{
+   uint64_t& t = b.touching[p];
+   unsigned fresh = bits & ~(unsigned) (t >> lane0);
+
+   t = (t & ~((uint64_t) group << lane0)) | ((uint64_t) bits << lane0);
+   while(fresh)
+   {
+      b.contacts[lane0 + __builtin_ctz(fresh)]++;
+      fresh &= fresh - 1;
+   }
+}
+
+/* The lanes from lane0 in which ball i is still on the table. */
+
+template <class T>
+static inline unsigned onTable(const BatchLanes<T>& b, int i, int lane0,
+                               unsigned run)
+{
+   return run & ~(unsigned) (b.pocketed[i] >> lane0);
+}
+
+
+/***********************************************************************
+ * Scalar: one lane per call.  The constants are spelled T(...) so a
+ * float batch does its arithmetic in float.
+ ***********************************************************************/
+
+template <class T>
+static void respondScalar(BatchLanes<T>& b, int p, int j, int k)
+{
+   T radiusSum = b.reach[p];
+   T nx = b.px[j] - b.px[k];
+   T ny = b.py[j] - b.py[k];
+   T distance = std::sqrt(nx * nx + ny * ny);
+   T penetration = radiusSum - distance;
+
+   if (distance <= T(0.0))
+      return;
+
+   T rvx = b.vx[k] - b.vx[j];
+   T rvy = b.vy[k] - b.vy[j];
+
+   nx /= distance;
+   ny /= distance;
+
+   b.px[j] += T(0.5) * penetration * nx;
+   b.py[j] += T(0.5) * penetration * ny;
+   b.px[k] -= T(0.5) * penetration * nx;
+   b.py[k] -= T(0.5) * penetration * ny;
+
+   T vDOTn = rvx * nx + rvy * ny;
+
+   if (vDOTn < T(0.0))
+      return;
+
+   T impulse = -(T(1.0) + b.elasticity) * vDOTn / b.invMassSum[p];
+   T imj = b.invMass[b.pairJ[p]], imk = b.invMass[b.pairK[p]];
+
+   b.vx[k] += impulse * imk * nx;
+   b.vy[k] += impulse * imk * ny;
+   b.vx[j] -= impulse * imj * nx;
+   b.vy[j] -= impulse * imj * ny;
+}
+
+/* bounceBall() from Kernels.h, in T. */
+
+template <class T>
+static inline void bounceLane(T& x, T& y, T& u, T& v, T r,
+                              T llx, T lly, T urx, T ury)
+{
+   if (x + r > urx)
+   {
+      u = -u;
+      x = urx - r;
+   }
+   else if (y + r > ury)
+   {
+      v = -v;
+      y = ury - r;
+   }
+   else if (x - r < llx)
+   {
+      u = -u;
+      x = llx + r;
+   }
+   else if (y - r < lly)
+   {
+      v = -v;
+      y = lly + r;
+   }
+}
+
+template <class T>
+static void stepScalar(BatchLanes<T>& b, int lane0, T dt, T damping)
+{
+   const int w = b.width;
+   const unsigned run = (unsigned) (b.running >> lane0) & 1;
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      if(!onTable(b, i, lane0, run))
+         continue;
+      b.px[s] += b.vx[s] * dt;
+      b.py[s] += b.vy[s] * dt;
+      b.vx[s] *= damping;
+      b.vy[s] *= damping;
+   }
+
+   for(size_t p = 0; p < b.pairJ.size(); p++)
+   {
+      int j = b.pairJ[p], k = b.pairK[p];
+      unsigned in = onTable(b, j, lane0, run) & onTable(b, k, lane0, run) & 1;
+      unsigned hit = 0;
+
+      if(in)
+      {
+         int sj = j * w + lane0, sk = k * w + lane0;
+         T nx = b.px[sj] - b.px[sk];
+         T ny = b.py[sj] - b.py[sk];
+         hit = (nx * nx + ny * ny <= b.reach[p] * b.reach[p]) ? 1 : 0;
+         if(hit)
+            respondScalar(b, (int) p, sj, sk);
+      }
+      touchLanes(b, (int) p, lane0, hit, 1);
+   }
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a];
+      if(onTable(b, i, lane0, run) & 1)
+         sinkLane(b, i, lane0);
+   }
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      if(onTable(b, i, lane0, run) & 1)
+         bounceLane(b.px[s], b.py[s], b.vx[s], b.vy[s], b.r[i],
+                    b.llx, b.lly, b.urx, b.ury);
+   }
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/***********************************************************************
+ * AVX2: one kernel, written against a small set of vector operations
+ * for each scalar type.  Four double or eight float lanes per
+ * instruction; masks are vectors and selects are blends.
+ ***********************************************************************/
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+struct AVX2Double
+{
+   typedef double T;
+   typedef __m256d V;
+   static const int LANES = 4;
+
+   TARGET_AVX2 static V load(const T* p) { return _mm256_loadu_pd(p); }
+   TARGET_AVX2 static void store(T* p, V a) { _mm256_storeu_pd(p, a); }
+   TARGET_AVX2 static V set(T a) { return _mm256_set1_pd(a); }
+   TARGET_AVX2 static V add(V a, V b) { return _mm256_add_pd(a, b); }
+   TARGET_AVX2 static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+   TARGET_AVX2 static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+   TARGET_AVX2 static V div(V a, V b) { return _mm256_div_pd(a, b); }
+   TARGET_AVX2 static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+   TARGET_AVX2 static V both(V a, V b) { return _mm256_and_pd(a, b); }
+   TARGET_AVX2 static V either(V a, V b) { return _mm256_or_pd(a, b); }
+   TARGET_AVX2 static V andNot(V a, V b) { return _mm256_andnot_pd(a, b); }
+   TARGET_AVX2 static V le(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+   TARGET_AVX2 static V lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+   TARGET_AVX2 static V gt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+   TARGET_AVX2 static V blend(V a, V b, V m) { return _mm256_blendv_pd(a, b, m); }
+   TARGET_AVX2 static unsigned bits(V m) { return _mm256_movemask_pd(m); }
+
+   /* Negate the lanes of a set in m. */
+
+   TARGET_AVX2 static V flip(V a, V m)
+      { return _mm256_xor_pd(a, _mm256_and_pd(m, _mm256_set1_pd(-0.0))); }
+
+   /* The lanes whose bit is set, as a vector mask. */
+
+   TARGET_AVX2 static V mask(unsigned bits)
+   {
+      const __m256i laneBit = _mm256_set_epi64x(8, 4, 2, 1);
+      __m256i all = _mm256_set1_epi64x(bits);
+
+      return _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                _mm256_and_si256(all, laneBit), laneBit));
+   }
+};
+
+struct AVX2Float
+{
+   typedef float T;
+   typedef __m256 V;
+   static const int LANES = 8;
+
+   TARGET_AVX2 static V load(const T* p) { return _mm256_loadu_ps(p); }
+   TARGET_AVX2 static void store(T* p, V a) { _mm256_storeu_ps(p, a); }
+   TARGET_AVX2 static V set(T a) { return _mm256_set1_ps(a); }
+   TARGET_AVX2 static V add(V a, V b) { return _mm256_add_ps(a, b); }
+   TARGET_AVX2 static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+   TARGET_AVX2 static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+   TARGET_AVX2 static V div(V a, V b) { return _mm256_div_ps(a, b); }
+   TARGET_AVX2 static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+   TARGET_AVX2 static V both(V a, V b) { return _mm256_and_ps(a, b); }
+   TARGET_AVX2 static V either(V a, V b) { return _mm256_or_ps(a, b); }
+   TARGET_AVX2 static V andNot(V a, V b) { return _mm256_andnot_ps(a, b); }
+   TARGET_AVX2 static V le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+   TARGET_AVX2 static V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+   TARGET_AVX2 static V gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+   TARGET_AVX2 static V blend(V a, V b, V m) { return _mm256_blendv_ps(a, b, m); }
+   TARGET_AVX2 static unsigned bits(V m) { return _mm256_movemask_ps(m); }
+
+   TARGET_AVX2 static V flip(V a, V m)
+      { return _mm256_xor_ps(a, _mm256_and_ps(m, _mm256_set1_ps(-0.0f))); }
+
+   TARGET_AVX2 static V mask(unsigned bits)
+   {
+      const __m256i laneBit = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+      __m256i all = _mm256_set1_epi32(bits);
+
+      return _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(all, laneBit), laneBit));
+   }
+};
+
+template <class S>
+TARGET_AVX2
+static void respondAVX2(BatchLanes<typename S::T>& b, int p, int sj, int sk,
+                        typename S::V nx, typename S::V ny,
+                        typename S::V distanceSquared, typename S::V hit)
+{
+   typedef typename S::T T;
+   typedef typename S::V V;
+
+   const V zero = S::set(T(0.0));
+   const V imj = S::set(b.invMass[b.pairJ[p]]);
+   const V imk = S::set(b.invMass[b.pairK[p]]);
+
+   V xj = S::load(&b.px[sj]), yj = S::load(&b.py[sj]);
+   V xk = S::load(&b.px[sk]), yk = S::load(&b.py[sk]);
+   V uj = S::load(&b.vx[sj]), vj = S::load(&b.vy[sj]);
+   V uk = S::load(&b.vx[sk]), vk = S::load(&b.vy[sk]);
+
+   V distance = S::sqrt(distanceSquared);
+   V penetration = S::sub(S::set(b.reach[p]), distance);
+   V moved = S::andNot(S::le(distance, zero), hit);
+
+   V rvx = S::sub(uk, uj);
+   V rvy = S::sub(vk, vj);
+
+   nx = S::div(nx, distance);
+   ny = S::div(ny, distance);
+
+   V half = S::mul(S::set(T(0.5)), penetration);
+   V dx = S::mul(half, nx), dy = S::mul(half, ny);
+   S::store(&b.px[sj], S::blend(xj, S::add(xj, dx), moved));
+   S::store(&b.py[sj], S::blend(yj, S::add(yj, dy), moved));
+   S::store(&b.px[sk], S::blend(xk, S::sub(xk, dx), moved));
+   S::store(&b.py[sk], S::blend(yk, S::sub(yk, dy), moved));
+
+   V vDOTn = S::add(S::mul(rvx, nx), S::mul(rvy, ny));
+   V pushed = S::andNot(S::lt(vDOTn, zero), moved);
+
+   V impulse = S::div(S::mul(S::set(-(T(1.0) + b.elasticity)), vDOTn),
+                      S::set(b.invMassSum[p]));
+   V ik = S::mul(impulse, imk), ij = S::mul(impulse, imj);
+
+   S::store(&b.vx[sk], S::blend(uk, S::add(uk, S::mul(ik, nx)), pushed));
+   S::store(&b.vy[sk], S::blend(vk, S::add(vk, S::mul(ik, ny)), pushed));
+   S::store(&b.vx[sj], S::blend(uj, S::sub(uj, S::mul(ij, nx)), pushed));
+   S::store(&b.vy[sj], S::blend(vj, S::sub(vj, S::mul(ij, ny)), pushed));
+}
+
+template <class S>
+TARGET_AVX2
+static void stepAVX2(BatchLanes<typename S::T>& b, int lane0,
+                     typename S::T dt, typename S::T damping)
+{
+   typedef typename S::T T;
+   typedef typename S::V V;
+
+   const int w = b.width;
+   const unsigned all = (1u << S::LANES) - 1;
+   const unsigned run = (unsigned) (b.running >> lane0) & all;
+   const V h = S::set(dt), d = S::set(damping);
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      unsigned in = onTable(b, i, lane0, run) & all;
+      if(!in)
+         continue;
+
+      V m = S::mask(in);
+      V x = S::load(&b.px[s]), y = S::load(&b.py[s]);
+      V u = S::load(&b.vx[s]), v = S::load(&b.vy[s]);
+      S::store(&b.px[s], S::blend(x, S::add(x, S::mul(u, h)), m));
+      S::store(&b.py[s], S::blend(y, S::add(y, S::mul(v, h)), m));
+      S::store(&b.vx[s], S::blend(u, S::mul(u, d), m));
+      S::store(&b.vy[s], S::blend(v, S::mul(v, d), m));
+   }
+
+   for(size_t p = 0; p < b.pairJ.size(); p++)
+   {
+      int j = b.pairJ[p], k = b.pairK[p];
+      unsigned in = onTable(b, j, lane0, run) & onTable(b, k, lane0, run) & all;
+      unsigned hits = 0;
+
+      if(in)
+      {
+         int sj = j * w + lane0, sk = k * w + lane0;
+         V nx = S::sub(S::load(&b.px[sj]), S::load(&b.px[sk]));
+         V ny = S::sub(S::load(&b.py[sj]), S::load(&b.py[sk]));
+         V d2 = S::add(S::mul(nx, nx), S::mul(ny, ny));
+         V hit = S::le(d2, S::set(b.reach[p] * b.reach[p]));
+
+         hits = S::bits(hit) & in;
+         if(hits)
+            respondAVX2<S>(b, (int) p, sj, sk, nx, ny, d2, S::mask(hits));
+      }
+      touchLanes(b, (int) p, lane0, hits, all);
+   }
+
+   const Pockets& pk = *b.pockets;
+   const V innerL = S::set(T(pk.innerLeft));
+   const V innerB = S::set(T(pk.innerBottom));
+   const V innerR = S::set(T(pk.innerRight));
+   const V innerT = S::set(T(pk.innerTop));
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      unsigned in = onTable(b, i, lane0, run) & all;
+      if(!in)
+         continue;
+
+      V x = S::load(&b.px[s]), y = S::load(&b.py[s]);
+      V inside = S::both(S::both(S::gt(x, innerL), S::lt(x, innerR)),
+                         S::both(S::gt(y, innerB), S::lt(y, innerT)));
+      unsigned near = in & ~S::bits(inside);
+      while(near)
+      {
+         sinkLane(b, i, lane0 + __builtin_ctz(near));
+         near &= near - 1;
+      }
+   }
+
+   const V left = S::set(b.llx), bottom = S::set(b.lly);
+   const V right = S::set(b.urx), top = S::set(b.ury);
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      unsigned in = onTable(b, i, lane0, run) & all;
+      if(!in)
+         continue;
+
+      V x = S::load(&b.px[s]), y = S::load(&b.py[s]);
+      V u = S::load(&b.vx[s]), v = S::load(&b.vy[s]);
+      V rad = S::set(b.r[i]);
+
+      /* As in Kernels.cpp: done marks lanes already handled, so only the
+       * first cushion crossed counts.
+       */
+
+      V done = S::mask(~in & all);
+      V hitR = S::andNot(done, S::gt(S::add(x, rad), right));
+      done = S::either(done, hitR);
+      V hitT = S::andNot(done, S::gt(S::add(y, rad), top));
+      done = S::either(done, hitT);
+      V hitL = S::andNot(done, S::lt(S::sub(x, rad), left));
+      done = S::either(done, hitL);
+      V hitB = S::andNot(done, S::lt(S::sub(y, rad), bottom));
+
+      x = S::blend(x, S::sub(right, rad), hitR);
+      x = S::blend(x, S::add(left, rad), hitL);
+      y = S::blend(y, S::sub(top, rad), hitT);
+      y = S::blend(y, S::add(bottom, rad), hitB);
+      u = S::flip(u, S::either(hitR, hitL));
+      v = S::flip(v, S::either(hitT, hitB));
+
+      S::store(&b.px[s], x);
+      S::store(&b.py[s], y);
+      S::store(&b.vx[s], u);
+      S::store(&b.vy[s], v);
+   }
+}
+
+
+/***********************************************************************
+ * AVX-512: eight double or sixteen float lanes per instruction, with
+ * mask registers doing the selects.  AVX-512F has fused multiply-add of
+ * its own, and GCC's intrinsics are plain vector arithmetic it will
+ * fuse, so contraction is turned off here.
+ ***********************************************************************/
+
+#define TARGET_AVX512 \
+   __attribute__((target("avx512f"), optimize("fp-contract=off")))
+
+struct AVX512Double
+{
+   typedef double T;
+   typedef __m512d V;
+   typedef __mmask8 M;
+   static const int LANES = 8;
+
+   TARGET_AVX512 static V load(const T* p) { return _mm512_loadu_pd(p); }
+   TARGET_AVX512 static void store(T* p, V a) { _mm512_storeu_pd(p, a); }
+   TARGET_AVX512 static V set(T a) { return _mm512_set1_pd(a); }
+   TARGET_AVX512 static V add(V a, V b) { return _mm512_add_pd(a, b); }
+   TARGET_AVX512 static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+   TARGET_AVX512 static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+   TARGET_AVX512 static V div(V a, V b) { return _mm512_div_pd(a, b); }
+
+   /* a + b, a - b, a * b and sqrt(a) in the lanes of k, src elsewhere. */
+
+   TARGET_AVX512 static V add(V src, M k, V a, V b)
+      { return _mm512_mask_add_pd(src, k, a, b); }
+   TARGET_AVX512 static V sub(V src, M k, V a, V b)
+      { return _mm512_mask_sub_pd(src, k, a, b); }
+   TARGET_AVX512 static V mul(V src, M k, V a, V b)
+      { return _mm512_mask_mul_pd(src, k, a, b); }
+   TARGET_AVX512 static V sqrt(V src, M k, V a)
+      { return _mm512_mask_sqrt_pd(src, k, a); }
+
+   /* The lanes of k where a compares true against b. */
+
+   template <int P>
+   TARGET_AVX512 static M cmp(M k, V a, V b)
+      { return _mm512_mask_cmp_pd_mask(k, a, b, P); }
+
+   TARGET_AVX512 static V flip(V a, M k)
+   {
+      __m512i raw = _mm512_castpd_si512(a);
+
+      return _mm512_castsi512_pd(_mm512_mask_xor_epi64(raw, k, raw,
+                _mm512_set1_epi64((long long) 1 << 63)));
+   }
+};
+
+struct AVX512Float
+{
+   typedef float T;
+   typedef __m512 V;
+   typedef __mmask16 M;
+   static const int LANES = 16;
+
+   TARGET_AVX512 static V load(const T* p) { return _mm512_loadu_ps(p); }
+   TARGET_AVX512 static void store(T* p, V a) { _mm512_storeu_ps(p, a); }
+   TARGET_AVX512 static V set(T a) { return _mm512_set1_ps(a); }
+   TARGET_AVX512 static V add(V a, V b) { return _mm512_add_ps(a, b); }
+   TARGET_AVX512 static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+   TARGET_AVX512 static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+   TARGET_AVX512 static V div(V a, V b) { return _mm512_div_ps(a, b); }
+
+   TARGET_AVX512 static V add(V src, M k, V a, V b)
+      { return _mm512_mask_add_ps(src, k, a, b); }
+   TARGET_AVX512 static V sub(V src, M k, V a, V b)
+      { return _mm512_mask_sub_ps(src, k, a, b); }
+   TARGET_AVX512 static V mul(V src, M k, V a, V b)
+      { return _mm512_mask_mul_ps(src, k, a, b); }
+   TARGET_AVX512 static V sqrt(V src, M k, V a)
+      { return _mm512_mask_sqrt_ps(src, k, a); }
+
+   template <int P>
+   TARGET_AVX512 static M cmp(M k, V a, V b)
+      { return _mm512_mask_cmp_ps_mask(k, a, b, P); }
+
+   TARGET_AVX512 static V flip(V a, M k)
+   {
+      __m512i raw = _mm512_castps_si512(a);
+
+      return _mm512_castsi512_ps(_mm512_mask_xor_epi32(raw, k, raw,
+                _mm512_set1_epi32((int) 0x80000000)));
+   }
+};
+
+template <class S>
+TARGET_AVX512
+static void respondAVX512(BatchLanes<typename S::T>& b, int p, int sj, int sk,
+                          typename S::V nx, typename S::V ny,
+                          typename S::V distanceSquared, typename S::M hit)
+{
+   typedef typename S::T T;
+   typedef typename S::V V;
+   typedef typename S::M M;
+
+   const V zero = S::set(T(0.0));
+   const V imj = S::set(b.invMass[b.pairJ[p]]);
+   const V imk = S::set(b.invMass[b.pairK[p]]);
+
+   V xj = S::load(&b.px[sj]), yj = S::load(&b.py[sj]);
+   V xk = S::load(&b.px[sk]), yk = S::load(&b.py[sk]);
+   V uj = S::load(&b.vx[sj]), vj = S::load(&b.vy[sj]);
+   V uk = S::load(&b.vx[sk]), vk = S::load(&b.vy[sk]);
+
+   V distance = S::sqrt(distanceSquared, hit, distanceSquared);
+   V penetration = S::sub(S::set(b.reach[p]), distance);
+   M moved = S::template cmp<_CMP_NLE_UQ>(hit, distance, zero);
+
+   V rvx = S::sub(uk, uj);
+   V rvy = S::sub(vk, vj);
+
+   nx = S::div(nx, distance);
+   ny = S::div(ny, distance);
+
+   V half = S::mul(S::set(T(0.5)), penetration);
+   V dx = S::mul(half, nx), dy = S::mul(half, ny);
+   S::store(&b.px[sj], S::add(xj, moved, xj, dx));
+   S::store(&b.py[sj], S::add(yj, moved, yj, dy));
+   S::store(&b.px[sk], S::sub(xk, moved, xk, dx));
+   S::store(&b.py[sk], S::sub(yk, moved, yk, dy));
+
+   V vDOTn = S::add(S::mul(rvx, nx), S::mul(rvy, ny));
+   M pushed = S::template cmp<_CMP_NLT_UQ>(moved, vDOTn, zero);
+
+   V impulse = S::div(S::mul(S::set(-(T(1.0) + b.elasticity)), vDOTn),
+                      S::set(b.invMassSum[p]));
+   V ik = S::mul(impulse, imk), ij = S::mul(impulse, imj);
+
+   S::store(&b.vx[sk], S::add(uk, pushed, uk, S::mul(ik, nx)));
+   S::store(&b.vy[sk], S::add(vk, pushed, vk, S::mul(ik, ny)));
+   S::store(&b.vx[sj], S::sub(uj, pushed, uj, S::mul(ij, nx)));
+   S::store(&b.vy[sj], S::sub(vj, pushed, vj, S::mul(ij, ny)));
+}
+
+template <class S>
+TARGET_AVX512
+static void stepAVX512(BatchLanes<typename S::T>& b, int lane0,
+                       typename S::T dt, typename S::T damping)
+{
+   typedef typename S::T T;
+   typedef typename S::V V;
+   typedef typename S::M M;
+
+   const int w = b.width;
+   const unsigned all = (1u << S::LANES) - 1;
+   const unsigned run = (unsigned) (b.running >> lane0) & all;
+   const V h = S::set(dt), d = S::set(damping);
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      M in = (M) onTable(b, i, lane0, run);
+      if(!in)
+         continue;
+
+      V x = S::load(&b.px[s]), y = S::load(&b.py[s]);
+      V u = S::load(&b.vx[s]), v = S::load(&b.vy[s]);
+      S::store(&b.px[s], S::add(x, in, x, S::mul(u, h)));
+      S::store(&b.py[s], S::add(y, in, y, S::mul(v, h)));
+      S::store(&b.vx[s], S::mul(u, in, u, d));
+      S::store(&b.vy[s], S::mul(v, in, v, d));
+   }
+
+   for(size_t p = 0; p < b.pairJ.size(); p++)
+   {
+      int j = b.pairJ[p], k = b.pairK[p];
+      M in = (M) (onTable(b, j, lane0, run) & onTable(b, k, lane0, run));
+      M hits = 0;
+
+      if(in)
+      {
+         int sj = j * w + lane0, sk = k * w + lane0;
+         V nx = S::sub(S::load(&b.px[sj]), S::load(&b.px[sk]));
+         V ny = S::sub(S::load(&b.py[sj]), S::load(&b.py[sk]));
+         V d2 = S::add(S::mul(nx, nx), S::mul(ny, ny));
+
+         hits = S::template cmp<_CMP_LE_OQ>(in, d2,
+                   S::set(b.reach[p] * b.reach[p]));
+         if(hits)
+            respondAVX512<S>(b, (int) p, sj, sk, nx, ny, d2, hits);
+      }
+      touchLanes(b, (int) p, lane0, hits, all);
+   }
+
+   const Pockets& pk = *b.pockets;
+   const V innerL = S::set(T(pk.innerLeft));
+   const V innerB = S::set(T(pk.innerBottom));
+   const V innerR = S::set(T(pk.innerRight));
+   const V innerT = S::set(T(pk.innerTop));
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      M in = (M) onTable(b, i, lane0, run);
+      if(!in)
+         continue;
+
+      V x = S::load(&b.px[s]), y = S::load(&b.py[s]);
+      M inside = S::template cmp<_CMP_GT_OQ>(in, x, innerL);
+      inside = S::template cmp<_CMP_LT_OQ>(inside, x, innerR);
+      inside = S::template cmp<_CMP_GT_OQ>(inside, y, innerB);
+      inside = S::template cmp<_CMP_LT_OQ>(inside, y, innerT);
+      unsigned near = in & ~(unsigned) inside;
+      while(near)
+      {
+         sinkLane(b, i, lane0 + __builtin_ctz(near));
+         near &= near - 1;
+      }
+   }
+
+   const V left = S::set(b.llx), bottom = S::set(b.lly);
+   const V right = S::set(b.urx), top = S::set(b.ury);
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * w + lane0;
+      M in = (M) onTable(b, i, lane0, run);
+      if(!in)
+         continue;
+
+      V x = S::load(&b.px[s]), y = S::load(&b.py[s]);
+      V u = S::load(&b.vx[s]), v = S::load(&b.vy[s]);
+      V rad = S::set(b.r[i]);
+
+      /* Each cushion only sees the lanes no earlier cushion took. */
+
+      M hitR = S::template cmp<_CMP_GT_OQ>(in, S::add(x, rad), right);
+      in &= ~hitR;
+      M hitT = S::template cmp<_CMP_GT_OQ>(in, S::add(y, rad), top);
+      in &= ~hitT;
+      M hitL = S::template cmp<_CMP_LT_OQ>(in, S::sub(x, rad), left);
+      in &= ~hitL;
+      M hitB = S::template cmp<_CMP_LT_OQ>(in, S::sub(y, rad), bottom);
+
+      x = S::sub(x, hitR, right, rad);
+      x = S::add(x, hitL, left, rad);
+      y = S::sub(y, hitT, top, rad);
+      y = S::add(y, hitB, bottom, rad);
+      u = S::flip(u, hitR | hitL);
+      v = S::flip(v, hitT | hitB);
+
+      S::store(&b.px[s], x);
+      S::store(&b.py[s], y);
+      S::store(&b.vx[s], u);
+      S::store(&b.vy[s], v);
+   }
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+/***********************************************************************
+ * Dispatch
+ ***********************************************************************/
+
+/* Every version for each scalar type. */
+
+template <class T>
+struct LaneKernels
+{
+   static const BatchKernels<T> scalar;
+   static const BatchKernels<T> avx2;
+   static const BatchKernels<T> avx512;
+};
+
+template <>
+const BatchKernels<double> LaneKernels<double>::scalar =
+   { "scalar", 1, stepScalar<double> };
+template <>
+const BatchKernels<float> LaneKernels<float>::scalar =
+   { "scalar", 1, stepScalar<float> };
+
+#ifdef HAVE_X86_KERNELS
+template <>
+const BatchKernels<double> LaneKernels<double>::avx2 =
+   { "avx2", AVX2Double::LANES, stepAVX2<AVX2Double> };
+template <>
+const BatchKernels<float> LaneKernels<float>::avx2 =
+   { "avx2", AVX2Float::LANES, stepAVX2<AVX2Float> };
+template <>
+const BatchKernels<double> LaneKernels<double>::avx512 =
+   { "avx512", AVX512Double::LANES, stepAVX512<AVX512Double> };
+template <>
+const BatchKernels<float> LaneKernels<float>::avx512 =
+   { "avx512", AVX512Float::LANES, stepAVX512<AVX512Float> };
+#endif
+
+template <class T>
+const BatchKernels<T>* scalarBatchKernels(void)
+{
+   return &LaneKernels<T>::scalar;
+}
+
+template <class T>
+const BatchKernels<T>* avx2BatchKernels(void)
+{
+#ifdef HAVE_X86_KERNELS
+   if(__builtin_cpu_supports("avx2"))
+      return &LaneKernels<T>::avx2;
+#endif
+   return NULL;
+}
+
+template <class T>
+const BatchKernels<T>* avx512BatchKernels(void)
+{
+#ifdef HAVE_X86_KERNELS
+   if(__builtin_cpu_supports("avx512f"))
+      return &LaneKernels<T>::avx512;
+#endif
+   return NULL;
+}
+
+template <class T>
+static const BatchKernels<T>* widestBatchKernels(void)
+{
+   const BatchKernels<T>* best = avx512BatchKernels<T>();
+
+   if(best == NULL)
+      best = avx2BatchKernels<T>();
+   if(best == NULL)
+      best = scalarBatchKernels<T>();
+   return best;
+}
+
+template <class T>
+const BatchKernels<T>* selectBatchKernels(void)
+{
+   static const BatchKernels<T>* best = widestBatchKernels<T>();
+
+   return best;
+}
+
+
+/***********************************************************************
+ * TableBatch
+ ***********************************************************************/
+
+template <class T>
+BasicTableBatch<T>::BasicTableBatch(int lanes, const BatchKernels<T>* kernels)
+   : kernels(kernels ? kernels : selectBatchKernels<T>())
+{
+   int step = this->kernels->width;
+
+   lanes = std::max(lanes, 1);
+   lanes = (lanes + step - 1) / step * step;
+   b.width = std::min(lanes, MAX_LANES);
+   b.running = 0;
+   busyTicks = laneTicks = 0;
+}
+
+
+/* Put table's balls into lane and hit its cue ball with shot, as
+ * PoolWorld::shoot() does.
+ */
+
+template <class T>
+void BasicTableBatch<T>::load(const PoolWorld& table, int lane, const Shot& shot)
+{
+   const BallStore& balls = table.balls;
+   uint64_t bit = (uint64_t) 1 << lane;
+
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * b.width + lane;
+      b.px[s] = balls.px[i];
+      b.py[s] = balls.py[i];
+      b.vx[s] = balls.vx[i];
+      b.vy[s] = balls.vy[i];
+      if(balls.pocketed.test(i))
+         b.pocketed[i] |= bit;
+      else
+         b.pocketed[i] &= ~bit;
+   }
+   for(size_t p = 0; p < b.touching.size(); p++)
+      b.touching[p] &= ~bit;
+
+   int cue = CUE_BALL * b.width + lane;
+   b.vx[cue] = shot.aim.x * shot.power;
+   b.vy[cue] = shot.aim.y * shot.power;
+
+   b.contacts[lane] = 0;
+   b.ticks[lane] = 0;
+   b.events[lane].clear();
+   b.running |= bit;
+}
+
+
+template <class T>
+bool BasicTableBatch<T>::isMoving(int lane) const
+{
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      int i = b.live[a], s = i * b.width + lane;
+      if(b.pocketed[i] >> lane & 1)
+         continue;
+      if(b.vx[s] * b.vx[s] + b.vy[s] * b.vy[s] >= REST_SPEED * REST_SPEED)
+         return true;
+   }
+   return false;
+}
+
+
+template <class T>
+void BasicTableBatch<T>::finish(int lane, ShotOutcome& outcome) const
+{
+   int cue = CUE_BALL * b.width + lane;
+
+   outcome.pocketed.clear();
+   for(size_t e = 0; e < b.events[lane].size(); e++)
+      outcome.pocketed.push_back(b.events[lane][e].ball);
+   outcome.scratched = (b.pocketed[CUE_BALL] >> lane) & 1;
+   outcome.cuePosition = dvec2(b.px[cue], b.py[cue]);
+   outcome.contacts = b.contacts[lane];
+}
+
+
+template <class T>
+std::vector<ShotOutcome> BasicTableBatch<T>::evaluate(
+   const PoolWorld& table, const std::vector<Shot>& shots, double maxTime)
+{
+   const BallStore& balls = table.balls;
+   const int w = b.width;
+   std::vector<ShotOutcome> outcomes(shots.size());
+
+   if(table.numBalls <= CUE_BALL)
+      return outcomes;
+
+   b.live.clear();
+   for(int i = 0; i < table.numBalls; i++)
+   {
+      if(!balls.ignored.test(i))
+         b.live.push_back(i);
+   }
+   b.pairJ.clear();
+   b.pairK.clear();
+   b.reach.clear();
+   b.invMassSum.clear();
+   for(size_t a = 0; a < b.live.size(); a++)
+   {
+      for(size_t c = a + 1; c < b.live.size(); c++)
+      {
+         int j = b.live[a], k = b.live[c];
+         b.pairJ.push_back(j);
+         b.pairK.push_back(k);
+         b.reach.push_back(balls.r[j] + balls.r[k]);
+         b.invMassSum.push_back(balls.invMass[j] + balls.invMass[k]);
+      }
+   }
+
+   b.px.assign(table.numBalls * w, T(0.0));
+   b.py.assign(table.numBalls * w, T(0.0));
+   b.vx.assign(table.numBalls * w, T(0.0));
+   b.vy.assign(table.numBalls * w, T(0.0));
+   b.r.assign(balls.r.begin(), balls.r.begin() + table.numBalls);
+   b.invMass.assign(balls.invMass.begin(),
+                    balls.invMass.begin() + table.numBalls);
+   b.pocketed.assign(table.numBalls, 0);
+   b.touching.assign(b.pairJ.size(), 0);
+   b.running = 0;
+   b.contacts.assign(w, 0);
+   b.ticks.assign(w, 0);
+   b.events.resize(w);
+
+   b.elasticity = table.elasticity;
+   b.llx = table.table.ll.x;
+   b.lly = table.table.ll.y;
+   b.urx = table.table.ur.x;
+   b.ury = table.table.ur.y;
+   b.pockets = &table.pockets;
+
+   std::vector<int> shotOf(w, -1);
+   std::vector<double> t(w, 0.0);
+   size_t next = 0;
+   double dt = table.tickDt / table.substeps;
+   double damping = 1 - table.friction * dt;
+
+   while(true)
+   {
+      /* Retire the lanes whose table is at rest, as simulateUntilRest()
+       * would stop it, and refill them while shots remain.
+       */
+
+      for(int l = 0; l < w; l++)
+      {
+         while(true)
+         {
+            if(b.running >> l & 1)
+            {
+               if(t[l] < maxTime && isMoving(l))
+                  break;
+               finish(l, outcomes[shotOf[l]]);
+               outcomes[shotOf[l]].time = t[l];
+               b.running &= ~((uint64_t) 1 << l);
+            }
+            if(next == shots.size())
+               break;
+            shotOf[l] = (int) next;
+            t[l] = 0.0;
+            load(table, l, shots[next++]);
+         }
+      }
+      if(b.running == 0)
+         break;
+
+      for(int s = 0; s < table.substeps; s++)
+      {
+         for(int lane0 = 0; lane0 < w; lane0 += kernels->width)
+         {
+            if(b.running >> lane0 & ((1u << kernels->width) - 1))
+               kernels->step(b, lane0, T(dt), T(damping));
+         }
+      }
+
+      for(int l = 0; l < w; l++)
+      {
+         if(b.running >> l & 1)
+         {
+            b.ticks[l]++;
+            t[l] += table.tickDt;
+            busyTicks++;
+         }
+      }
+      laneTicks += w;
+   }
+   return outcomes;
+}
+
+
+template const BatchKernels<float>* scalarBatchKernels<float>(void);
+template const BatchKernels<double>* scalarBatchKernels<double>(void);
+template const BatchKernels<float>* avx2BatchKernels<float>(void);
+template const BatchKernels<double>* avx2BatchKernels<double>(void);
+template const BatchKernels<float>* avx512BatchKernels<float>(void);
+template const BatchKernels<double>* avx512BatchKernels<double>(void);
+template const BatchKernels<float>* selectBatchKernels<float>(void);
+template const BatchKernels<double>* selectBatchKernels<double>(void);
+
+template class BasicTableBatch<float>;
+template class BasicTableBatch<double>;
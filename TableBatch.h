@@ -0,0 +1,138 @@
+/******************************************************************************
+ *  TableBatch.h
+ *
+ *  Lockstep stepping of many copies of one table.  Each copy is a lane,
+ *  and ball i of every lane sits in adjacent doubles, so the integrate,
+ *  collision test, collision response and cushion math of one ball or
+ *  pair runs for 4 (AVX2) or 8 (AVX-512) tables per instruction.  A lane
+ *  whose table has come to rest is masked off and handed the next shot
+ *  waiting, so the lanes stay busy until the last few shots drain.
+ *
+ *  The lanes play the pairwise model of collisionResponse(), without the
+ *  contact solver and without sleeping: a lane gives bit-identical
+ *  results to a stepped PoolWorld with useContactSolver and useSleeping
+ *  turned off.
+ *
+ *  The batch is templated on its scalar type.  TableBatch runs in double,
+ *  as PoolWorld does; FloatTableBatch runs in float, with twice the lanes
+ *  to an instruction (8 for AVX2, 16 for AVX-512), for sifting through
+ *  many candidate shots where a rougher answer will do.
+ ******************************************************************************/
+
+#ifndef __TABLE_BATCH_H__
+#define __TABLE_BATCH_H__
+
+#include "ShotFarm.h"
+
+
+/* MAX_LANES is the most tables a batch steps together, one bit of a
+ * mask word each.
+ */
+
+const int MAX_LANES = 64;
+
+
+/* The lanes' state.  Per-ball values are stored ball-major: ball i of
+ * lane l is at [i * width + l].  Lane masks hold one bit per lane.
+ */
+
+template <class T>
+struct BatchLanes
+{
+   int width;
+
+   /* The balls that take part, and every pair of them, lower index
+    * first.  reach is a pair's radius sum, invMassSum its inverse
+    * masses added.  r and invMass are per ball, the same in every lane.
+    */
+
+   std::vector<int> live;
+   std::vector<int> pairJ, pairK;
+   std::vector<T> reach, invMassSum;
+
+   std::vector<T> px, py, vx, vy;
+   std::vector<T> r, invMass;
+   std::vector<uint64_t> pocketed;
+   std::vector<uint64_t> touching;
+   uint64_t running;
+
+   std::vector<long> contacts;
+   std::vector<long> ticks;
+   std::vector<std::vector<PocketEvent> > events;
+
+   T elasticity;
+   T llx, lly, urx, ury;
+   const Pockets* pockets;
+};
+
+
+template <class T>
+struct BatchKernels
+{
+   const char* name;
+
+   /* Lanes handled per call. */
+
+   int width;
+
+   /* One step of dt seconds for lanes lane0 .. lane0+width-1: integrate
+    * with damping, collide every pair, sink balls that reached a pocket
+    * and bounce off the cushions.  Lanes not in running are left alone.
+    */
+
+   void (*step)(BatchLanes<T>& b, int lane0, T dt, T damping);
+};
+
+
+/* As with Kernels, the AVX2 and AVX-512 versions return NULL when the
+ * CPU (or compiler) does not support them.  T is float or double.
+ */
+
+template <class T> const BatchKernels<T>* scalarBatchKernels(void);
+template <class T> const BatchKernels<T>* avx2BatchKernels(void);
+template <class T> const BatchKernels<T>* avx512BatchKernels(void);
+template <class T> const BatchKernels<T>* selectBatchKernels(void);
+
+
+template <class T>
+class BasicTableBatch
+{
+public:
+   /* Step the given number of tables together, rounded up to a whole
+    * number of kernel calls and at most MAX_LANES.  kernels defaults to
+    * the widest supported.
+    */
+
+   explicit BasicTableBatch(int lanes = 16,
+                            const BatchKernels<T>* kernels = NULL);
+
+   /* Play every shot from table, which must be at rest, and return the
+    * outcomes in the order of shots.  Uses table's timestep, friction
+    * and elasticity, for at most maxTime simulated seconds a shot.
+    */
+
+   std::vector<ShotOutcome> evaluate(const PoolWorld& table,
+                                     const std::vector<Shot>& shots,
+                                     double maxTime = MAX_SHOT_TIME);
+
+   const BatchKernels<T>* kernels;
+
+   /* Lane-ticks spent on a table in play, and lane-ticks paid for,
+    * since the batch was made.  Their ratio is how full the lanes ran.
+    */
+
+   long busyTicks;
+   long laneTicks;
+
+private:
+   void load(const PoolWorld& table, int lane, const Shot& shot);
+   bool isMoving(int lane) const;
+   void finish(int lane, ShotOutcome& outcome) const;
+
+   BatchLanes<T> b;
+};
+
+typedef BasicTableBatch<double> TableBatch;
+typedef BasicTableBatch<float> FloatTableBatch;
+
+#endif // __TABLE_BATCH_H__
@@ -0,0 +1,137 @@
+/******************************************************************************
+ *  ThreadPool.cpp
+ ******************************************************************************/
+
+#include "ThreadPool.h"
+#include <cstddef>
+
+
+ThreadPool::ThreadPool(int threads)
+{
+   if(threads <= 0)
+      threads = (int) std::thread::hardware_concurrency();
+   if(threads <= 0)
+      threads = 1;
+
+   generation = 0;
+   stopping = false;
+   task = NULL;
+   remaining = 0;
+   stolen = 0;
+
+   for(int t = 0; t < threads; t++)
+      queues.push_back(new Queue);
+   for(int t = 0; t < threads; t++)
+      workers.push_back(std::thread(&ThreadPool::work, this, t));
+}
+
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+
+   for(size_t t = 0; t < workers.size(); t++)
+      workers[t].join();
+   for(size_t t = 0; t < queues.size(); t++)
+      delete queues[t];
+}
+
+
+void ThreadPool::parallelFor(int n, const std::function<void(int)>& job)
+{
+   if(n <= 0)
+      return;
+
+   /* The task and count are in place before any item can be taken.
+    * Each worker starts with a contiguous run of items; stealing evens
+    * out runs that turn out to cost more than others.
+    */
+
+   task = &job;
+   remaining = n;
+
+   int threads = size();
+   for(int t = 0; t < threads; t++)
+   {
+      std::lock_guard<std::mutex> guard(queues[t]->lock);
+      for(int i = (long) n * t / threads; i < (long) n * (t + 1) / threads; i++)
+         queues[t]->items.push_back(i);
+   }
+
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      generation++;
+   }
+   wake.notify_all();
+
+   std::unique_lock<std::mutex> guard(lock);
+   while(remaining > 0)
+      done.wait(guard);
+}
+
+
+/* The next item for worker self: its own newest, else another worker's
+ * oldest.  False once every queue is empty.
+ */
+
+bool ThreadPool::next(int self, int& item)
+{
+   {
+      Queue& own = *queues[self];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if(!own.items.empty())
+      {
+         item = own.items.back();
+         own.items.pop_back();
+         return true;
+      }
+   }
+
+   int threads = size();
+   for(int v = 1; v < threads; v++)
+   {
+      Queue& victim = *queues[(self + v) % threads];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if(!victim.items.empty())
+      {
+         item = victim.items.front();
+         victim.items.pop_front();
+         stolen++;
+         return true;
+      }
+   }
+   return false;
+}
+
+
+void ThreadPool::work(int self)
+{
+   long seen = 0;
+
+   while(true)
+   {
+      {
+         std::unique_lock<std::mutex> guard(lock);
+         while(!stopping && generation == seen)
+            wake.wait(guard);
+         if(stopping)
+            return;
+         seen = generation;
+      }
+
+      int item;
+      while(next(self, item))
+      {
+         (*task)(item);
+         if(--remaining == 0)
+         {
+            std::lock_guard<std::mutex> guard(lock);
+            done.notify_all();
+         }
+      }
+   }
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+ *  ThreadPool.h
+ *
+ *  A fixed set of worker threads with one work queue each.  parallelFor()
+ *  deals the items out evenly across the queues.  A worker takes items
+ *  from the back of its own queue, and once that is empty steals from the
+ *  front of the others, so a worker that drew cheap items helps finish
+ *  the expensive ones instead of sitting idle.
+ ******************************************************************************/
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool
+{
+public:
+   /* Start the given number of workers, or one per core if zero. */
+
+   explicit ThreadPool(int threads = 0);
+   ~ThreadPool();
+
+   int size(void) const
+      { return (int) workers.size(); }
+
+   /* Run job(i) for every i from 0 to n-1 on the workers and wait for
+    * them all to finish.  Calls must not overlap.
+    */
+
+   void parallelFor(int n, const std::function<void(int)>& job);
+
+   /* Items the workers took from another worker's queue, since the pool
+    * was started.
+    */
+
+   long steals(void) const
+      { return stolen; }
+
+private:
+   struct Queue
+   {
+      std::mutex lock;
+      std::deque<int> items;
+   };
+
+   ThreadPool(const ThreadPool&);
+   ThreadPool& operator = (const ThreadPool&);
+
+   void work(int self);
+   bool next(int self, int& item);
+
+   std::vector<std::thread> workers;
+   std::vector<Queue*> queues;
+
+   /* lock guards generation and stopping.  Workers wait on wake for a
+    * new generation of work; parallelFor() waits on done for remaining
+    * to reach zero.
+    */
+
+   std::mutex lock;
+   std::condition_variable wake;
+   std::condition_variable done;
+   long generation;
+   bool stopping;
+
+   const std::function<void(int)>* task;
+   std::atomic<int> remaining;
+   std::atomic<long> stolen;
+};
+
+#endif // __THREAD_POOL_H__
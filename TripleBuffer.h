@@ -0,0 +1,64 @@
+/******************************************************************************
+ *  TripleBuffer.h
+ *
+ *  Hands the newest of a stream of values from one writer thread to one
+ *  reader thread without either ever waiting on the other.  There are
+ *  three slots: the writer fills its back slot and publish() swaps it
+ *  with the middle one; the reader's update() swaps its front slot with
+ *  the middle one if something new was published since.  The writer can
+ *  publish any number of times between reads, and the reader always gets
+ *  the last value published, whole.  Slots are reused, so a value with
+ *  its own storage (a vector) stops allocating once it has grown.
+ ******************************************************************************/
+
+#ifndef __TRIPLE_BUFFER_H__
+#define __TRIPLE_BUFFER_H__
+
+#include <atomic>
+
+
+template <class T>
+class TripleBuffer
+{
+public:
+   TripleBuffer()
+      : middle(1), back(0), front(2) {}
+
+   /* Writer side: the slot to fill, then publish it. */
+
+   T& writeBuffer(void)
+      { return slots[back]; }
+
+   void publish(void)
+      { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & SLOT; }
+
+   /* Reader side: whether something was published since the last
+    * update(), and take the newest value if so.  readBuffer() is the
+    * value taken last, and stays put until the next update().
+    */
+
+   bool fresh(void) const
+      { return (middle.load(std::memory_order_acquire) & FRESH) != 0; }
+
+   bool update(void)
+   {
+      if(!fresh())
+         return false;
+      front = middle.exchange(front, std::memory_order_acq_rel) & SLOT;
+      return true;
+   }
+
+   const T& readBuffer(void) const
+      { return slots[front]; }
+
+private:
+   static const int SLOT = 3;
+   static const int FRESH = 4;
+
+   T slots[3];
+   std::atomic<int> middle;
+   int back;
+   int front;
+};
+
+#endif // __TRIPLE_BUFFER_H__
@@ -1,10 +1,36 @@
 #version 150 
 
 in  vec4 color;
+in  vec2 offset;
+flat in float radius;
+flat in float outline;
 out vec4 fColor;
 
+layout(std140, row_major) uniform Frame
+{
+    mat4 projection;
+    float outlineWidth;
+};
+uniform bool distanceField;
+
 void main() 
 { 
-    fColor = color;
-} 
+    if (!distanceField)
+    {
+        fColor = color;
+        return;
+    }
+
+    // Signed distance to the circle, negative inside, or for an outline
+    // to a ring one pixel wide just inside the rim.  Coverage falls off
+    // over one pixel across the edge.
+    float d = length(offset) - radius;
+    if (outline > 0.5)
+        d = abs(d + 0.5 * outlineWidth) - 0.5 * outlineWidth;
 
+    float coverage = clamp(0.5 - d / outlineWidth, 0.0, 1.0);
+    if (coverage <= 0.0)
+        discard;
+
+    fColor = vec4(color.rgb, color.a * coverage);
+} 
@@ -38,78 +38,142 @@ return 1000 * tv.tv_sec + tv.tv_usec / 1000;
 
 #define DOUBLE_BUFFER
 
-/* Some basic constants.  MAX_BALLS is rather meaningless at this point.
- * ESC is the ASCII value of the Esc key.  ELASTICITY is used to define
- * the elasticity of collisions.  It may range between 1.0 (completely
- * elastic) to 0.0 (completely inelastic).  VELOCITY_SCALE is used to scale
- * velocity to a reasonable value on fast machines.  SLICES is the number
- * of vertices to generate for rendering a ball, which is rendered as a
- * circle.
+/* Some basic constants.  ESC is the ASCII value of the Esc key.
+ * VELOCITY_SCALE is used to scale velocity to a reasonable value on fast
+ * machines.  SLICES is the number of vertices to generate for rendering
+ * a ball, which is rendered as a circle.
  */
 
-const int MAX_BALLS = 100;
 const int ESC = 0x1b;
 const float VELOCITY_SCALE = 0.01;
 const int SLICES = 72;
-int count = 0;
+
+/* GAME_TICK_RATE is the physics rate in the game, in ticks per second.
+ * display() blends each ball between its last two ticks, so motion is
+ * smooth at any refresh rate without ticking faster.
+ */
+
+const double GAME_TICK_RATE = 120.0;
+
+/* MAX_FRAME_RATE caps redraws where the driver will not wait for
+ * vertical retrace.
+ */
+
+const double MAX_FRAME_RATE = 144.0;
 
 #include <time.h>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "Angel.h"
-#include <fstream>
+#ifdef WIN32
+#include <GL/wglew.h>
+#elif !defined(__APPLE__)
+#include <GL/glxew.h>
+#endif
+#include "PoolWorld.h"
+#include "ReplayLog.h"
+#include "GpuResources.h"
+#include "TripleBuffer.h"
+#include "GlState.h"
 
 
-/* Identifiers for the shader programs and the uniform projection and model
- * view matrices in the vertex shader (see vshader41.glsl).
+/* Identifiers for the shader program, the buffer holding its Frame
+ * block of per-frame constants (the projection matrix and the outline
+ * width, see vshader41.glsl), and its per-instance attributes.
  */
 
 GLuint program;
-GLuint projection;
-GLuint model_view;
+GLuint frameBlock;
+GLuint vInstance;
+GLuint vColor;
 
 
-/* Basic data structures for the simulation. */
+/* All GL state display() changes goes through gl, which skips the calls
+ * that would set what is already set and counts the rest (the 'f' key
+ * prints them).  tableProjection is fixed once the table is read.
+ */
 
-typedef vec3 Color;
+GlState gl;
+mat4 tableProjection;
 
 
-/* Most of these are self-explanatory.  vao is the indentifier for the vertex
- * array object holding the vertex attributes for this ball.  numVertices
- * is the number of vertices represented within the VAO.  geometry is the
- * geometry (GL_LINES, GL_TRIANGLES, etc.) to use when drawing the VAO.
+/* Every ball, marker and pocket is drawn from one unit circle mesh, in a
+ * single instanced draw call, one CircleInstance (see GpuResources.h)
+ * per circle.  Every ball keeps its slot, pocketed or not, so only the
+ * circles that changed since a buffer was last written are written.
  */
 
-typedef struct Ball
-{
-   vec2 position;
-   vec2 oPosition;
-   vec2 velocity;
-   GLdouble radius;
-   GLdouble mass;
-   Color color;
-   GLuint vao;
-   GLuint numVertices;
-   GLuint geometry;
-   int isPocket;
-   int isIgnored;
-   int hasBeenShot;
-} Ball;
-
-double fringeWidth;
-double friction;
-double ELASTICITY;
-int displayThreshold;
-int numBalls;
-int numPockets;
-int currentTick = -1;
-GLuint boardVAO;
-GLuint boardBuffer;
-vec2 points[4];
-vec2 aimValue;
+
+/* Every buffer and vertex array the game draws with is owned by gpu.
+ * boardMesh, circleMesh and quadMesh are the handles of its meshes.
+ * Circles are drawn either from circleMesh, SLICES segments around,
+ * or, with useDistanceField, each as a quadMesh square the fragment
+ * shader cuts the disc or ring out of (the 'm' key switches).
+ */
+
+GpuResources gpu;
+int boardMesh = -1;
+int circleMesh = -1;
+int quadMesh = -1;
+bool useDistanceField = true;
+GLuint distanceField;
+dvec2 aimValue;
 int powerValue;
-Color colors[4];
-vec2 ll, ur;
-Color boardColor, fringeColor;
-Ball aimBall, aimCircle;
+
+
+/* The instances are streamed through a ring of INSTANCE_FRAMES regions
+ * of one buffer, persistently mapped, so display() writes frame N's
+ * circles straight into memory the GPU reads while it may still be
+ * drawing frames N-1 and N-2 from the other regions.  A fence after
+ * each frame's draw says when its region can be written again.  With
+ * no ARB_buffer_storage, instanceRing is NULL and the changed circles
+ * are uploaded into the one buffer with glBufferSubData instead.
+ * instanceCapacity is the most circles a frame can hold.
+ *
+ * display() gathers a frame's circles in drawn, and instanceShadows
+ * hold what each region (or the one buffer, in [0]) was last given, so
+ * only the circles that differ are written (see InstanceShadow.h).
+ */
+
+const int INSTANCE_FRAMES = 3;
+
+GLuint instanceBuffer;
+CircleInstance* instanceRing = NULL;
+GLsync instanceFences[INSTANCE_FRAMES];
+int instanceFrame = 0;
+int instanceCapacity = 0;
+std::vector<CircleInstance> drawn;
+InstanceShadow instanceShadows[INSTANCE_FRAMES];
+
+
+/* Frame times, as the interval between display() calls while the table
+ * is in motion, over the last FRAME_SAMPLES frames, and the frames that
+ * had to wait for the GPU to finish with their ring region (stalls) and
+ * for how long in all.  uploaded is the instance bytes written to the
+ * GPU, lastUploaded the last frame's, and offered what writing every
+ * circle every frame would have been.  The 'f' key prints them.
+ */
+
+const int FRAME_SAMPLES = 1000;
+
+typedef struct FrameStats
+{
+   std::vector<double> times;
+   int next;
+   long frames;
+   long stalls;
+   double stallTime;
+   long uploaded;
+   long lastUploaded;
+   long offered;
+   std::chrono::steady_clock::time_point last;
+} FrameStats;
+
+FrameStats frameStats;
 
 /* Initial window width and height */
 
@@ -127,19 +191,9 @@ GLfloat worldTop = WORLD_HALF;
 
 
 /***********************************************************************
- * Prototypes for basic vector operations not already defined in vec.h.
+ * Prototypes for setting attributes of the simulation objects.
  ***********************************************************************/
 
-GLfloat distanceSquared(vec2 v);
-
-
-/***********************************************************************
- * Prototypes for collision detection and response, and for setting
- * attributes of the simulation objects.
- ***********************************************************************/
-
-int collision(Ball ball1, Ball ball2);
-void collisionResponse(Ball& ball1, Ball& ball2);
 void placeBalls(void);
 void shoot(void);
 void initBalls(void);
@@ -155,8 +209,16 @@ void moveCueForward(void);
 void moveCueBack(void);
 void ballSizeUp(void);
 void ballSizeDown(void);
-vec2 aim(void);
-GLuint createCircle(Ball ball);
+void printFrameStats(void);
+dvec2 aim(void);
+int createCircleMesh(void);
+int createQuadMesh(void);
+int createBoard(void);
+void releaseGraphics(void);
+void createInstanceBuffer(void);
+void uploadInstances(int n, const std::vector<int>& changed, long since,
+                     long serial);
+void drawInstances(int n);
 
 
 /***********************************************************************
@@ -170,308 +232,328 @@ void idle(void);
 void keyboard(unsigned char key, int x, int y);
 
 
-/* Data structure for holding the simulation objects. */
+/* The simulation, and a shorthand for its ball table.  outlined[i] is
+ * set for a ball drawn as just its rim.
+ */
 
-Ball balls[MAX_BALLS];
+PoolWorld world;
+BallStore& balls = world.balls;
+std::vector<bool> outlined;
 
+/* Every shot and everything else that changes the physics is appended
+ * to logName, for poolReplay.
+ */
 
-/***********************************************************************
- * Definitions for basic vector operations.
- ***********************************************************************/
+const char* logName = "pool.log";
+ReplayWriter replayLog;
 
 
-/***********************************************************************
- * We use distanceSquared() wherever we can to avoid computing a square
- * root (expensive).
- ***********************************************************************/
+/* The simulation runs on simThread, which owns world and replayLog; the
+ * GLUT thread takes worldLock to act on input.  After every batch of
+ * ticks the simulation thread publishes a FrameSnapshot, the circles as
+ * they stand, and display() draws the newest one without ever waiting.
+ *
+ * A snapshot holds the circles at tick and, in fromX and fromY, where
+ * each one was at tick from, the tick before the batch (the same place
+ * for pockets and markers).  lead is the time the world's accumulator
+ * held past tick when the snapshot was published at published.  With
+ * interpolate, display() draws the circles one tick behind the clock,
+ * part way from the one position to the other.
+ *
+ * changed lists the circles that changed after snapshot since, up to
+ * this one, serial, so display() compares only those against what the
+ * instance buffers hold.  The simulation thread keeps them in
+ * circleChanges: every circle after input, otherwise the markers, the
+ * awake balls and the balls still moving at the last snapshot, which
+ * may have just gone to sleep or into a pocket.  A ball is still moving
+ * while it is awake or drawn part way from one place to the next.
+ */
+
+typedef std::chrono::steady_clock Clock;
 
-GLfloat distanceSquared(vec2 v)
+typedef struct FrameSnapshot
 {
-   return dot(v, v);
-}
+   std::vector<CircleInstance> circles;
+   std::vector<GLfloat> fromX, fromY;
+   long from, tick;
+   double tickDt;
+   double lead;
+   Clock::time_point published;
+   std::vector<int> changed;
+   long since, serial;
+} FrameSnapshot;
+
+TripleBuffer<FrameSnapshot> snapshots;
+InstanceChanges circleChanges;
+std::vector<int> movingBalls, stillMoving;
+std::mutex worldLock;
+std::thread simThread;
+std::atomic<bool> simRunning(false);
+bool interpolate = true;
+
+/* Once every ball is asleep the simulation thread sets simAsleep and
+ * waits on simWake, and the GLUT thread stops redrawing once it has
+ * drawn the last snapshot, so a table at rest costs no CPU at all.
+ * Input sets inputPending and wakes both (see wakeSimulation()).
+ */
 
+std::condition_variable simWake;
+std::atomic<bool> simAsleep(false);
+bool inputPending = false;
 
-/***********************************************************************
- * Collision detection and response functions.
- ***********************************************************************/
+void simulate(void);
+void startSimulation(void);
+void stopSimulation(void);
+void wakeSimulation(void);
+void enableVsync(void);
+void writeSnapshot(FrameSnapshot& snapshot, const std::vector<double>& fromX,
+                   const std::vector<double>& fromY, long from, bool edited);
 
-	int collision(Ball ball1, Ball ball2)
-	{
-	   double radiusSum = ball1.radius + ball2.radius;
-
-	   /* Vector from center of ball2 to center of ball1.  This vector is
-		* normal to the collision plane.
-		*/
-
-	   vec2 collisionNormal = ball1.position - ball2.position;
-
-	   /* Note that we're comparing square of distance, to avoid computing
-		* square roots.  We've had a collision if the distance between
-		* the centers of the balls is <= to the sum of their radii.
-		*/
-	   if(ball1.isPocket == 1)
-	   {
-		   return (distanceSquared(collisionNormal) <= ball1.radius * ball1.radius)
-				  ? 1 : 0;
-	   }else if (ball2.isPocket == 1)
-		{
-		   return (distanceSquared(collisionNormal) <= ball2.radius * ball2.radius)
-				 ? 1 : 0;
-		}else{
-		   return (distanceSquared(collisionNormal) <= radiusSum * radiusSum)
-				 ? 1 : 0;
-		}
-	}
 
 /***********************************************************************
  * File Reading
  ***********************************************************************/
 void readFile()
 {
-	std::ifstream data;
-	data.open("poolData.txt");
-	if(!data.is_open())
+	if(!world.readFile("poolData.txt"))
 	{
-		std::cout << "Could not open dat file, dawg" << std::endl;
+		std::cout << "Could not read dat file, dawg" << std::endl;
 		exit(1);
 	}
-	data >> displayThreshold;
-	data >> ll.x;
-	data >> ll.y;
-	data >> ur.x;
-	data >> ur.y;
-	data >> boardColor;
-	data >> fringeWidth;
-	data >> fringeColor;
-	data >> ELASTICITY;
-	data >> friction;
-	data >> powerValue;
-	data >> numBalls;
-
-	double zC[2*numBalls];
-	int z = 0;
-	for(int i = 0; i < numBalls; i++)
-	{
-		balls[i].isPocket = 0;
-		balls[i].isIgnored = 0;
-		data >> balls[i].mass;
-		data >> balls[i].radius;
-		data >> balls[i].color;
-		data >> balls[i].position;
-		balls[i].oPosition = balls[i].position;
-		data >> zC[z]; z++;
-		data >> balls[i].velocity;
-		data >> zC[z]; z++;
-	}
-	data >> numPockets;
+	powerValue = world.powerValue;
+	world.tickDt = 1.0 / GAME_TICK_RATE;
+	outlined.assign(world.numBalls, false);
 
-	double yC[2*numPockets];
-	int y = 0;
-	for(int i = numBalls; i < (numPockets + numBalls); i++)
+	world.recordContacts = true;
+	if(!replayLog.open(logName, world))
 	{
-		balls[i].isPocket = 1;
-		balls[i].isIgnored = 0;
-		data >> balls[i].mass;
-		data >> balls[i].radius;
-		data >> balls[i].color;
-		data >> balls[i].position;
-		balls[i].oPosition = balls[i].position;
-		data >> yC[y]; y++;
-		data >> balls[i].velocity;
-		data >> yC[y]; y++;
+		std::cout << "Could not open " << logName << ", not logging" << std::endl;
 	}
-	data.close();
 }
 
 
 /***********************************************************************
- * We may have to make modifications to ball1 and ball2, so we need to
- * pass in references to them.  This function will determine the
- * response to the collision and modify each ball's position and
- * velocity vector to account for the collision response.
+ * After input: run the simulation and redraw until the table is at
+ * rest again.  Called on the GLUT thread with worldLock held.
  ***********************************************************************/
 
-void collisionResponse(Ball& ball1, Ball& ball2)
+void wakeSimulation(void)
 {
-	if(ball1.isPocket == 1)
-	{
-		ball2.velocity = 0.0;
-		ball2.position = -ball1.oPosition * 2;
-	}
-	else if(ball2.isPocket == 1)
-	{
-		ball1.velocity = 0.0;
-		ball1.position = -ball1.oPosition * 2;
-	}else if(ball1.isPocket == 0 || ball2.isPocket == 0){
-   double radiusSum = ball1.radius + ball2.radius;
-
-   /* Vector from center of ball2 to center of ball1.  This vector is
-    * normal to the collision plane.
-    */
-
-   vec2 collisionNormal = ball1.position - ball2.position;
-
-   /* Penetration distance is sum of radii less distance between centers
-    * of the two balls.
-    */
-
-   double distance = length(collisionNormal);
-   double penetration = radiusSum - distance;
-
-   vec2 relativeVelocity = ball2.velocity - ball1.velocity;
-
-   /* Dot product of relative velocity and collision normal.  If this
-    * is negative, the balls are already moving apart, and we need not
-    * compute a collision response.
-    */
+   inputPending = true;
+   simWake.notify_one();
+   glutIdleFunc(idle);
+}
 
-   double vDOTn;  
 
-   /* The following are used to compute the collision impulse.  This is
-    * energy added to each ball to draw them apart following the collision.
-    * The total energy in the system remains the same, or is less than
-    * before the collision if the collision is inelastic.
-    */
+/***********************************************************************
+ * Have glutSwapBuffers() wait for the vertical retrace, where the
+ * driver allows it.
+ ***********************************************************************/
 
-   double numerator;
-   double denominator;
-   double impulse;
+void enableVsync(void)
+{
+#ifdef WIN32
+   if (WGLEW_EXT_swap_control)
+      wglSwapIntervalEXT(1);
+#elif !defined(__APPLE__)
+   if (GLXEW_SGI_swap_control)
+      glXSwapIntervalSGI(1);
+#endif
+}
 
-   collisionNormal = normalize(collisionNormal);
 
-   /* Readjust ball position by translating each ball by 1/2 the
-    * penetration distance along the collision normal.
-    */
+/***********************************************************************
+ * Create the shared circle mesh and the buffer its instances are
+ * streamed through.
+ ***********************************************************************/
 
-   ball1.position = ball1.position + 0.5 * penetration * collisionNormal;
+  void initBalls(void)
+{
+   instanceCapacity = world.numBalls + world.pockets.size();
+   createInstanceBuffer();
+   circleMesh = createCircleMesh();
+   quadMesh = createQuadMesh();
+}
 
-   ball2.position = ball2.position - 0.5 * penetration * collisionNormal;
 
-   vDOTn = dot(relativeVelocity, collisionNormal);
+/***********************************************************************
+ * Get the unit circle for drawing from geometry, a triangle strip
+ * alternating between hub and rim (see GpuResources::circle()).  The
+ * vertex shader puts the hub at the centre for a filled circle and just
+ * inside the rim for an outline.
+ ***********************************************************************/
 
-   if (vDOTn < 0.0)
-      return;
+int createCircleMesh(void)
+{
+   gl.useProgram(program);
 
-   /* Compute impulse energy. */
+   int h = gpu.circle(program, SLICES, GL_TRIANGLE_STRIP);
+   glBindVertexArray(gpu.mesh(h).vao);
+   bindCircleInstances(program, instanceBuffer);
+   return h;
+}
 
-   numerator = -(1.0 + ELASTICITY) * vDOTn;
-   denominator = (1.0 / ball2.mass + 1.0 / ball1.mass);
-   impulse = numerator / denominator;
 
-   /* Apply the impulse to each ball. */
+/***********************************************************************
+ * Get the square around the unit circle, for drawing from the distance
+ * field.  The vertex shader grows it by a pixel so the anti-aliased
+ * edge is not clipped.
+ ***********************************************************************/
 
-   ball2.velocity = ball2.velocity + impulse / ball2.mass * collisionNormal;
+int createQuadMesh(void)
+{
+   gl.useProgram(program);
 
-   ball1.velocity = ball1.velocity - impulse / ball1.mass * collisionNormal;
-	}
+   int h = gpu.quad(program, vec2(-1.0, -1.0), vec2(1.0, 1.0));
+   glBindVertexArray(gpu.mesh(h).vao);
+   bindCircleInstances(program, instanceBuffer);
+   return h;
 }
 
+
 /***********************************************************************
- * Assign initial attributes to the two balls.  This data should really
- * be read from a file.
+ * Create the instance buffer and leave it bound.  Where the driver can
+ * keep a buffer mapped while it draws from it, this is the ring of
+ * INSTANCE_FRAMES regions, mapped once for the life of the program;
+ * writes are coherent, so nothing needs flushing before a draw.
  ***********************************************************************/
 
-  void initBalls(void)
+void createInstanceBuffer(void)
 {
-   //Create geometry information and vaos for each ball.
+   for (int f = 0; f < INSTANCE_FRAMES; f++)
+      instanceFences[f] = NULL;
 
-   for (int i = 0; i < MAX_BALLS; ++i)
+   if (GLEW_ARB_buffer_storage && GLEW_ARB_base_instance)
    {
-	  if(balls[i].isIgnored == 0)
-	   {
-		  balls[i].vao = createCircle(balls[i]);
-		  balls[i].geometry = GL_TRIANGLE_FAN;
-		  balls[i].numVertices = SLICES;
-	   }
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                         GL_MAP_COHERENT_BIT;
+      GLsizeiptr size = (GLsizeiptr) INSTANCE_FRAMES * instanceCapacity *
+                        sizeof(CircleInstance);
+
+      instanceBuffer = gpu.createStorage(GL_ARRAY_BUFFER, size, flags);
+      instanceRing = (CircleInstance*)
+         glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+   }
+
+   drawn.resize(instanceCapacity);
+   if (instanceRing == NULL)
+   {
+      instanceBuffer = gpu.createBuffer(GL_ARRAY_BUFFER,
+                                        instanceCapacity *
+                                        sizeof(CircleInstance),
+                                        NULL, GL_STREAM_DRAW);
+      std::cout << "No persistent buffer mapping, "
+                << "uploading changed instances each frame" << std::endl;
    }
 }
 
 
 /***********************************************************************
- * Create and setup a complete vao, buffer, and set of shader programs
- * to render the given ball as a circle.
+ * Write the first n circles in drawn that changed since the buffer to
+ * be drawn from was last written.  In the ring, that is the region
+ * drawn from INSTANCE_FRAMES frames ago, so its fence has almost always
+ * passed; if not, wait for it and count a stall.  Without the ring, the
+ * buffer may still be in use, and glBufferSubData() leaves it to the
+ * driver to keep the frames apart.
  ***********************************************************************/
 
-GLuint createCircle(Ball ball)
+void uploadInstances(int n, const std::vector<int>& changed, long since,
+                     long serial)
 {
-   GLuint vao, buffer;
+   size_t bytes;
 
-   vec2 points[SLICES];
-   vec3 colors[SLICES];
-   GLfloat angle = 0.0;
-   GLfloat sliceAngle = 2.0 * M_PI / (GLfloat) SLICES;
-
-   for (int i = 0; i < SLICES; i++)
+   if (instanceRing == NULL)
    {
-      points[i] = ball.radius * vec2(cos(angle), sin(angle));
-      colors[i] = ball.color;
-      angle += sliceAngle;
+      InstanceShadow& shadow = instanceShadows[0];
+      bytes = shadow.update(drawn.data(), n, NULL, changed.data(),
+                            changed.size(), since, serial);
+
+      gl.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+      for (size_t r = 0; r < shadow.runs().size(); r++)
+      {
+         const InstanceRun& run = shadow.runs()[r];
+         glBufferSubData(GL_ARRAY_BUFFER,
+                         run.first * sizeof(CircleInstance),
+                         run.count * sizeof(CircleInstance),
+                         &drawn[run.first]);
+         gl.issue();
+      }
+      frameStats.uploaded += bytes;
+      frameStats.lastUploaded = bytes;
+      frameStats.offered += n * sizeof(CircleInstance);
+      return;
    }
 
-   glGenVertexArrays(1, &vao);
-   glBindVertexArray(vao);
+   GLsync& fence = instanceFences[instanceFrame];
+   if (fence != NULL)
+   {
+      gl.issue();
+      if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+      {
+         std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+         while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                 1000000000) == GL_TIMEOUT_EXPIRED)
+            gl.issue();
+         gl.issue();
+
+         frameStats.stalls++;
+         frameStats.stallTime += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+      }
+      glDeleteSync(fence);
+      gl.issue();
+      fence = NULL;
+   }
 
-   glGenBuffers(1, &buffer);
-   glBindBuffer(GL_ARRAY_BUFFER, buffer);
+   bytes = instanceShadows[instanceFrame].update(drawn.data(), n,
+              instanceRing + instanceFrame * instanceCapacity,
+              changed.data(), changed.size(), since, serial);
+   frameStats.uploaded += bytes;
+   frameStats.lastUploaded = bytes;
+   frameStats.offered += n * sizeof(CircleInstance);
+}
 
-   glBufferData(GL_ARRAY_BUFFER, sizeof(points) + sizeof(colors),
-                NULL, GL_STATIC_DRAW);
 
-   glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(points), points);
-   glBufferSubData(GL_ARRAY_BUFFER, sizeof(points), sizeof(colors), colors);
+/***********************************************************************
+ * Draw the first n circles uploaded by uploadInstances(), and in the
+ * ring, fence the region and move on to the next.
+ ***********************************************************************/
 
-   glUseProgram(program);
+void drawInstances(int n)
+{
+   const Mesh& m = gpu.mesh(useDistanceField ? quadMesh : circleMesh);
+   gl.bindVertexArray(m.vao);
+   gl.uniform1i(distanceField, useDistanceField);
 
-   GLuint vPosition = glGetAttribLocation(program, "vPosition");
-   glEnableVertexAttribArray(vPosition);
-   glVertexAttribPointer(vPosition, 2, GL_FLOAT, GL_FALSE, 0,
-                         BUFFER_OFFSET(0));
+   if (instanceRing == NULL)
+   {
+      glDrawArraysInstanced(m.primitive, 0, m.numVertices, n);
+      gl.issue();
+      return;
+   }
 
-   GLuint vColor = glGetAttribLocation(program, "vColor");
-   glEnableVertexAttribArray(vColor);
-   glVertexAttribPointer(vColor, 3, GL_FLOAT, GL_FALSE, 0,
-                         BUFFER_OFFSET(sizeof(points)));
-   return vao;
+   glDrawArraysInstancedBaseInstance(m.primitive, 0, m.numVertices, n,
+                                     instanceFrame * instanceCapacity);
+   instanceFences[instanceFrame] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   gl.issue(2);
+   instanceFrame = (instanceFrame + 1) % INSTANCE_FRAMES;
 }
+
+
 /***********************************************************************
 * Create and setup a complete vao, buffer, and set of shader programs
  * to render the board
  ***********************************************************************/
-GLuint createBoard()
+int createBoard(void)
 {
-	int boardIndex = 0;
-
-	points[boardIndex] = vec2( ll.x, ll.y ); colors[boardIndex] = boardColor; boardIndex++;
-	points[boardIndex] = vec2( ur.x, ll.y ); colors[boardIndex] = boardColor; boardIndex++;
-	points[boardIndex] = vec2( ur.x, ur.y ); colors[boardIndex] = boardColor; boardIndex++;
-	points[boardIndex] = vec2( ll.x, ur.y  ); colors[boardIndex] = boardColor; boardIndex++;
-
-
-		   // Create a vertex array object
-		   glGenVertexArrays( 1, &boardVAO );
-		   glBindVertexArray( boardVAO );
+	/* On the rim of a unit circle at the origin, so the corners come out
+	 * where they are; the board's instance values are set in display().
+	 */
 
-		   // Create and initialize a buffer object
-		   glGenBuffers( 1, &boardBuffer );
-		   glBindBuffer( GL_ARRAY_BUFFER, boardBuffer );
-
-		   glBufferData( GL_ARRAY_BUFFER, sizeof(points) + sizeof(colors),
-						 NULL, GL_STATIC_DRAW );
-
-		   glBufferSubData( GL_ARRAY_BUFFER, 0, sizeof(points), points );
-		   glBufferSubData( GL_ARRAY_BUFFER, sizeof(points), sizeof(colors), colors );
-
-		   GLuint vPosition = glGetAttribLocation(program, "vPosition");
-		   glEnableVertexAttribArray(vPosition);
-		   glVertexAttribPointer(vPosition, 2, GL_FLOAT, GL_FALSE, 0,
-		                            BUFFER_OFFSET(0));
-
-		   GLuint vColor = glGetAttribLocation(program, "vColor");
-		   glEnableVertexAttribArray(vColor);
-		   glVertexAttribPointer(vColor, 3, GL_FLOAT, GL_FALSE, 0,
-		                            BUFFER_OFFSET(sizeof(points)));
-
-		   return boardVAO;
+	return gpu.quad(program, vec2(world.table.ll), vec2(world.table.ur));
 }
 /***********************************************************************
  * Create and set up aiming circle
@@ -479,19 +561,8 @@ GLuint createBoard()
  ***********************************************************************/
 void createAimer()
 {
-	balls[2].oPosition.x = -100.0; balls[2].oPosition.y = -100.0;
-	balls[0].geometry = GL_TRIANGLE_FAN;
-	balls[1].geometry = GL_TRIANGLE_FAN;
-	balls[2].geometry = GL_LINE_LOOP;
-	balls[3].geometry = GL_TRIANGLE_FAN;
-	balls[4].hasBeenShot = 0;
-
-	for(int i = 0; i < 4; i++)
-	{
-		balls[i].isIgnored = 1;
-		balls[i].numVertices = SLICES;
-		balls[i].vao = createCircle(balls[i]);
-	}
+	balls.info[2].oPosition.x = -100.0; balls.info[2].oPosition.y = -100.0;
+	outlined[AIM_CIRCLE] = true;
 }
 
 /***********************************************************************
@@ -499,74 +570,207 @@ void createAimer()
  ***********************************************************************/
 
 /***********************************************************************
- * Recall, this will do our rendering for us.  It is called following
- * each simulation step in order to update the window.
+ * Recall, this will do our rendering for us.  It is called whenever
+ * the simulation has published a new snapshot (see idle()).
  ***********************************************************************/
 
 void display(void)
 {
-   mat4 mv;   /* Model view matrix */
-   mat4 p;    /* Projection matrix */
-
    glClear(GL_COLOR_BUFFER_BIT);
+   gl.issue();
 
-   /* Define the projection matrix and make it available to the vertex
-    * shader.
+   /* The width of one pixel for outlines goes in the Frame block with
+    * the projection; it is only uploaded when the window is resized.
     */
 
-   p = Ortho(ll.x-fringeWidth, ur.x+fringeWidth, ll.y-fringeWidth, ur.y+fringeWidth, -1.0, 1.0);
-   glUniformMatrix4fv(projection, 1, GL_TRUE, p);
+   const Table& t = world.table;
+   gl.frameConstants(frameBlock, tableProjection,
+                     (t.ur.x - t.ll.x + 2.0 * t.fringeWidth) /
+                     glutGet(GLUT_WINDOW_WIDTH));
 
    // Render Board //
 
-   glBindVertexArray(boardVAO);
+   const Color& boardColor = t.boardColor;
+   const Mesh& board = gpu.mesh(boardMesh);
+   gl.bindVertexArray(board.vao);
+   gl.uniform1i(distanceField, GL_FALSE);
+   gl.vertexAttrib4f(vInstance, 0.0, 0.0, 1.0, 0.0);
+   gl.vertexAttrib4f(vColor, boardColor.x, boardColor.y, boardColor.z, 1.0);
+   glDrawArrays(board.primitive, 0, board.numVertices);
+   gl.issue();
+
+   /* Draw the circles from the newest snapshot in one call, where they
+    * were one tick ago: alpha of the way from the tick before the
+    * snapshot's batch to its last.
+    */
 
-   glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+   snapshots.update();
+   const FrameSnapshot& s = snapshots.readBuffer();
+   int n = s.circles.size();
 
-    // Swap buffers, for smooth animation.  This will also flush the
-   // * pipeline.
+   double alpha = 1.0;
+   if (interpolate && s.tick > s.from)
+   {
+      double span = (s.tick - s.from) * s.tickDt;
+      double since = std::chrono::duration<double>(Clock::now() -
+                                                   s.published).count();
+      alpha = std::min(std::max((s.lead + since - s.tickDt + span) / span,
+                                0.0), 1.0);
+   }
 
+   if (n > 0)
+   {
+      CircleInstance* c = drawn.data();
+      for (int k = 0; k < n; k++)
+      {
+         c[k] = s.circles[k];
+         c[k].x = s.fromX[k] + (s.circles[k].x - s.fromX[k]) * alpha;
+         c[k].y = s.fromY[k] + (s.circles[k].y - s.fromY[k]) * alpha;
+      }
+      uploadInstances(n, s.changed, s.since, s.serial);
+      drawInstances(n);
+   }
 
-   /* Render balls. */
+   // Swap buffers, for smooth animation.  This will also flush the
+   // pipeline.
 
+   glutSwapBuffers();
+   gl.endFrame();
 
-   for (int i = 0; i < MAX_BALLS; i++)
-   {
-      glBindVertexArray(balls[i].vao);
+   /* Time the frame, from the end of the last one. */
 
-      /* Define the object-appropriate model view matrix and make it
-       *  available to the vertex shader.
-       */
+   Clock::time_point now = Clock::now();
+   FrameStats& f = frameStats;
+   double time = std::chrono::duration<double>(now - f.last).count();
+   if (f.last != Clock::time_point())
+   {
+      if ((int) f.times.size() < FRAME_SAMPLES)
+         f.times.push_back(time);
+      else
+         f.times[f.next] = time;
+      f.next = (f.next + 1) % FRAME_SAMPLES;
+   }
+   f.last = now;
+   f.frames++;
+}
 
-      mv = Translate(balls[i].position.x, balls[i].position.y, 0.0);
-      glUniformMatrix4fv(model_view, 1, GL_TRUE, mv);
 
-      glDrawArrays(balls[i].geometry, 0, balls[i].numVertices);
-   }
+/***********************************************************************
+ * Print the median, 95th and 99th percentile and worst frame times over
+ * the last FRAME_SAMPLES frames, the fence stalls so far, and the GL
+ * calls and instance bytes a frame takes.
+ ***********************************************************************/
 
-   glutSwapBuffers();
+void printFrameStats(void)
+{
+   std::vector<double> t = frameStats.times;
+   if (t.empty())
+      return;
+   std::sort(t.begin(), t.end());
+
+   double p50 = t[t.size() * 50 / 100];
+   double p95 = t[t.size() * 95 / 100];
+   double p99 = t[t.size() * 99 / 100];
+
+   std::cout << "Frame time over " << t.size() << " frames: p50 "
+             << p50 * 1000.0 << " ms, p95 " << p95 * 1000.0 << " ms, p99 "
+             << p99 * 1000.0 << " ms, max " << t.back() * 1000.0 << " ms"
+             << std::endl;
+   std::cout << (instanceRing != NULL ? "Persistent instance ring: "
+                                      : "Orphaned instance buffer: ")
+             << frameStats.stalls << " fence stalls in "
+             << frameStats.frames << " frames, "
+             << frameStats.stallTime * 1000.0 << " ms waiting" << std::endl;
+   std::cout << "GL calls: " << gl.frameIssued << " in the last frame, "
+             << gl.frameSkipped << " skipped as redundant; "
+             << (double) gl.issued / frameStats.frames << " a frame on "
+             << "average, " << (double) (gl.issued + gl.skipped) /
+                frameStats.frames << " without the state cache" << std::endl;
+   if (frameStats.offered > 0)
+      std::cout << "Instance uploads: " << frameStats.lastUploaded
+                << " bytes in the last frame, "
+                << (double) frameStats.uploaded / frameStats.frames
+                << " a frame on average, "
+                << 100.0 * frameStats.uploaded / frameStats.offered
+                << "% of writing every circle" << std::endl;
+   std::cout << "GPU holds " << gpu.buffers() << " buffers, "
+             << gpu.vertexArrays() << " vertex arrays, " << gpu.bytes()
+             << " bytes" << std::endl;
 }
 
 
 void init(void) 
 {
    readFile();
-   glClearColor (fringeColor.x, fringeColor.y, fringeColor.z, 0.0);
+   glClearColor (world.table.fringeColor.x, world.table.fringeColor.y,
+                 world.table.fringeColor.z, 0.0);
    glShadeModel (GL_FLAT);   /* Probably unnecessary. */
 
    /* Load shaders and use the resulting shader program. */
 
    program = InitShader("vshader41.glsl", "fshader41.glsl");
 
-   /* Get the locations of the uniform matrices in the vertex shader. */
+   /* Get the locations of the uniform and attributes set per draw, and
+    * the Frame block, with the projection for the whole table in it.
+    */
 
-   model_view = glGetUniformLocation( program, "model_view" );
-   projection = glGetUniformLocation( program, "projection" );
+   distanceField = glGetUniformLocation( program, "distanceField" );
+   vInstance = glGetAttribLocation( program, "vInstance" );
+   vColor = glGetAttribLocation( program, "vColor" );
+
+   const Table& t = world.table;
+   tableProjection = Ortho(t.ll.x-t.fringeWidth, t.ur.x+t.fringeWidth,
+                           t.ll.y-t.fringeWidth, t.ur.y+t.fringeWidth,
+                           -1.0, 1.0);
+   frameBlock = gl.createFrameBlock(gpu, program);
+
+   /* Distance field circles fade out over their last pixel. */
+
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+   enableVsync();
 
    createAimer();
    initBalls();
-   createBoard();
+   boardMesh = createBoard();
+
+   /* The meshes were built by binding behind gl's back. */
+
+   gl.reset();
+   gl.useProgram(program);
+}
+
+
+/***********************************************************************
+ * Give back every GL object, before the context goes away.
+ ***********************************************************************/
+
+void releaseGraphics(void)
+{
+   if (instanceRing != NULL)
+   {
+      glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      instanceRing = NULL;
+   }
+   for (int f = 0; f < INSTANCE_FRAMES; f++)
+   {
+      if (instanceFences[f] != NULL)
+         glDeleteSync(instanceFences[f]);
+      instanceFences[f] = NULL;
+   }
 
+   gpu.deleteBuffer(instanceBuffer);
+   gpu.deleteBuffer(frameBlock);
+   gpu.release(circleMesh);
+   gpu.release(quadMesh);
+   gpu.release(boardMesh);
+   glDeleteProgram(program);
+
+   if (gpu.buffers() > 0 || gpu.vertexArrays() > 0)
+      std::cout << "Leaked " << gpu.buffers() << " buffers and "
+                << gpu.vertexArrays() << " vertex arrays" << std::endl;
 }
 
 
@@ -576,9 +780,16 @@ void init(void)
 
 void keyboard(unsigned char key, int x, int y)
 {
+   std::unique_lock<std::mutex> lock(worldLock);
+
+   if (key == ESC)
+      lock.unlock();
+
    switch (key)
    {
       case ESC:
+          stopSimulation();
+          releaseGraphics();
           exit(0);
           break;
       case ' ':
@@ -620,29 +831,49 @@ void keyboard(unsigned char key, int x, int y)
       case '-':
     	  lowerPower();
     	  break;
+      case 'f':
+    	  printFrameStats();
+    	  break;
+      case 'i':
+    	  interpolate = !interpolate;
+    	  std::cout << "Interpolation " << (interpolate ? "on" : "off")
+    	            << std::endl;
+    	  break;
+      case 'm':
+    	  useDistanceField = !useDistanceField;
+    	  std::cout << "Drawing circles from "
+    	            << (useDistanceField ? "a distance field" : "geometry")
+    	            << std::endl;
+    	  break;
    }
 
+   wakeSimulation();
+
 }
 void mouse( int button, int state, int x, int y )
 {
+	std::lock_guard<std::mutex> lock(worldLock);
+	double fringeWidth = world.table.fringeWidth;
+
 	if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN)
 		   {
 			y = ((450 - y)*(50 + 2 * fringeWidth))/450;
 			y = y - fringeWidth;
 			x = (x*(100 + 2 * fringeWidth))/900;
 			x = x - fringeWidth;
-			float xdif = abs(balls[2].position.x - x);
-			float ydif = abs(balls[2].position.y - y);
-			if(xdif < balls[2].radius &&
-			   ydif < balls[2].radius)
+			float xdif = abs(balls.px[2] - x);
+			float ydif = abs(balls.py[2] - y);
+			if(xdif < balls.r[2] &&
+			   ydif < balls.r[2])
 				{
-				 if(balls[4].velocity.x < 1.0 && balls[4].velocity.y <1.0)
+				 if(world.isTableAtRest())
 				 {
-					 balls[3].position.x = x; balls[3].position.y = y;
+					 balls.px[3] = x; balls.py[3] = y;
 					 aim();
 				 }
 				}
 		   }
+	wakeSimulation();
 }
 
 /***********************************************************************
@@ -650,13 +881,10 @@ void mouse( int button, int state, int x, int y )
  ***********************************************************************/
 void rackBoard()
 {
-	for(int i = 0; i < MAX_BALLS; i++)
-	{
-		balls[i].velocity = 0.0;
-		balls[i].position = balls[i].oPosition;
-		ELASTICITY = 1.0;
-	}
-	balls[4].hasBeenShot = 0;
+	world.rack();
+	world.elasticity = 1.0;
+	replayLog.rack(world);
+	replayLog.elasticity(world);
 	glutPostRedisplay();
 }
 
@@ -665,12 +893,12 @@ void rackBoard()
  ***********************************************************************/
 void shoot()
 {
-	if(balls[4].velocity.x < 0.6 && balls[4].velocity.y < 0.6)
+	if(world.isTableAtRest())
 	{
-		balls[4].hasBeenShot = 1;
-		balls[3].position = balls[3].oPosition;
-		balls[2].position = balls[4].oPosition;
-		balls[4].velocity = aimValue*powerValue;
+		world.setPosition(3, balls.info[3].oPosition);
+		world.setPosition(2, balls.info[4].oPosition);
+		replayLog.shot(world, aimValue, powerValue);
+		world.shoot(aimValue, powerValue);
 		aimValue.x = 0.0; aimValue.y = 0.0;
 		glutPostRedisplay();
 	}
@@ -680,18 +908,17 @@ void shoot()
  ***********************************************************************/
 void rackCue()
 {
-	balls[4].hasBeenShot = 0;
-	balls[4].velocity = 0.0;
-	balls[4].position = balls[4].oPosition;
+	world.rackCue();
+	replayLog.rackCue(world);
 	glutPostRedisplay();
 }
 /***********************************************************************
  * Aims the ball
  ***********************************************************************/
-vec2 aim()
+dvec2 aim()
 {
-	aimValue.x = balls[2].position.x - balls[3].position.x;
-	aimValue.y = balls[2].position.y - balls[3].position.y;
+	aimValue.x = balls.px[2] - balls.px[3];
+	aimValue.y = balls.py[2] - balls.py[3];
 	return aimValue;
 }
 /***********************************************************************
@@ -717,29 +944,31 @@ void lowerPower(void)
  ***********************************************************************/
 void elasticityUp()
 {
-	    if(ELASTICITY == 1.0)
+	    if(world.elasticity == 1.0)
 		{
-	    	ELASTICITY = 1.5;
+	    	world.elasticity = 1.5;
 	    	std::cout << "Elasticity is raised." << std::endl;
 		}
-		if(ELASTICITY == 0.5)
+		if(world.elasticity == 0.5)
 		{
-			ELASTICITY = 1.0;
+			world.elasticity = 1.0;
 			std::cout << "Elasticity is normal." << std::endl;
 		}
+		replayLog.elasticity(world);
 }
 void elasticityDown()
 {
-	if(ELASTICITY == 1.0)
+	if(world.elasticity == 1.0)
 		{
-		ELASTICITY = 0.5;
+		world.elasticity = 0.5;
 		std::cout << "Elasticity is lowered." << std::endl;
 		}
-	if(ELASTICITY == 1.5)
+	if(world.elasticity == 1.5)
 	{
-		ELASTICITY = 1.0;
+		world.elasticity = 1.0;
 		std::cout << "Elasticity is normal." << std::endl;
 	}
+	replayLog.elasticity(world);
 }
 /***********************************************************************
  * CueBall Size modifiers
@@ -747,16 +976,14 @@ void elasticityDown()
 void ballSizeUp()
 {
 		std::cout << "Cue ball size and radius are raised." << std::endl;
-		balls[4].radius = 5.125;
-		balls[4].mass = 10.0;
-		balls[4].vao = createCircle(balls[4]);
+		world.setRadius(4, 5.125, 10.0);
+		replayLog.cue(world);
 }
 void ballSizeDown()
 {
 		std::cout << "Cue ball size and radius are normal." << std::endl;
-		balls[4].radius = 1.125;
-		balls[4].mass = 6;
-		balls[4].vao = createCircle(balls[4]);
+		world.setRadius(4, 1.125, 6);
+		replayLog.cue(world);
 }
 
 /***********************************************************************
@@ -764,114 +991,287 @@ void ballSizeDown()
  ***********************************************************************/
 void moveCueUp(void)
 {
-	if(balls[4].hasBeenShot == 0)
+	if(balls.info[4].hasBeenShot == 0)
 	{
-		balls[4].position.y = balls[4].position.y + 1.0;
+		balls.py[4] = balls.py[4] + 1.0;
+		world.wake(4);
+		replayLog.cue(world);
 	}
 }
 void moveCueDown(void)
 {
-	if(balls[4].hasBeenShot == 0)
+	if(balls.info[4].hasBeenShot == 0)
 		{
-			balls[4].position.y = balls[4].position.y - 1.0;
+			balls.py[4] = balls.py[4] - 1.0;
+			world.wake(4);
+			replayLog.cue(world);
 		}
 }
 void moveCueForward(void)
 {
-	if(balls[4].hasBeenShot == 0)
+	if(balls.info[4].hasBeenShot == 0)
 	{
-		if(balls[4].position.x + 1.0 <= balls[4].oPosition.x)
+		if(balls.px[4] + 1.0 <= balls.info[4].oPosition.x)
 		{
-			balls[4].position.x = balls[4].position.x + 1.0;
+			balls.px[4] = balls.px[4] + 1.0;
+			world.wake(4);
+			replayLog.cue(world);
 		}
 	}
 }
 void moveCueBack(void)
 {
-	if(balls[4].hasBeenShot == 0)
+	if(balls.info[4].hasBeenShot == 0)
 		{
-			balls[4].position.x = balls[4].position.x - 1.0;
+			balls.px[4] = balls.px[4] - 1.0;
+			world.wake(4);
+			replayLog.cue(world);
 		}
 }
 
 /***********************************************************************
- * This computes a simulation step.  Updated ball positions are computed
- * using each ball's velocity.  Then, we check to see if the balls have
- * collided.  If so, we compute the response.  Finally, we see if either
- * ball is leaving the clipping region.  If so, we call placeBalls() to
- * re-start the simulation.
+ * Feed the wall-clock time since the last call to the simulation, which
+ * runs it off in fixed ticks.  Rendering just shows whatever state the
+ * last tick left.  Then keep the aiming circle on the cue ball while the
+ * table is at rest.
  ***********************************************************************/
 
 void idle(void)
 {
-	if(currentTick == -1)
-	{
-		currentTick = GetTickCount();
-	}
-	int idleTick = GetTickCount();
-	int dif = idleTick - currentTick;
+   /* With the table at rest and its last snapshot drawn, stop being
+    * called until input comes (see wakeSimulation()).
+    */
+
+   if (simAsleep && !snapshots.fresh())
+   {
+      glutIdleFunc(NULL);
+      frameStats.last = Clock::time_point();
+      return;
+   }
+
+   /* Redraw at once: with vsync, display() blocks in glutSwapBuffers()
+    * until the retrace, which paces the frames.  Without it, wait out
+    * the rest of the shortest frame allowed.
+    */
 
-   /* Update positions. */
+   Clock::time_point due = frameStats.last +
+      std::chrono::duration_cast<Clock::duration>(
+         std::chrono::duration<double>(1.0 / MAX_FRAME_RATE));
+   std::this_thread::sleep_until(due);
+   glutPostRedisplay();
+}
 
-   for (int i = 0; i < MAX_BALLS; ++i){
-      balls[i].position += (balls[i].velocity * (dif * .001));
-      balls[i].velocity = balls[i].velocity*(1 - friction * (dif * .001));
+
+/***********************************************************************
+ * The simulation thread.  Every tick, catch the world up to the wall
+ * clock, log and report what happened, place the aiming circle and
+ * publish the result.  worldLock is held for all of that, but not while
+ * publishing or sleeping.
+ ***********************************************************************/
+
+void simulate(void)
+{
+   Clock::time_point last = Clock::now();
+   Clock::time_point next = last;
+   Clock::duration tick = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(world.tickDt));
+
+   /* Where the balls were before the last batch that ran any ticks, and
+    * before this one.
+    */
+
+   std::vector<double> fromX(balls.px.begin(), balls.px.end());
+   std::vector<double> fromY(balls.py.begin(), balls.py.end());
+   std::vector<double> beforeX, beforeY;
+   long from = world.ticks;
+
+   while (simRunning)
+   {
+      {
+         std::unique_lock<std::mutex> lock(worldLock);
+
+         /* Sleep while every ball is asleep and nothing has happened,
+          * and start the clock afresh on waking.
+          */
+
+         if (world.awakeCount() == 0 && !inputPending)
+         {
+            simAsleep = true;
+            simWake.wait(lock, [] { return inputPending || !simRunning; });
+            simAsleep = false;
+            last = next = Clock::now();
+         }
+         bool edited = inputPending;
+         inputPending = false;
+
+         beforeX.assign(balls.px.begin(), balls.px.end());
+         beforeY.assign(balls.py.begin(), balls.py.end());
+         long before = world.ticks;
+
+         Clock::time_point now = Clock::now();
+         if (world.advance(std::chrono::duration<double>(now - last).count()))
+         {
+            fromX.swap(beforeX);
+            fromY.swap(beforeY);
+            from = before;
+         }
+         last = now;
+         replayLog.events(world);
+
+         for (size_t e = 0; e < world.pocketEvents.size(); e++)
+         {
+            std::cout << "Ball " << world.pocketEvents[e].ball
+                      << " dropped into pocket " << world.pocketEvents[e].pocket
+                      << std::endl;
+         }
+         world.pocketEvents.clear();
+         world.contactEvents.clear();
+
+         if(world.isTableAtRest())
+         {
+            world.setPosition(2, world.position(4));
+         }else
+         {
+            world.setPosition(2, -balls.info[2].oPosition);
+         }
+
+         writeSnapshot(snapshots.writeBuffer(), fromX, fromY, from, edited);
+      }
+      snapshots.publish();
+
+      /* Wake on the next tick, or straight away after a stall. */
+
+      next += tick;
+      if (next < Clock::now())
+         next = Clock::now();
+      std::this_thread::sleep_until(next);
    }
-   if(balls[4].velocity.x < 0.2 && balls[4].velocity.y < 0.2)
+}
+
+
+/***********************************************************************
+ * Write pockets, then the balls, so the balls draw over the pockets,
+ * with where the balls were at tick from, and list the circles that
+ * changed.  edited is true after input.  Called with worldLock held.
+ ***********************************************************************/
+
+void writeSnapshot(FrameSnapshot& snapshot, const std::vector<double>& fromX,
+                   const std::vector<double>& fromY, long from, bool edited)
+{
+   std::vector<CircleInstance>& c = snapshot.circles;
+   c.clear();
+   snapshot.fromX.clear();
+   snapshot.fromY.clear();
+
+   for (int p = 0; p < world.pockets.size(); p++)
    {
-	   balls[2].position = balls[4].position;
-   }else
+      const Color& color = world.pockets.color[p];
+      CircleInstance pocket = { (GLfloat) world.pockets.cx[p],
+                                (GLfloat) world.pockets.cy[p],
+                                (GLfloat) world.pockets.radius[p], 0.0,
+                                color.x, color.y, color.z, 1.0 };
+      c.push_back(pocket);
+      snapshot.fromX.push_back(pocket.x);
+      snapshot.fromY.push_back(pocket.y);
+   }
+
+   for (int i = 0; i < balls.size(); i++)
    {
-	   balls[2].position = -balls[2].oPosition;
+      /* A pocketed ball keeps its slot as an invisible circle, so the
+       * balls after it do not all move down one.
+       */
+
+      if (world.isPocketed(i))
+      {
+         CircleInstance hidden = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+         c.push_back(hidden);
+         snapshot.fromX.push_back(0.0);
+         snapshot.fromY.push_back(0.0);
+         continue;
+      }
+
+      const Color& color = balls.info[i].color;
+      CircleInstance ball = { (GLfloat) balls.px[i], (GLfloat) balls.py[i],
+                              (GLfloat) balls.r[i],
+                              (GLfloat) (outlined[i] ? 1.0 : 0.0),
+                              color.x, color.y, color.z, 1.0 };
+      c.push_back(ball);
+
+      bool moved = i >= NUM_MARKERS && i < (int) fromX.size();
+      snapshot.fromX.push_back(moved ? (GLfloat) fromX[i] : ball.x);
+      snapshot.fromY.push_back(moved ? (GLfloat) fromY[i] : ball.y);
    }
+   snapshot.from = from;
+   snapshot.tick = world.ticks;
+   snapshot.tickDt = world.tickDt;
+   snapshot.lead = world.accumulator;
+   snapshot.published = Clock::now();
 
-   /* Check for collisions and act. */
+   /* After input, take every ball as moving at the last snapshot. */
 
-   for(int j = 0; j < numBalls+numPockets; j++)
+   int first = world.pockets.size();
+   circleChanges.resize(c.size());
+   if (edited)
    {
-	   for(int k = j + 1; k < numBalls+numPockets; k++)
-	   {
-		   if (balls[j].isIgnored == 0 && balls[k].isIgnored == 0)
-		   {
-			   if (collision(balls[j], balls[k]))
-			   {
-					   collisionResponse(balls[j], balls[k]);
-			   }
-		   }
-	   }
+      circleChanges.markAll();
+      movingBalls.clear();
+      for (int i = 0; i < balls.size(); i++)
+         movingBalls.push_back(i);
+   }
+
+   const std::vector<int>& awake = world.awakeBalls();
+   stillMoving.clear();
+   for (size_t a = 0; a < awake.size(); a++)
+   {
+      circleChanges.mark(first + awake[a]);
+      stillMoving.push_back(awake[a]);
+   }
+   for (size_t m = 0; m < movingBalls.size(); m++)
+   {
+      int i = movingBalls[m], k = first + i;
+      if (!balls.sleeping.test(i))
+         continue;
+      circleChanges.mark(k);
+      if (c[k].x != snapshot.fromX[k] || c[k].y != snapshot.fromY[k])
+         stillMoving.push_back(i);
    }
-   for(int j = 0; j < numBalls; j++)
-     {
-	   if(balls[j].isIgnored == 0){
-  		   if (balls[j].position.x + balls[j].radius > ur.x){
-  			   balls[j].velocity.x = -balls[j].velocity.x;
-  			   balls[j].position.x = ur.x - balls[j].radius;
-  			   }
-  		   else if (balls[j].position.y + balls[j].radius > ur.y){
-  			   balls[j].velocity.y = balls[j].velocity.y * -1;
-  			   balls[j].position.y = ur.y - balls[j].radius;
-  			   }
-  		   else if (balls[j].position.x - balls[j].radius < ll.x){
-  			   balls[j].velocity.x = balls[j].velocity.x * -1;
-  			   balls[j].position.x = ll.x + balls[j].radius;
-  			   }
-  		   else if (balls[j].position.y - balls[j].radius < ll.y){
-  			   balls[j].velocity.y = balls[j].velocity.y * -1;
-  			   balls[j].position.y = ll.y + balls[j].radius;
-  			   }
-	   }
-     }
-
-
-   // Re-render the scene. */
-
-   count++;
-   if(count == displayThreshold)
+   movingBalls.swap(stillMoving);
+   for (int i = 0; i < NUM_MARKERS && i < balls.size(); i++)
+      circleChanges.mark(first + i);
+   circleChanges.close();
+
+   snapshot.changed = circleChanges.list();
+   snapshot.since = circleChanges.since();
+   snapshot.serial = circleChanges.serial();
+}
+
+
+/***********************************************************************
+ * Publish the table as loaded, so the first frame has something to
+ * draw, and start the simulation thread; and stop it again.
+ ***********************************************************************/
+
+void startSimulation(void)
+{
+   std::vector<double> noMotion;
+   writeSnapshot(snapshots.writeBuffer(), noMotion, noMotion, world.ticks,
+                 true);
+   snapshots.publish();
+
+   simRunning = true;
+   simThread = std::thread(simulate);
+}
+
+
+void stopSimulation(void)
+{
    {
-	   glutPostRedisplay();
-	   count = 0;
+      std::lock_guard<std::mutex> lock(worldLock);
+      simRunning = false;
    }
-   currentTick = idleTick;
+   simWake.notify_one();
+   if (simThread.joinable())
+      simThread.join();
 }
 
    
@@ -895,10 +1295,14 @@ int main(int argc, char** argv)
    //glutInitContextProfile(GLUT_CORE_PROFILE);
    glutCreateWindow("Colliding balls");
 
+   if(argc > 1)
+      logName = argv[1];
+
    glewExperimental = GL_TRUE;
    glewInit();
 
    init();
+   startSimulation();
 
    glutDisplayFunc(display); 
 #ifdef RESHAPE
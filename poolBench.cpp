@@ -0,0 +1,1845 @@
+/******************************************************************************
+ *  poolBench.cpp
+ *
+ *  Headless benchmarks for the simulation core.  Each benchmark prints a
+ *  small table to stdout.  With no arguments every benchmark is run;
+ *  otherwise only the ones named on the command line.
+ *
+ *  Usage: poolBench [broadphase] [layout] [timestep] [events] [kernels]
+ *                   [sleep] [solver] [pockets] [farm] [batch]
+ *                   [precision] [snapshot] [scale] [replay] [interp]
+ *                   [upload]
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "PoolWorld.h"
+#include "EventSimulator.h"
+#include "Kernels.h"
+#include "ShotFarm.h"
+#include "TableBatch.h"
+#include "ReplayLog.h"
+#include "InstanceShadow.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <unistd.h>
+
+
+/***********************************************************************
+ * Helpers
+ ***********************************************************************/
+
+static double now(void)
+{
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* Set by a benchmark whose check fails; poolBench then exits with 1. */
+
+static bool failed = false;
+
+/* Simple deterministic generator so every run benchmarks the same scene. */
+
+static unsigned benchSeed = 12345;
+
+static double randUnit(void)
+{
+   benchSeed = benchSeed * 1664525u + 1013904223u;
+   return (benchSeed >> 8) * (1.0 / 16777216.0);
+}
+
+/* Fill world with n pool balls scattered over a table whose area grows
+ * with n, so the density (and with it the contacts per ball) matches a
+ * regular table.  Balls start on a jittered lattice so none overlap.
+ */
+
+static void makeStressScene(PoolWorld& world, int n)
+{
+   const double radius = 1.125;
+   const double spacing = 4.0 * radius;
+   int columns = (int) std::ceil(std::sqrt(2.0 * n));
+   int rows = (n + columns - 1) / columns;
+
+   benchSeed = 12345;
+   world.table.ll = dvec2(0.0, 0.0);
+   world.table.ur = dvec2(columns * spacing, rows * spacing);
+   world.friction = 0.0;
+   world.elasticity = 1.0;
+   world.numBalls = n;
+   world.pockets.clear();
+   world.balls.resize(n);
+
+   BallStore& b = world.balls;
+   for(int i = 0; i < n; i++)
+   {
+      b.r[i] = radius;
+      b.setMass(i, 6.0);
+      b.px[i] = (i % columns + 0.5) * spacing + (randUnit() - 0.5) * radius;
+      b.py[i] = (i / columns + 0.5) * spacing + (randUnit() - 0.5) * radius;
+      b.info[i].oPosition = world.position(i);
+      b.vx[i] = (randUnit() - 0.5) * 40.0;
+      b.vy[i] = (randUnit() - 0.5) * 40.0;
+   }
+   world.wakeAll();
+}
+
+/* Load poolData.txt and hit the cue ball along aim at power.  A power
+ * of zero means the file's power.  The default is the standard break:
+ * the cue ball driven straight into the rack.
+ */
+
+static bool setupBreak(PoolWorld& world, dvec2 aim = dvec2(8.0, 0.0),
+                       double power = 0.0)
+{
+   if(!world.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return false;
+   }
+   world.shoot(aim, power > 0.0 ? power : world.powerValue);
+   return true;
+}
+
+/* Number of balls whose pocketed state differs between two worlds. */
+
+static int pocketMismatches(const PoolWorld& a, const PoolWorld& b)
+{
+   int mismatches = 0;
+
+   for(int i = NUM_MARKERS; i < a.numBalls; i++)
+   {
+      if(a.isPocketed(i) != b.isPocketed(i))
+         mismatches++;
+   }
+   return mismatches;
+}
+
+/* Largest distance between the final positions of the same simulated
+ * ball in two worlds.
+ */
+
+static double maxDeviation(const PoolWorld& a, const PoolWorld& b)
+{
+   double worst = 0.0;
+
+   for(int i = NUM_MARKERS; i < a.numBalls; i++)
+   {
+      if(a.isPocketed(i) || b.isPocketed(i))
+         continue;
+      double d = length(a.position(i) - b.position(i));
+      if(d > worst)
+         worst = d;
+   }
+   return worst;
+}
+
+/* Average wall-clock seconds per step() over enough steps to take at
+ * least minTime.
+ */
+
+static double timeSteps(PoolWorld& world, double dt, double minTime)
+{
+   int steps = 0;
+   double start = now();
+   double elapsed;
+
+   do
+   {
+      world.step(dt);
+      steps++;
+      elapsed = now() - start;
+   } while(elapsed < minTime);
+
+   return elapsed / steps;
+}
+
+
+/***********************************************************************
+ * Step time with and without the uniform-grid broadphase.  With the grid
+ * the cost per ball should stay roughly flat as the scene grows.
+ ***********************************************************************/
+
+static void benchBroadphase(void)
+{
+   const int sizes[] = { 20, 100, 1000, 10000, 100000 };
+   const int maxBruteForce = 10000;
+
+   std::cout << "broadphase: step time vs. ball count" << std::endl;
+   std::cout << std::setw(8) << "balls"
+             << std::setw(14) << "grid us/step"
+             << std::setw(14) << "grid ns/ball"
+             << std::setw(14) << "all us/step"
+             << std::setw(14) << "all ns/ball" << std::endl;
+
+   for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+   {
+      int n = sizes[s];
+      PoolWorld world;
+
+      makeStressScene(world, n);
+      world.useBroadphase = true;
+      double grid = timeSteps(world, 0.001, 0.25);
+
+      std::cout << std::setw(8) << n
+                << std::setw(14) << std::fixed << std::setprecision(2)
+                << grid * 1e6
+                << std::setw(14) << grid * 1e9 / n;
+
+      if(n <= maxBruteForce)
+      {
+         makeStressScene(world, n);
+         world.useBroadphase = false;
+         double all = timeSteps(world, 0.001, 0.25);
+         std::cout << std::setw(14) << all * 1e6
+                   << std::setw(14) << all * 1e9 / n;
+      }
+      std::cout << std::endl;
+   }
+
+   /* Two balls at rest, three cells apart once the grid is built, then
+    * the first grown, awake, until they overlap.  Its radius is written
+    * straight into the store, so only the grid's own check can find the
+    * contact.
+    */
+
+   PoolWorld world;
+   makeStressScene(world, 2);
+   world.table.ur = dvec2(20.0, 10.0);
+   for(int i = 0; i < 2; i++)
+   {
+      world.balls.px[i] = 2.0 + 6.0 * i;
+      world.balls.py[i] = 5.0;
+      world.balls.vx[i] = world.balls.vy[i] = 0.0;
+   }
+   world.step(0.001);
+   world.balls.r[0] = 5.125;
+   world.step(0.001);
+
+   bool found = world.contacts > 0;
+   if(!found)
+      failed = true;
+   std::cout << "  ball grown while awake: contact in the next cell "
+             << (found ? "found" : "MISSED") << std::endl;
+}
+
+
+/***********************************************************************
+ * Integrate-and-bounce pass over the old array-of-structs Ball layout,
+ * which interleaved GL handles and bookkeeping with the physics, against
+ * the same pass over BallStore.  The collision phase is left out because
+ * it costs the same either way once the broadphase has run.
+ ***********************************************************************/
+
+typedef struct LegacyBall
+{
+   vec2 position;
+   vec2 oPosition;
+   vec2 velocity;
+   GLdouble radius;
+   GLdouble mass;
+   Color color;
+   GLuint vao;
+   GLuint numVertices;
+   GLuint geometry;
+   int isPocket;
+   int isIgnored;
+   int hasBeenShot;
+} LegacyBall;
+
+static void legacyStep(LegacyBall* balls, int n, const Table& table,
+                       double friction, double dt)
+{
+   const vec2 ll(table.ll);
+   const vec2 ur(table.ur);
+
+   for (int i = 0; i < n; ++i)
+   {
+      balls[i].position += (balls[i].velocity * dt);
+      balls[i].velocity = balls[i].velocity * (1 - friction * dt);
+   }
+   for(int j = 0; j < n; j++)
+   {
+      if(balls[j].isIgnored == 0)
+      {
+         if (balls[j].position.x + balls[j].radius > ur.x)
+         {
+            balls[j].velocity.x = -balls[j].velocity.x;
+            balls[j].position.x = ur.x - balls[j].radius;
+         }
+         else if (balls[j].position.y + balls[j].radius > ur.y)
+         {
+            balls[j].velocity.y = balls[j].velocity.y * -1;
+            balls[j].position.y = ur.y - balls[j].radius;
+         }
+         else if (balls[j].position.x - balls[j].radius < ll.x)
+         {
+            balls[j].velocity.x = balls[j].velocity.x * -1;
+            balls[j].position.x = ll.x + balls[j].radius;
+         }
+         else if (balls[j].position.y - balls[j].radius < ll.y)
+         {
+            balls[j].velocity.y = balls[j].velocity.y * -1;
+            balls[j].position.y = ll.y + balls[j].radius;
+         }
+      }
+   }
+}
+
+static void benchLayout(void)
+{
+   const int sizes[] = { 100, 10000, 1000000 };
+
+   std::cout << "layout: integrate + cushions, ns/ball" << std::endl;
+   std::cout << std::setw(8) << "balls"
+             << std::setw(14) << "structs"
+             << std::setw(14) << "BallStore" << std::endl;
+
+   for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+   {
+      int n = sizes[s];
+      PoolWorld world;
+      makeStressScene(world, n);
+
+      std::vector<LegacyBall> legacy(n);
+      for(int i = 0; i < n; i++)
+      {
+         legacy[i].position = vec2(world.position(i));
+         legacy[i].velocity = vec2(world.velocity(i));
+         legacy[i].radius = world.balls.r[i];
+         legacy[i].mass = world.balls.info[i].mass;
+         legacy[i].isIgnored = 0;
+      }
+
+      int steps = 0;
+      double start = now(), structs, store;
+      do
+      {
+         legacyStep(&legacy[0], n, world.table, world.friction, 0.001);
+         steps++;
+      } while((structs = now() - start) < 0.25);
+      structs /= steps;
+
+      steps = 0;
+      start = now();
+      do
+      {
+         world.integrate(0.001);
+         world.bounceOffCushions();
+         steps++;
+      } while((store = now() - start) < 0.25);
+      store /= steps;
+
+      std::cout << std::setw(8) << n
+                << std::setw(14) << std::fixed << std::setprecision(2)
+                << structs * 1e9 / n
+                << std::setw(14) << store * 1e9 / n << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Accuracy and cost of the break shot at several fixed timesteps, against
+ * a reference run at a very small one.  Also checks that two runs of the
+ * same shot finish bit-identical.
+ ***********************************************************************/
+
+static void benchTimestep(void)
+{
+   const struct { double rate; int substeps; } configs[] = {
+      { 60.0, 1 }, { 120.0, 1 }, { 120.0, 4 }, { 240.0, 1 },
+      { 240.0, 4 }, { 480.0, 2 }, { 960.0, 1 }, { 960.0, 4 }
+   };
+
+   std::cout << "timestep: break shot vs. 7680 Hz x 4 reference" << std::endl;
+
+   PoolWorld reference;
+   if(!setupBreak(reference))
+      return;
+   reference.tickDt = 1.0 / 7680.0;
+   reference.substeps = 4;
+   reference.simulateUntilRest();
+
+   std::cout << std::setw(8) << "Hz"
+             << std::setw(10) << "substeps"
+             << std::setw(14) << "ms/shot"
+             << std::setw(14) << "max error" << std::endl;
+
+   for(size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+   {
+      PoolWorld world;
+      setupBreak(world);
+      world.tickDt = 1.0 / configs[c].rate;
+      world.substeps = configs[c].substeps;
+
+      double start = now();
+      world.simulateUntilRest();
+      double elapsed = now() - start;
+
+      std::cout << std::setw(8) << std::fixed << std::setprecision(0)
+                << configs[c].rate
+                << std::setw(10) << configs[c].substeps
+                << std::setw(14) << std::setprecision(3) << elapsed * 1e3
+                << std::setw(14) << maxDeviation(world, reference)
+                << std::endl;
+   }
+
+   PoolWorld first, second;
+   setupBreak(first);
+   setupBreak(second);
+   first.simulateUntilRest();
+   second.simulateUntilRest();
+
+   bool identical = first.balls.px == second.balls.px &&
+                    first.balls.py == second.balls.py &&
+                    first.balls.vx == second.balls.vx &&
+                    first.balls.vy == second.balls.vy;
+   std::cout << "repeat run bit-identical: " << (identical ? "yes" : "NO")
+             << std::endl;
+}
+
+
+/***********************************************************************
+ * Event-driven engine against the stepped engine.  Errors are the
+ * largest final-position difference of any ball left on the table, and
+ * "pkt" counts balls pocketed in one run but not the other.  The event
+ * engine must end within EVENT_TOLERANCE of the stepped engine run at
+ * 7680 Hz x 4, with the same balls pocketed; a shot where it does not
+ * is flagged and fails the benchmark.  The stepped engine at the default
+ * 240 Hz x 4 is timed and its error shown, but not held to that: a
+ * glancing contact can fall between two of its steps and send a ball
+ * somewhere else entirely ("step err"; "vs event" is the two engines
+ * against each other at their defaults).
+ ***********************************************************************/
+
+static const double EVENT_TOLERANCE = 1.0;
+
+static void benchEvents(void)
+{
+   const struct { double x, y, power; } shots[] = {
+      { 8.0, 0.0, 0.0 }, { 8.0, 0.3, 0.0 }, { 7.0, -2.0, 14.0 },
+      { 8.0, 1.0, 5.0 }, { 6.0, 5.0, 14.0 }, { 0.5, 8.0, 30.0 }
+   };
+
+   std::cout << "events: event-driven vs. stepped at 7680 Hz x 4, tolerance "
+             << std::fixed << std::setprecision(1) << EVENT_TOLERANCE
+             << std::endl;
+   std::cout << std::setw(16) << "shot"
+             << std::setw(11) << "step ms"
+             << std::setw(10) << "step err"
+             << std::setw(5) << "pkt"
+             << std::setw(11) << "event ms"
+             << std::setw(10) << "event err"
+             << std::setw(5) << "pkt"
+             << std::setw(8) << "events"
+             << std::setw(10) << "vs event" << std::endl;
+
+   for(size_t s = 0; s < sizeof(shots) / sizeof(shots[0]); s++)
+   {
+      dvec2 aim(shots[s].x, shots[s].y);
+      PoolWorld reference, stepped, events;
+
+      if(!setupBreak(reference, aim, shots[s].power))
+         return;
+      reference.tickDt = 1.0 / 7680.0;
+      reference.substeps = 4;
+      reference.simulateUntilRest();
+
+      setupBreak(stepped, aim, shots[s].power);
+      double start = now();
+      stepped.simulateUntilRest();
+      double steppedTime = now() - start;
+
+      setupBreak(events, aim, shots[s].power);
+      EventSimulator engine(events);
+      start = now();
+      engine.simulateUntilRest();
+      double eventTime = now() - start;
+
+      double eventError = maxDeviation(events, reference);
+      bool within = eventError <= EVENT_TOLERANCE &&
+                    pocketMismatches(events, reference) == 0;
+      if(!within)
+         failed = true;
+
+      std::cout << std::setw(6) << std::fixed << std::setprecision(1)
+                << aim.x << "," << std::setw(4) << aim.y << " x"
+                << std::setw(4) << std::setprecision(0)
+                << (shots[s].power > 0.0 ? shots[s].power : reference.powerValue)
+                << std::setprecision(3)
+                << std::setw(11) << steppedTime * 1e3
+                << std::setw(10) << maxDeviation(stepped, reference)
+                << std::setw(5) << pocketMismatches(stepped, reference)
+                << std::setw(11) << eventTime * 1e3
+                << std::setw(10) << eventError
+                << std::setw(5) << pocketMismatches(events, reference)
+                << std::setw(8) << engine.events
+                << std::setw(10) << maxDeviation(stepped, events)
+                << (within ? "" : "  OVER TOLERANCE") << std::endl;
+   }
+
+   /* The cue ball starting inside a pocket, on the table side of its
+    * center and rolling out onto the table.  Both engines must sink it.
+    */
+
+   PoolWorld stepped, events;
+   if(!stepped.readFile("poolData.txt") || !events.readFile("poolData.txt"))
+      return;
+
+   PoolWorld* worlds[] = { &stepped, &events };
+   for(int w = 0; w < 2; w++)
+   {
+      PoolWorld& world = *worlds[w];
+      const Pockets& pockets = world.pockets;
+      double cx = 0.5 * (world.table.ll.x + world.table.ur.x);
+      double cy = 0.5 * (world.table.ll.y + world.table.ur.y);
+      double dx = cx - pockets.cx[0], dy = cy - pockets.cy[0];
+      double d = std::sqrt(dx * dx + dy * dy);
+      double inset = 0.5 * pockets.radius[0] / d;
+
+      world.balls.px[CUE_BALL] = pockets.cx[0] + inset * dx;
+      world.balls.py[CUE_BALL] = pockets.cy[0] + inset * dy;
+      world.setVelocity(CUE_BALL, dvec2(20.0 * dx / d, 20.0 * dy / d));
+   }
+   stepped.simulateUntilRest();
+   EventSimulator engine(events);
+   engine.simulateUntilRest();
+
+   bool sunk = events.isPocketed(CUE_BALL) &&
+               stepped.isPocketed(CUE_BALL);
+   if(!sunk)
+      failed = true;
+   std::cout << "  ball inside a pocket rolling out: stepped "
+             << (stepped.isPocketed(CUE_BALL) ? "sinks" : "MISSES")
+             << " it, events "
+             << (events.isPocketed(CUE_BALL) ? "sink" : "MISS") << " it"
+             << std::endl;
+
+   /* The break on a budget of five events, which the stepped engine
+    * must finish.
+    */
+
+   PoolWorld budget;
+   setupBreak(budget);
+   EventSimulator limited(budget);
+   limited.maxEvents = 5;
+   limited.simulateUntilRest();
+
+   bool finished = limited.steppedFinish && limited.events == 5 &&
+                   !budget.isMoving();
+   if(!finished)
+      failed = true;
+   std::cout << "  break on a budget of 5 events: "
+             << (finished ? "finished stepped, at rest" : "NOT FINISHED")
+             << std::endl;
+}
+
+
+/***********************************************************************
+ * Integrate and cushion kernels: the scalar loop against the SSE2 and
+ * AVX2 versions.  Every seventh ball is ignored so the masked path gets
+ * exercised.  "same" checks the final state is bit-identical to scalar.
+ ***********************************************************************/
+
+static double timeKernels(const Kernels* k, PoolWorld& world, int steps)
+{
+   BallStore& b = world.balls;
+   const Table& t = world.table;
+   int n = b.size();
+   double start = now();
+
+   for(int s = 0; s < steps; s++)
+   {
+      k->integrate(&b.px[0], &b.py[0], &b.vx[0], &b.vy[0], n, 0.001, 0.9994);
+      k->bounce(&b.px[0], &b.py[0], &b.vx[0], &b.vy[0], &b.r[0], b.ignored, n,
+                t.ll.x, t.ll.y, t.ur.x, t.ur.y);
+   }
+   return (now() - start) / steps;
+}
+
+static void benchKernels(void)
+{
+   const int sizes[] = { 16, 1000, 1000000 };
+   const Kernels* versions[] = { scalarKernels(), sse2Kernels(), avx2Kernels() };
+   const int numVersions = sizeof(versions) / sizeof(versions[0]);
+
+   std::cout << "kernels: integrate + cushions, ns/ball (selected: "
+             << selectKernels()->name << ")" << std::endl;
+   std::cout << std::setw(8) << "balls";
+   for(int v = 0; v < numVersions; v++)
+   {
+      if(versions[v] != NULL)
+         std::cout << std::setw(10) << versions[v]->name << std::setw(6) << "same";
+   }
+   std::cout << std::endl;
+
+   for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+   {
+      int n = sizes[s];
+      int steps = (int) (2e8 / n / 40) + 1;
+      PoolWorld expected;
+
+      std::cout << std::setw(8) << n;
+      for(int v = 0; v < numVersions; v++)
+      {
+         if(versions[v] == NULL)
+            continue;
+
+         PoolWorld world;
+         makeStressScene(world, n);
+         for(int i = 0; i < n; i += 7)
+            world.balls.ignored.set(i, true);
+
+         double t = timeKernels(versions[v], world, steps);
+         if(v == 0)
+            expected = world;
+
+         bool same = expected.balls.px == world.balls.px &&
+                     expected.balls.py == world.balls.py &&
+                     expected.balls.vx == world.balls.vx &&
+                     expected.balls.vy == world.balls.vy;
+         std::cout << std::setw(10) << std::fixed << std::setprecision(3)
+                   << t * 1e9 / n << std::setw(6) << (same ? "yes" : "NO");
+      }
+      std::cout << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Sleeping.  First the break shot run with and without sleeping balls:
+ * putting slow balls to sleep shifts where they stop by a little.  Then
+ * the cost of a step on a large table that is at rest, for the first
+ * second after one ball is set rolling ("woken" is the most balls awake
+ * at once as it knocks into others), and fully awake with sleeping
+ * turned off.
+ ***********************************************************************/
+
+/* Stop every ball in world and step until all of them are asleep. */
+
+static void settle(PoolWorld& world, double dt)
+{
+   for(int i = 0; i < world.numBalls; i++)
+      world.setVelocity(i, dvec2(0.0));
+   while(world.awakeCount() > 0)
+      world.step(dt);
+}
+
+static void benchSleep(void)
+{
+   const int sizes[] = { 1000, 100000 };
+   const double dt = 1.0 / (TICK_RATE * SUBSTEPS);
+
+   std::cout << "sleep: break shot, sleeping vs. always awake" << std::endl;
+
+   PoolWorld awake, sleeping;
+   if(setupBreak(awake) && setupBreak(sleeping))
+   {
+      awake.useSleeping = false;
+
+      double start = now();
+      awake.simulateUntilRest();
+      double awakeTime = now() - start;
+
+      start = now();
+      sleeping.simulateUntilRest();
+      double sleepingTime = now() - start;
+
+      std::cout << std::fixed << std::setprecision(3)
+                << "  awake " << awakeTime * 1e3 << " ms, sleeping "
+                << sleepingTime * 1e3 << " ms, max difference "
+                << maxDeviation(awake, sleeping) << ", pocketed differently "
+                << pocketMismatches(awake, sleeping) << std::endl;
+   }
+
+   std::cout << "sleep: step time, us/step" << std::endl;
+   std::cout << std::setw(8) << "balls"
+             << std::setw(14) << "at rest"
+             << std::setw(14) << "one rolling"
+             << std::setw(8) << "woken"
+             << std::setw(14) << "all awake" << std::endl;
+
+   for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+   {
+      int n = sizes[s];
+      PoolWorld world;
+
+      makeStressScene(world, n);
+      world.friction = 0.6;
+      settle(world, dt);
+      double rest = timeSteps(world, dt, 0.25);
+
+      int steps = (int) (1.0 / dt), woken = 0;
+      world.setVelocity(n / 2, dvec2(20.0, 3.0));
+      double start = now();
+      for(int i = 0; i < steps; i++)
+      {
+         world.step(dt);
+         if(world.awakeCount() > woken)
+            woken = world.awakeCount();
+      }
+      double rolling = (now() - start) / steps;
+
+      world.useSleeping = false;
+      world.wakeAll();
+      double all = timeSteps(world, dt, 0.25);
+
+      std::cout << std::setw(8) << n
+                << std::setw(14) << std::fixed << std::setprecision(3)
+                << rest * 1e6
+                << std::setw(14) << rolling * 1e6
+                << std::setw(8) << woken
+                << std::setw(14) << all * 1e6 << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Contact solver against the pairwise collisionResponse() on the break
+ * shot.  After every step the pairs still overlapping, and still closing
+ * while touching, are measured; the worst of each over the shot is
+ * shown.  The break is mirror-symmetric about the middle of the table,
+ * so "asym" (how far the final layout is from its own mirror image)
+ * shows how much the result depends on the order pairs were visited.
+ * "iters" is the average and largest number of solver iterations over
+ * the steps that had contacts.
+ ***********************************************************************/
+
+/* Worst overlap and closing speed over touching pairs of balls. */
+
+static void contactError(const PoolWorld& world, double& overlap,
+                         double& closing)
+{
+   const BallStore& b = world.balls;
+
+   for(int j = NUM_MARKERS; j < world.numBalls; j++)
+   {
+      for(int k = j + 1; k < world.numBalls; k++)
+      {
+         if(world.isPocketed(j) || world.isPocketed(k))
+            continue;
+         dvec2 n = world.position(j) - world.position(k);
+         double d = length(n);
+         double depth = b.r[j] + b.r[k] - d;
+         if(depth <= 0.0 || d <= 0.0)
+            continue;
+         double speed = dot(world.velocity(k) - world.velocity(j), n) / d;
+         if(depth > overlap)
+            overlap = depth;
+         if(speed > closing)
+            closing = speed;
+      }
+   }
+}
+
+/* Largest distance from a ball to the nearest ball of the layout
+ * reflected about the table's horizontal center line.
+ */
+
+static double asymmetry(const PoolWorld& world)
+{
+   double middle = 0.5 * (world.table.ll.y + world.table.ur.y);
+   double worst = 0.0;
+
+   for(int i = NUM_MARKERS; i < world.numBalls; i++)
+   {
+      if(world.isPocketed(i))
+         continue;
+      dvec2 mirror(world.balls.px[i], 2.0 * middle - world.balls.py[i]);
+      double nearest = 1e30;
+      for(int j = NUM_MARKERS; j < world.numBalls; j++)
+      {
+         if(!world.isPocketed(j))
+            nearest = std::min(nearest, length(mirror - world.position(j)));
+      }
+      worst = std::max(worst, nearest);
+   }
+   return worst;
+}
+
+static void benchSolver(void)
+{
+   std::cout << "solver: break shot, pairwise vs. contact solver (240 Hz x 4)"
+             << std::endl;
+   std::cout << std::setw(10) << "response"
+             << std::setw(10) << "ms/shot"
+             << std::setw(12) << "overlap"
+             << std::setw(12) << "closing"
+             << std::setw(10) << "asym"
+             << std::setw(10) << "error"
+             << std::setw(12) << "iters" << std::endl;
+
+   for(int solve = 0; solve <= 1; solve++)
+   {
+      PoolWorld reference, timed, world;
+
+      if(!setupBreak(reference) || !setupBreak(timed) || !setupBreak(world))
+         return;
+      reference.useContactSolver = timed.useContactSolver =
+         world.useContactSolver = (solve != 0);
+      reference.tickDt = 1.0 / 7680.0;
+      reference.simulateUntilRest();
+
+      double start = now();
+      timed.simulateUntilRest();
+      double elapsed = now() - start;
+
+      /* The same shot again, a step at a time, measuring as it goes. */
+
+      double dt = world.tickDt / world.substeps;
+      double overlap = 0.0, closing = 0.0;
+      long steps = 0, iterations = 0;
+      int most = 0;
+      for(double t = 0.0; t < MAX_SHOT_TIME && world.isMoving(); t += dt)
+      {
+         world.step(dt);
+         contactError(world, overlap, closing);
+         if(world.solver.contacts > 0)
+         {
+            steps++;
+            iterations += world.solver.iterations;
+            most = std::max(most, world.solver.iterations);
+         }
+      }
+
+      std::cout << std::setw(10) << (solve ? "solver" : "pairwise")
+                << std::setw(10) << std::fixed << std::setprecision(3)
+                << elapsed * 1e3
+                << std::setw(12) << std::setprecision(6) << overlap
+                << std::setw(12) << closing
+                << std::setw(10) << std::setprecision(3) << asymmetry(world)
+                << std::setw(10) << maxDeviation(timed, reference);
+      if(solve)
+         std::cout << std::setw(6) << std::setprecision(1)
+                   << (steps ? (double) iterations / steps : 0.0)
+                   << " / " << most;
+      std::cout << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Pocket lookup for balls scattered uniformly over the poolData.txt
+ * table: Pockets::find(), which only checks the pockets for balls near
+ * a rail, against checking every pocket for every ball.
+ ***********************************************************************/
+
+static void benchPockets(void)
+{
+   const int n = 1000000;
+   PoolWorld world;
+
+   std::cout << "pockets: lookup, ns/ball" << std::endl;
+   if(!world.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return;
+   }
+
+   const Pockets& pockets = world.pockets;
+   const Table& t = world.table;
+   std::vector<double> x(n), y(n);
+
+   benchSeed = 12345;
+   for(int i = 0; i < n; i++)
+   {
+      x[i] = t.ll.x + randUnit() * (t.ur.x - t.ll.x);
+      y[i] = t.ll.y + randUnit() * (t.ur.y - t.ll.y);
+   }
+
+   long found = 0, checked = 0;
+   double start = now();
+   for(int i = 0; i < n; i++)
+      found += pockets.find(x[i], y[i]) >= 0;
+   double railBand = now() - start;
+
+   start = now();
+   for(int i = 0; i < n; i++)
+   {
+      for(int p = 0; p < pockets.size(); p++)
+      {
+         double dx = x[i] - pockets.cx[p], dy = y[i] - pockets.cy[p];
+         if(dx * dx + dy * dy <= pockets.radius[p] * pockets.radius[p])
+         {
+            checked++;
+            break;
+         }
+      }
+   }
+   double every = now() - start;
+
+   std::cout << std::fixed << std::setprecision(2)
+             << "  rail band " << railBand * 1e9 / n
+             << ", every pocket " << every * 1e9 / n
+             << ", same answers: " << (found == checked ? "yes" : "NO")
+             << " (" << found << " of " << n << " in a pocket)" << std::endl;
+}
+
+
+/***********************************************************************
+ * Shot farm throughput: a fan of aims at several powers, all from the
+ * racked poolData.txt table, on pools of 1, 2, 4, ... threads up to
+ * twice the core count.  "same" checks every outcome matches the
+ * one-thread run.
+ ***********************************************************************/
+
+static bool sameOutcomes(const std::vector<ShotOutcome>& a,
+                         const std::vector<ShotOutcome>& b)
+{
+   for(size_t i = 0; i < a.size(); i++)
+   {
+      if(a[i].pocketed != b[i].pocketed || a[i].contacts != b[i].contacts ||
+         a[i].cuePosition.x != b[i].cuePosition.x ||
+         a[i].cuePosition.y != b[i].cuePosition.y || a[i].time != b[i].time)
+         return false;
+   }
+   return true;
+}
+
+/* 64 aims around the compass at each of four powers. */
+
+static std::vector<Shot> fanOfShots(void)
+{
+   const int angles = 64;
+   const double powers[] = { 4.0, 8.0, 12.0, 14.0 };
+   std::vector<Shot> shots;
+
+   for(int a = 0; a < angles; a++)
+   {
+      for(size_t p = 0; p < sizeof(powers) / sizeof(powers[0]); p++)
+      {
+         double angle = 2.0 * M_PI * a / angles;
+         Shot shot;
+         shot.aim = dvec2(8.0 * std::cos(angle), 8.0 * std::sin(angle));
+         shot.power = powers[p];
+         shots.push_back(shot);
+      }
+   }
+   return shots;
+}
+
+static void benchFarm(void)
+{
+   PoolWorld table;
+
+   std::cout << "farm: shots/sec vs. threads ("
+             << std::thread::hardware_concurrency() << " cores)" << std::endl;
+   if(!table.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return;
+   }
+
+   std::vector<Shot> shots = fanOfShots();
+
+   std::cout << std::setw(8) << "threads"
+             << std::setw(12) << "shots/sec"
+             << std::setw(10) << "speedup"
+             << std::setw(8) << "steals"
+             << std::setw(6) << "same" << std::endl;
+
+   std::vector<ShotOutcome> expected;
+   double base = 0.0;
+   int maxThreads = 2 * std::max(1, (int) std::thread::hardware_concurrency());
+   for(int threads = 1; threads <= std::max(maxThreads, 4); threads *= 2)
+   {
+      ShotFarm farm(threads);
+      double start = now();
+      std::vector<ShotOutcome> outcomes = farm.evaluate(table, shots);
+      double rate = shots.size() / (now() - start);
+
+      if(threads == 1)
+      {
+         expected = outcomes;
+         base = rate;
+      }
+      std::cout << std::setw(8) << threads
+                << std::setw(12) << std::fixed << std::setprecision(1) << rate
+                << std::setw(10) << std::setprecision(2) << rate / base
+                << std::setw(8) << farm.pool.steals()
+                << std::setw(6) << (sameOutcomes(outcomes, expected) ? "yes" : "NO")
+                << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Lockstep batches on one thread: the farm's shots played one table at
+ * a time with the pairwise model the lanes use, then by TableBatch with
+ * each kernel at 8, 16 and 64 lanes.  "same" checks every outcome
+ * matches the one-at-a-time run; "full" is how much of the lane time
+ * went to tables still in play.  The default solver-and-sleep model is
+ * shown for reference.
+ ***********************************************************************/
+
+static void benchBatch(void)
+{
+   PoolWorld table;
+
+   std::cout << "batch: shots/sec on one thread" << std::endl;
+   if(!table.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return;
+   }
+
+   std::vector<Shot> shots = fanOfShots();
+   ShotFarm farm(1);
+
+   double start = now();
+   farm.evaluate(table, shots);
+   double solved = shots.size() / (now() - start);
+
+   table.useContactSolver = false;
+   table.useSleeping = false;
+   start = now();
+   std::vector<ShotOutcome> expected = farm.evaluate(table, shots);
+   double base = shots.size() / (now() - start);
+
+   std::cout << std::fixed << std::setprecision(1)
+             << "  one at a time: solver and sleep " << solved
+             << ", pairwise " << base << std::endl
+             << std::setw(8) << "kernel" << std::setw(7) << "lanes"
+             << std::setw(12) << "shots/sec" << std::setw(10) << "speedup"
+             << std::setw(7) << "full" << std::setw(6) << "same" << std::endl;
+
+   const BatchKernels<double>* kernels[] = { scalarBatchKernels<double>(),
+                                             avx2BatchKernels<double>(),
+                                             avx512BatchKernels<double>() };
+   const int lanes[] = { 8, 16, 64 };
+   for(int k = 0; k < 3; k++)
+   {
+      if(kernels[k] == NULL)
+      {
+         std::cout << "  (no " << (k == 1 ? "avx2" : "avx512") << ")"
+                   << std::endl;
+         continue;
+      }
+      for(int l = 0; l < 3; l++)
+      {
+         TableBatch batch(lanes[l], kernels[k]);
+         start = now();
+         std::vector<ShotOutcome> outcomes = batch.evaluate(table, shots);
+         double rate = shots.size() / (now() - start);
+
+         std::cout << std::setw(8) << kernels[k]->name
+                   << std::setw(7) << lanes[l]
+                   << std::setw(12) << std::setprecision(1) << rate
+                   << std::setw(10) << std::setprecision(2) << rate / base
+                   << std::setw(7) << std::setprecision(2)
+                   << (double) batch.busyTicks / batch.laneTicks
+                   << std::setw(6) << (sameOutcomes(outcomes, expected) ? "yes" : "NO")
+                   << std::endl;
+      }
+   }
+}
+
+
+/***********************************************************************
+ * Scalar type: the fan of shots through TableBatch (double) and
+ * FloatTableBatch (float) at 16 lanes with each kernel.  Drift compares
+ * the float outcomes with the double ones: "same" is the share of shots
+ * that sank the same balls in the same order, "cue" the mean and worst
+ * distance between where the cue ball stopped.
+ ***********************************************************************/
+
+template <class T>
+static double timeBatch(const BatchKernels<T>* kernels, const PoolWorld& table,
+                        const std::vector<Shot>& shots,
+                        std::vector<ShotOutcome>& outcomes)
+{
+   BasicTableBatch<T> batch(16, kernels);
+   double start = now();
+
+   outcomes = batch.evaluate(table, shots);
+   return shots.size() / (now() - start);
+}
+
+static void benchPrecision(void)
+{
+   PoolWorld table;
+
+   std::cout << "precision: float against double batches, 16 lanes"
+             << std::endl;
+   if(!table.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return;
+   }
+
+   std::vector<Shot> shots = fanOfShots();
+   std::cout << std::setw(8) << "kernel" << std::setw(10) << "double/s"
+             << std::setw(10) << "float/s" << std::setw(9) << "speedup"
+             << std::setw(7) << "same" << std::setw(10) << "cue mean"
+             << std::setw(9) << "cue max" << std::endl;
+
+   const BatchKernels<double>* doubles[] = { scalarBatchKernels<double>(),
+                                             avx2BatchKernels<double>(),
+                                             avx512BatchKernels<double>() };
+   const BatchKernels<float>* floats[] = { scalarBatchKernels<float>(),
+                                           avx2BatchKernels<float>(),
+                                           avx512BatchKernels<float>() };
+   for(int k = 0; k < 3; k++)
+   {
+      if(doubles[k] == NULL || floats[k] == NULL)
+      {
+         std::cout << "  (no " << (k == 1 ? "avx2" : "avx512") << ")"
+                   << std::endl;
+         continue;
+      }
+
+      std::vector<ShotOutcome> reference, rough;
+      double slow = timeBatch(doubles[k], table, shots, reference);
+      double fast = timeBatch(floats[k], table, shots, rough);
+
+      int same = 0;
+      double sum = 0.0, worst = 0.0;
+      for(size_t i = 0; i < shots.size(); i++)
+      {
+         double d = length(reference[i].cuePosition - rough[i].cuePosition);
+         same += reference[i].pocketed == rough[i].pocketed;
+         sum += d;
+         worst = std::max(worst, d);
+      }
+
+      std::cout << std::setw(8) << doubles[k]->name
+                << std::fixed << std::setprecision(1)
+                << std::setw(10) << slow << std::setw(10) << fast
+                << std::setw(9) << std::setprecision(2) << fast / slow
+                << std::setw(6) << std::setprecision(0)
+                << 100.0 * same / shots.size() << "%"
+                << std::setw(10) << std::setprecision(3)
+                << sum / shots.size() << std::setw(9) << worst << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Snapshot and restore: ns per call on the racked poolData.txt table,
+ * against copying the whole PoolWorld and against re-reading the file.
+ * "replay" checks the break played from a restored rack matches the
+ * break played from the file, and "mid-shot" that two restores of a
+ * state taken during the break finish identically.  "foreign" checks
+ * that a state for another number of balls is turned away.
+ ***********************************************************************/
+
+static bool sameBalls(const PoolWorld& a, const PoolWorld& b)
+{
+   for(int i = 0; i < a.numBalls; i++)
+   {
+      if(a.isPocketed(i) != b.isPocketed(i) ||
+         a.balls.px[i] != b.balls.px[i] || a.balls.py[i] != b.balls.py[i])
+         return false;
+   }
+   return a.contacts == b.contacts && a.ticks == b.ticks;
+}
+
+static void benchSnapshot(void)
+{
+   const int calls = 1000000;
+   const int copies = 20000;
+   PoolWorld world, reference;
+
+   std::cout << "snapshot: ns/call" << std::endl;
+   if(!world.readFile("poolData.txt") || !reference.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return;
+   }
+
+   WorldState rack;
+   if(!world.snapshot(rack))
+   {
+      std::cout << "  (skipped: more than " << STATE_BALLS << " balls)"
+                << std::endl;
+      return;
+   }
+
+   /* Play a shot first so the world's vectors have their working size;
+    * after that restore() never allocates.
+    */
+
+   world.shoot(dvec2(8.0, 0.0), world.powerValue);
+   world.simulateUntilRest();
+
+   static WorldState states[1000];
+   double start = now();
+   for(int i = 0; i < calls; i++)
+      world.snapshot(states[i % 1000]);
+   double snap = now() - start;
+
+   start = now();
+   for(int i = 0; i < calls; i++)
+      world.restore(states[i % 1000]);
+   double restore = now() - start;
+
+   long sink = 0;
+   start = now();
+   for(int i = 0; i < copies; i++)
+   {
+      PoolWorld copy(world);
+      sink += copy.numBalls;
+   }
+   double copy = now() - start;
+
+   start = now();
+   for(int i = 0; i < copies / 10; i++)
+   {
+      PoolWorld fresh;
+      fresh.readFile("poolData.txt");
+      sink += fresh.numBalls;
+   }
+   double reread = now() - start;
+
+   world.restore(rack);
+   world.shoot(dvec2(8.0, 0.0), world.powerValue);
+   world.simulateUntilRest();
+   reference.shoot(dvec2(8.0, 0.0), reference.powerValue);
+   reference.simulateUntilRest();
+   bool replay = sameBalls(world, reference);
+
+   WorldState middle;
+   world.restore(rack);
+   world.shoot(dvec2(8.0, 0.0), world.powerValue);
+   for(int t = 0; t < TICK_RATE / 4; t++)
+      world.tick();
+   world.snapshot(middle);
+   world.simulateUntilRest();
+   reference = world;
+   world.restore(middle);
+   world.simulateUntilRest();
+   reference.restore(middle);
+   reference.simulateUntilRest();
+   bool repeat = sameBalls(world, reference);
+
+   WorldState foreign = WorldState();
+   bool rejected = !world.restore(foreign);
+   foreign = middle;
+   foreign.numBalls = world.numBalls + 1;
+   rejected = rejected && !world.restore(foreign) && sameBalls(world, reference);
+
+   std::cout << std::fixed << std::setprecision(1)
+             << "  " << world.numBalls << " balls, " << sizeof(WorldState)
+             << " bytes per state" << std::endl
+             << "  snapshot " << snap * 1e9 / calls
+             << ", restore " << restore * 1e9 / calls
+             << ", PoolWorld copy " << copy * 1e9 / copies
+             << ", readFile " << reread * 1e9 / (copies / 10)
+             << (sink ? "" : " ") << std::endl
+             << "  replay from rack: " << (replay ? "same" : "DIFFERENT")
+             << ", mid-shot restores: " << (repeat ? "same" : "DIFFERENT")
+             << ", foreign states: " << (rejected ? "rejected" : "ACCEPTED")
+             << std::endl;
+}
+
+
+/***********************************************************************
+ * Scale: stress scenes up to a million balls, all moving.  "store" is
+ * the ball table's bytes per ball, "pool" the BlockPool bytes it holds
+ * after rounding to block sizes, and "rss" the growth in resident memory
+ * per ball, grids and contact lists included.  Once the scenes are gone
+ * the pool should hold nothing.
+ ***********************************************************************/
+
+/* Resident set size in bytes, or 0 where /proc is missing. */
+
+static double residentBytes(void)
+{
+   std::ifstream statm("/proc/self/statm");
+   long size = 0, resident = 0;
+
+   statm >> size >> resident;
+   return (double) resident * sysconf(_SC_PAGESIZE);
+}
+
+static void benchScale(void)
+{
+   const int sizes[] = { 10000, 100000, 1000000 };
+   const double dt = 1.0 / 240.0;
+
+   std::cout << "scale: stress scenes, per ball" << std::endl
+             << std::setw(9) << "balls" << std::setw(10) << "build ms"
+             << std::setw(10) << "step ms" << std::setw(8) << "ns"
+             << std::setw(8) << "store" << std::setw(8) << "pool"
+             << std::setw(8) << "rss" << std::endl;
+
+   size_t before = BlockPool::held() - BlockPool::cached();
+   for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+   {
+      int n = sizes[s];
+      double rss = residentBytes();
+      double stepTime, start = now();
+      size_t store, pool;
+      {
+         PoolWorld world;
+         makeStressScene(world, n);
+         double build = now() - start;
+         stepTime = timeSteps(world, dt, 0.5);
+         store = world.balls.bytes();
+         pool = BlockPool::held() - BlockPool::cached() - before;
+         rss = residentBytes() - rss;
+
+         std::cout << std::setw(9) << n
+                   << std::setw(10) << std::fixed << std::setprecision(1)
+                   << build * 1e3;
+      }
+      std::cout << std::setw(10) << stepTime * 1e3
+                << std::setw(8) << stepTime * 1e9 / n
+                << std::setw(8) << std::setprecision(0) << (double) store / n
+                << std::setw(8) << (double) pool / n
+                << std::setw(8) << rss / n << std::endl;
+   }
+   std::cout << "  pool after: "
+             << BlockPool::held() - BlockPool::cached() - before
+             << " bytes in use, " << BlockPool::cached() << " cached"
+             << std::endl;
+}
+
+
+/***********************************************************************
+ * Replay: a game of random shots, racks and cue changes is played the
+ * way pool.cpp plays it, in uneven bursts of ticks, and logged.  The log
+ * is then replayed in full, which must reproduce every event and end on
+ * the same table, and the last shot is sought from its keyframe, which
+ * must find the table as it was when the shot was taken.
+ ***********************************************************************/
+
+static const char* REPLAY_LOG = "/tmp/poolBench.log";
+
+/* Run ticks ticks in frames of one to six, logging after each. */
+
+static void playFrames(PoolWorld& world, ReplayWriter& log, long ticks)
+{
+   while(ticks > 0)
+   {
+      long frame = std::min(ticks, 1L + (long) (randUnit() * 6.0));
+
+      for(long t = 0; t < frame; t++)
+         world.tick();
+      log.events(world);
+      world.pocketEvents.clear();
+      world.contactEvents.clear();
+      ticks -= frame;
+   }
+}
+
+static void playFramesUntilRest(PoolWorld& world, ReplayWriter& log)
+{
+   while(world.isMoving())
+      playFrames(world, log, 1 + (long) (randUnit() * 6.0));
+}
+
+static bool allSunk(const PoolWorld& world)
+{
+   for(int i = CUE_BALL + 1; i < world.numBalls; i++)
+   {
+      if(!world.isPocketed(i))
+         return false;
+   }
+   return true;
+}
+
+static void recordGame(PoolWorld& world, ReplayWriter& log, int shots,
+                       PoolWorld& beforeLast)
+{
+   const double sizes[2][2] = { { 1.125, 6.0 }, { 5.125, 10.0 } };
+   const double elasticities[3] = { 0.5, 1.0, 1.5 };
+
+   for(int s = 0; s < shots; s++)
+   {
+      if(allSunk(world) || (s > 0 && s % 25 == 0))
+      {
+         world.rack();
+         world.elasticity = 1.0;
+         log.rack(world);
+         log.elasticity(world);
+      }
+      else if(world.isPocketed(CUE_BALL))
+      {
+         world.rackCue();
+         log.rackCue(world);
+      }
+      if(randUnit() < 0.1)
+      {
+         int big = randUnit() < 0.5;
+
+         world.balls.r[CUE_BALL] = sizes[big][0];
+         world.balls.setMass(CUE_BALL, sizes[big][1]);
+         world.wake(CUE_BALL);
+         log.cue(world);
+      }
+      if(world.balls.info[CUE_BALL].hasBeenShot == 0 && randUnit() < 0.3)
+      {
+         world.balls.py[CUE_BALL] += randUnit() < 0.5 ? 1.0 : -1.0;
+         world.wake(CUE_BALL);
+         log.cue(world);
+      }
+      if(randUnit() < 0.1)
+      {
+         world.elasticity = elasticities[(int) (randUnit() * 3.0)];
+         log.elasticity(world);
+      }
+
+      /* Half the time, wait long enough for everything to fall asleep. */
+
+      playFramesUntilRest(world, log);
+      playFrames(world, log, (long) (randUnit() * 2.0 * SLEEP_TIME /
+                                     world.tickDt));
+
+      dvec2 aim(randUnit() * 16.0 - 8.0, randUnit() * 16.0 - 8.0);
+      int power = 4 + (int) (randUnit() * 10.0);
+
+      if(s == shots - 1)
+         beforeLast = world;
+      log.shot(world, aim, power);
+      world.shoot(aim, power);
+      playFramesUntilRest(world, log);
+   }
+}
+
+static void benchReplay(void)
+{
+   const int shots = 200;
+   PoolWorld table;
+
+   std::cout << "replay: " << shots << " shot game" << std::endl;
+   if(!table.readFile("poolData.txt"))
+   {
+      std::cout << "  (skipped: poolData.txt not found)" << std::endl;
+      return;
+   }
+
+   PoolWorld world(table), beforeLast;
+   ReplayWriter log;
+
+   unlink(REPLAY_LOG);
+   world.recordContacts = true;
+   if(!log.open(REPLAY_LOG, world))
+   {
+      std::cout << "  (skipped: cannot write " << REPLAY_LOG << ")"
+                << std::endl;
+      return;
+   }
+
+   benchSeed = 12345;
+   double start = now();
+   recordGame(world, log, shots, beforeLast);
+   double played = now() - start;
+   long records = log.records, bytes = log.bytes;
+   log.close();
+
+   ReplayPlayer player;
+   player.open(REPLAY_LOG, table);
+   start = now();
+   bool read = player.replayAll();
+   double replayed = now() - start;
+   while(player.world.ticks < world.ticks)
+      player.world.tick();
+   bool ended = read && sameBalls(player.world, world);
+
+   start = now();
+   bool found = player.seek(shots);
+   double sought = now() - start;
+   bool matched = found && sameBalls(player.world, beforeLast);
+
+   std::cout << std::fixed << std::setprecision(1)
+             << "  " << records << " records, " << bytes << " bytes ("
+             << (double) bytes / shots << " per shot), "
+             << player.events << " events checked" << std::endl
+             << "  played " << played * 1e3 << " ms, replayed "
+             << replayed * 1e3 << " ms (" << std::setprecision(0)
+             << player.ticks / replayed << " ticks/s), "
+             << player.mismatches << " event mismatches, end: "
+             << (ended ? "same" : "DIFFERENT") << std::endl
+             << std::setprecision(2)
+             << "  seek to shot " << shots << ": " << sought * 1e3 << " ms, "
+             << player.ticksReplayed << " ticks from "
+             << (player.fromKeyframe ? "a keyframe" : "the session start")
+             << ", table: " << (matched ? "same" : "DIFFERENT") << std::endl;
+}
+
+
+/***********************************************************************
+ * CPU cost of smooth motion on a 144 Hz display, over the break shot
+ * played frame by frame until the table is at rest.  Either the physics
+ * ticks once a frame, or at a lower rate with each frame drawn between
+ * the last two ticks, as the game does.  Either way each frame writes
+ * every ball's drawn position; "pkt" is the balls pocketed.  ms/shot
+ * is the median over the repeats, after one untimed warm-up, and "min"
+ * the fastest; "saved" compares medians.
+ ***********************************************************************/
+
+static const double REFRESH_RATE = 144.0;
+
+/* Play world to rest a frame at a time; returns the frames drawn. */
+
+static long playAtRefresh(PoolWorld& world, bool interpolate)
+{
+   std::vector<double> fromX(world.balls.px.begin(), world.balls.px.end());
+   std::vector<double> fromY(world.balls.py.begin(), world.balls.py.end());
+   std::vector<double> beforeX, beforeY;
+   std::vector<float> drawnX(world.numBalls), drawnY(world.numBalls);
+   long frames = 0;
+
+   while(world.isMoving() && frames < MAX_SHOT_TIME * REFRESH_RATE)
+   {
+      const BallStore& b = world.balls;
+
+      if(interpolate)
+      {
+         beforeX.assign(b.px.begin(), b.px.end());
+         beforeY.assign(b.py.begin(), b.py.end());
+         if(world.advance(1.0 / REFRESH_RATE))
+         {
+            fromX.swap(beforeX);
+            fromY.swap(beforeY);
+         }
+
+         double alpha = world.accumulator / world.tickDt;
+         for(int i = 0; i < world.numBalls; i++)
+         {
+            drawnX[i] = fromX[i] + (b.px[i] - fromX[i]) * alpha;
+            drawnY[i] = fromY[i] + (b.py[i] - fromY[i]) * alpha;
+         }
+      }
+      else
+      {
+         world.advance(1.0 / REFRESH_RATE);
+         for(int i = 0; i < world.numBalls; i++)
+         {
+            drawnX[i] = b.px[i];
+            drawnY[i] = b.py[i];
+         }
+      }
+      frames++;
+   }
+   return frames;
+}
+
+static void benchInterpolation(void)
+{
+   const struct { double rate; bool interpolate; } configs[] = {
+      { REFRESH_RATE, false }, { 240.0, false },
+      { 120.0, true }, { 60.0, true }
+   };
+   const int numConfigs = sizeof(configs) / sizeof(configs[0]);
+   const int runs = 20;
+   const int repeats = 9;
+   std::vector<double> times[numConfigs];
+   long frames[numConfigs];
+   int pocketed[numConfigs];
+
+   std::cout << "interp: break shot drawn at " << REFRESH_RATE << " Hz, "
+             << "median of " << repeats << " x " << runs << " runs"
+             << std::endl;
+   std::cout << std::setw(8) << "tick Hz"
+             << std::setw(8) << "interp"
+             << std::setw(10) << "frames"
+             << std::setw(14) << "ms/shot"
+             << std::setw(10) << "min"
+             << std::setw(10) << "saved"
+             << std::setw(6) << "pkt" << std::endl;
+
+   /* Repeat 0 is a warm-up and is not timed.  The configurations take
+    * turns within each repeat, so drift in the machine's speed hits all
+    * of them alike.
+    */
+
+   for(int rep = 0; rep <= repeats; rep++)
+   {
+      for(int c = 0; c < numConfigs; c++)
+      {
+         double start = now();
+
+         for(int r = 0; r < runs; r++)
+         {
+            PoolWorld world;
+            if(!setupBreak(world))
+               return;
+            world.tickDt = 1.0 / configs[c].rate;
+            frames[c] = playAtRefresh(world, configs[c].interpolate);
+
+            pocketed[c] = 0;
+            for(int i = NUM_MARKERS; i < world.numBalls; i++)
+               pocketed[c] += world.isPocketed(i);
+         }
+         if(rep > 0)
+            times[c].push_back((now() - start) / runs);
+      }
+   }
+
+   double baseline = 0.0;
+   for(int c = 0; c < numConfigs; c++)
+   {
+      std::sort(times[c].begin(), times[c].end());
+      double perShot = times[c][times[c].size() / 2];
+      if(c == 0)
+         baseline = perShot;
+
+      std::cout << std::setw(8) << std::fixed << std::setprecision(0)
+                << configs[c].rate
+                << std::setw(8) << (configs[c].interpolate ? "yes" : "no")
+                << std::setw(10) << frames[c]
+                << std::setw(14) << std::setprecision(3) << perShot * 1e3
+                << std::setw(10) << times[c][0] * 1e3
+                << std::setw(9) << std::setprecision(0)
+                << (1.0 - perShot / baseline) * 100.0 << "%"
+                << std::setw(6) << pocketed[c] << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Instance bytes written a frame when only the circles that changed
+ * since a ring region was last written go to it, against writing every
+ * circle, with frames drawn at 144 Hz as the game draws them (ticking
+ * at 120 Hz and interpolating, pockets first, pocketed balls hidden in
+ * their slots).  "rolling" is 10,000 balls at rest with one sent into
+ * the rest for two seconds; "break" is the break shot played to rest.
+ * The us/fr columns are the CPU time a frame to fill the region: by
+ * copying every circle, by comparing every circle with the shadow, and
+ * by comparing only those an InstanceChanges lists, marking included.
+ ***********************************************************************/
+
+static const int RING_REGIONS = 3;
+
+static void drawCircles(const PoolWorld& world,
+                        const std::vector<double>& fromX,
+                        const std::vector<double>& fromY, double alpha,
+                        std::vector<CircleInstance>& circles)
+{
+   const BallStore& b = world.balls;
+
+   circles.clear();
+   for(int p = 0; p < world.pockets.size(); p++)
+   {
+      const Color& color = world.pockets.color[p];
+      CircleInstance c = { (GLfloat) world.pockets.cx[p],
+                           (GLfloat) world.pockets.cy[p],
+                           (GLfloat) world.pockets.radius[p], 0.0,
+                           color.x, color.y, color.z, 1.0 };
+      circles.push_back(c);
+   }
+   for(int i = 0; i < world.numBalls; i++)
+   {
+      CircleInstance c = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+      if(!world.isPocketed(i))
+      {
+         const Color& color = b.info[i].color;
+         c.x = (GLfloat) (fromX[i] + (b.px[i] - fromX[i]) * alpha);
+         c.y = (GLfloat) (fromY[i] + (b.py[i] - fromY[i]) * alpha);
+         c.radius = (GLfloat) b.r[i];
+         c.r = color.x;
+         c.g = color.y;
+         c.b = color.z;
+         c.a = 1.0;
+      }
+      circles.push_back(c);
+   }
+}
+
+/* Mark the circle of every ball that may have changed since the last
+ * frame, as pool.cpp's writeSnapshot() does: the awake balls, and those
+ * still moving at the last frame, which may have just gone to sleep or
+ * into a pocket or still be drawn part way between two places.  moving
+ * is the balls still moving after this frame.
+ */
+
+static void markCircles(const PoolWorld& world,
+                        const std::vector<double>& fromX,
+                        const std::vector<double>& fromY,
+                        std::vector<int>& moving, std::vector<int>& next,
+                        InstanceChanges& changes)
+{
+   const BallStore& b = world.balls;
+   const std::vector<int>& awake = world.awakeBalls();
+   int first = world.pockets.size();
+
+   next.clear();
+   for(size_t a = 0; a < awake.size(); a++)
+   {
+      changes.mark(first + awake[a]);
+      next.push_back(awake[a]);
+   }
+   for(size_t m = 0; m < moving.size(); m++)
+   {
+      int i = moving[m];
+      if(!b.sleeping.test(i))
+         continue;
+      changes.mark(first + i);
+      if(!world.isPocketed(i) && (fromX[i] != b.px[i] || fromY[i] != b.py[i]))
+         next.push_back(i);
+   }
+   moving.swap(next);
+   changes.close();
+}
+
+static void benchUpload(void)
+{
+   std::cout << "upload: instance bytes/frame at " << REFRESH_RATE
+             << " Hz, every circle vs. changed only" << std::endl;
+   std::cout << std::setw(10) << "scene"
+             << std::setw(8) << "frames"
+             << std::setw(11) << "all B/fr"
+             << std::setw(11) << "dirty B/fr"
+             << std::setw(7) << "saved"
+             << std::setw(11) << "all us/fr"
+             << std::setw(11) << "cmp us/fr"
+             << std::setw(13) << "listed us/fr" << std::endl;
+
+   for(int scene = 0; scene < 2; scene++)
+   {
+      PoolWorld world;
+      long maxFrames = (long) (MAX_SHOT_TIME * REFRESH_RATE);
+
+      if(scene == 0)
+      {
+         makeStressScene(world, 10000);
+         world.friction = 0.6;
+         settle(world, 1.0 / (TICK_RATE * SUBSTEPS));
+         world.setVelocity(world.numBalls / 2, dvec2(20.0, 3.0));
+         maxFrames = (long) (2.0 * REFRESH_RATE);
+      }
+      else if(!setupBreak(world))
+         continue;
+      world.tickDt = 1.0 / 120.0;
+
+      const BallStore& b = world.balls;
+      int n = world.numBalls + world.pockets.size();
+      std::vector<double> fromX(b.px.begin(), b.px.end());
+      std::vector<double> fromY(b.py.begin(), b.py.end());
+      std::vector<double> beforeX, beforeY;
+      std::vector<CircleInstance> circles;
+      std::vector<CircleInstance> all[RING_REGIONS];
+      std::vector<CircleInstance> compared[RING_REGIONS];
+      std::vector<CircleInstance> listed[RING_REGIONS];
+      InstanceShadow compareShadows[RING_REGIONS];
+      InstanceShadow listShadows[RING_REGIONS];
+      InstanceChanges changes;
+      std::vector<int> moving, next;
+      double allBytes = 0.0, dirtyBytes = 0.0;
+      double allTime = 0.0, compareTime = 0.0, listTime = 0.0;
+      long frames = 0;
+
+      for(int r = 0; r < RING_REGIONS; r++)
+      {
+         all[r].resize(n);
+         compared[r].resize(n);
+         listed[r].resize(n);
+      }
+      changes.resize(n);
+
+      while(frames < maxFrames && (scene == 0 || world.isMoving()))
+      {
+         beforeX.assign(b.px.begin(), b.px.end());
+         beforeY.assign(b.py.begin(), b.py.end());
+         if(world.advance(1.0 / REFRESH_RATE))
+         {
+            fromX.swap(beforeX);
+            fromY.swap(beforeY);
+         }
+         drawCircles(world, fromX, fromY,
+                     world.accumulator / world.tickDt, circles);
+
+         int region = frames % RING_REGIONS;
+         size_t bytes = n * sizeof(CircleInstance);
+         double start = now();
+         memcpy(&all[region][0], &circles[0], bytes);
+         double copied = now();
+         compareShadows[region].update(&circles[0], n, &compared[region][0]);
+         double compareDone = now();
+         markCircles(world, fromX, fromY, moving, next, changes);
+         const std::vector<int>& list = changes.list();
+         dirtyBytes += listShadows[region].update(&circles[0], n,
+                                                  &listed[region][0],
+                                                  list.data(), list.size(),
+                                                  changes.since(),
+                                                  changes.serial());
+         double listDone = now();
+
+         allTime += copied - start;
+         compareTime += compareDone - copied;
+         listTime += listDone - compareDone;
+         allBytes += bytes;
+         frames++;
+
+         if(memcmp(&all[region][0], &compared[region][0], bytes) != 0 ||
+            memcmp(&all[region][0], &listed[region][0], bytes) != 0)
+         {
+            std::cout << "  region " << region << " differs at frame "
+                      << frames << std::endl;
+            return;
+         }
+      }
+
+      std::cout << std::setw(10) << (scene == 0 ? "rolling" : "break")
+                << std::setw(8) << frames
+                << std::setw(11) << std::fixed << std::setprecision(0)
+                << allBytes / frames
+                << std::setw(11) << dirtyBytes / frames
+                << std::setw(6) << (1.0 - dirtyBytes / allBytes) * 100.0
+                << "%"
+                << std::setw(11) << std::setprecision(2)
+                << allTime * 1e6 / frames
+                << std::setw(11) << compareTime * 1e6 / frames
+                << std::setw(13) << listTime * 1e6 / frames << std::endl;
+   }
+}
+
+
+/***********************************************************************
+ * Driver
+ ***********************************************************************/
+
+static bool wanted(int argc, char** argv, const char* name)
+{
+   if(argc < 2)
+      return true;
+   for(int i = 1; i < argc; i++)
+   {
+      if(strcmp(argv[i], name) == 0)
+         return true;
+   }
+   return false;
+}
+
+int main(int argc, char** argv)
+{
+   if(wanted(argc, argv, "broadphase"))
+      benchBroadphase();
+   if(wanted(argc, argv, "layout"))
+      benchLayout();
+   if(wanted(argc, argv, "timestep"))
+      benchTimestep();
+   if(wanted(argc, argv, "events"))
+      benchEvents();
+   if(wanted(argc, argv, "kernels"))
+      benchKernels();
+   if(wanted(argc, argv, "sleep"))
+      benchSleep();
+   if(wanted(argc, argv, "solver"))
+      benchSolver();
+   if(wanted(argc, argv, "pockets"))
+      benchPockets();
+   if(wanted(argc, argv, "farm"))
+      benchFarm();
+   if(wanted(argc, argv, "batch"))
+      benchBatch();
+   if(wanted(argc, argv, "precision"))
+      benchPrecision();
+   if(wanted(argc, argv, "snapshot"))
+      benchSnapshot();
+   if(wanted(argc, argv, "scale"))
+      benchScale();
+   if(wanted(argc, argv, "replay"))
+      benchReplay();
+   if(wanted(argc, argv, "interp"))
+      benchInterpolation();
+   if(wanted(argc, argv, "upload"))
+      benchUpload();
+   return failed ? 1 : 0;
+}
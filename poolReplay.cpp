@@ -0,0 +1,127 @@
+/******************************************************************************
+ *  poolReplay.cpp
+ *
+ *  Headless replay of a game log written by pool.cpp (see ReplayLog.h).
+ *  With no -s, every session in the log is re-simulated as fast as the
+ *  machine allows and the pocket and contact events it produces are
+ *  checked against the ones logged.  With -s, the tool seeks to shot
+ *  number shot (counted from 1 over the whole log), starting from the
+ *  last keyframe before it, and prints the table as it stood when the
+ *  shot was taken and where the balls came to rest.
+ *
+ *  Usage: poolReplay logFile [dataFile] [-s shot]
+ *
+ *  dataFile must be the table the log was recorded on.
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "ReplayLog.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+
+static double now(void)
+{
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void printTable(const PoolWorld& world)
+{
+   for(int i = NUM_MARKERS; i < world.numBalls; i++)
+   {
+      std::cout << i << " " << world.position(i)
+                << (world.isPocketed(i) ? " pocketed" : "") << std::endl;
+   }
+}
+
+
+int main(int argc, char** argv)
+{
+   const char* logName = NULL;
+   const char* fileName = "poolData.txt";
+   long shot = 0;
+
+   for(int a = 1; a < argc; a++)
+   {
+      if(strcmp(argv[a], "-s") == 0 && a + 1 < argc)
+         shot = atol(argv[++a]);
+      else if(logName == NULL)
+         logName = argv[a];
+      else
+         fileName = argv[a];
+   }
+   if(logName == NULL)
+   {
+      std::cerr << "Usage: poolReplay logFile [dataFile] [-s shot]"
+                << std::endl;
+      return 1;
+   }
+
+   PoolWorld table;
+   if(!table.readFile(fileName))
+   {
+      std::cerr << "Could not open " << fileName << std::endl;
+      return 1;
+   }
+
+   ReplayPlayer player;
+   if(!player.open(logName, table))
+   {
+      std::cerr << "Could not open " << logName << std::endl;
+      return 1;
+   }
+
+   double start = now();
+
+   if(shot > 0)
+   {
+      if(!player.seek(shot))
+      {
+         std::cerr << "No shot " << shot << " in " << logName << std::endl;
+         return 1;
+      }
+
+      const ReplayRecord& r = player.record;
+      PoolWorld& world = player.world;
+
+      std::cout << "Shot " << shot << " at tick " << r.tick
+                << ", reached in " << (now() - start) * 1000.0 << " ms by "
+                << player.ticksReplayed << " ticks from "
+                << (player.fromKeyframe ? "a keyframe" : "the session start")
+                << std::endl;
+      if(player.diverged)
+         std::cout << "Warning: the cue ball differs from the one logged"
+                   << std::endl;
+      std::cout << "Aim " << dvec2(r.aimX, r.aimY) << " power " << r.power
+                << std::endl;
+      printTable(world);
+
+      applyRecord(world, r);
+      double t = world.simulateUntilRest();
+
+      std::cout << "Table at rest after " << t << " s" << std::endl;
+      printTable(world);
+      return 0;
+   }
+
+   if(!player.replayAll())
+   {
+      std::cerr << logName << " was not recorded on " << fileName
+                << std::endl;
+      return 1;
+   }
+
+   double elapsed = now() - start;
+
+   std::cout << player.sessions << " sessions, " << player.shots
+             << " shots, " << player.ticks << " ticks, " << player.events
+             << " events" << std::endl;
+   std::cout << "Replayed in " << elapsed << " s ("
+             << player.ticks / elapsed << " ticks/s)" << std::endl;
+   std::cout << player.mismatches << " event mismatches, " << player.diverged
+             << " shots from a different cue ball" << std::endl;
+   return (player.mismatches || player.diverged) ? 2 : 0;
+}
@@ -0,0 +1,84 @@
+/******************************************************************************
+ *  poolSim.cpp
+ *
+ *  Headless shot runner.  Loads a table, hits the cue ball once and
+ *  simulates until everything has stopped, then prints where each ball
+ *  came to rest.  No window or GL context is created, so this runs on
+ *  machines without a display.
+ *
+ *  Usage: poolSim [-e] [dataFile [aimX aimY [power [tickRate [substeps]]]]]
+ *
+ *  -e uses the event-driven engine, which ignores tickRate and substeps
+ *  unless it runs out of events (see EventSimulator.h).
+ ******************************************************************************/
+
+#define ANGEL_NO_GL
+
+#include "PoolWorld.h"
+#include "EventSimulator.h"
+#include <cstdlib>
+#include <cstring>
+
+
+int main(int argc, char** argv)
+{
+   const char* fileName = "poolData.txt";
+   dvec2 aim(8.0, 0.0);
+   double power = -1.0;
+   double tickRate = TICK_RATE;
+   int substeps = SUBSTEPS;
+   int engine = ENGINE_STEPPED;
+
+   if(argc > 1 && strcmp(argv[1], "-e") == 0)
+   {
+      engine = ENGINE_EVENTS;
+      argc--;
+      argv++;
+   }
+   if(argc > 1)
+      fileName = argv[1];
+   if(argc > 3)
+   {
+      aim.x = atof(argv[2]);
+      aim.y = atof(argv[3]);
+   }
+   if(argc > 4)
+      power = atof(argv[4]);
+   if(argc > 5)
+      tickRate = atof(argv[5]);
+   if(argc > 6)
+      substeps = atoi(argv[6]);
+   if(tickRate <= 0.0 || substeps <= 0)
+   {
+      std::cerr << "Usage: poolSim [-e] [dataFile [aimX aimY [power"
+                << " [tickRate [substeps]]]]]" << std::endl;
+      return 1;
+   }
+
+   PoolWorld world;
+   if(!world.readFile(fileName))
+   {
+      std::cerr << "Could not open " << fileName << std::endl;
+      return 1;
+   }
+   if(power < 0.0)
+      power = world.powerValue;
+
+   world.tickDt = 1.0 / tickRate;
+   world.substeps = substeps;
+   world.engine = engine;
+   world.shoot(aim, power);
+   double t = world.simulateUntilRest();
+
+   if(world.steppedFinish)
+      std::cerr << "Event engine ran out of events after " << MAX_EVENTS
+                << " contacts; finished on the fixed timestep" << std::endl;
+
+   std::cout << "Table at rest after " << t << " s" << std::endl;
+   for(int i = NUM_MARKERS; i < world.numBalls; i++)
+   {
+      std::cout << i << " " << world.position(i)
+                << (world.isPocketed(i) ? " pocketed" : "") << std::endl;
+   }
+   return 0;
+}
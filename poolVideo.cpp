@@ -0,0 +1,683 @@
+/******************************************************************************
+ *  poolVideo.cpp
+ *
+ *  Renders a game log written by pool.cpp (see ReplayLog.h) to video with
+ *  no window or display: an offscreen EGL context, which on a machine
+ *  with no GPU is Mesa's llvmpipe, drawing into a framebuffer object.
+ *  Each frame is read back through a ring of VIDEO_PBOS pixel buffers,
+ *  so the copy of frame N runs while frames N+1 and N+2 are drawn, and
+ *  is handed to a writer thread that converts it and puts it on disk.
+ *
+ *  Usage: poolVideo logFile [dataFile] [-o output] [-r fps] [-t seconds]
+ *                   [-s widthxheight] [-p]
+ *
+ *  Output is raw RGB24 frames, one after another, in output (pool.rgb by
+ *  default), for example for
+ *      ffmpeg -f rawvideo -pix_fmt rgb24 -s 900x450 -r 60 -i pool.rgb pool.mp4
+ *  or with -p, one PPM image per frame named output00000.ppm and so on.
+ *  -t stops after that many seconds of video.  dataFile must be the table
+ *  the log was recorded on.  Without EGL, building with -DPOOL_OSMESA
+ *  renders through OSMesa instead.
+ ******************************************************************************/
+
+#include "ReplayLog.h"
+#include "GpuResources.h"
+#include "GlState.h"
+#ifdef POOL_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+
+/* VIDEO_PBOS is the number of frames in flight between drawing and
+ * reading back.  VIDEO_QUEUE is the most frames waiting for the writer
+ * before the render loop has to wait for it.
+ */
+
+const int VIDEO_PBOS = 3;
+const int VIDEO_QUEUE = 16;
+
+
+static double now(void)
+{
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/***********************************************************************
+ * Offscreen context
+ ***********************************************************************/
+
+#ifdef POOL_OSMESA
+
+static OSMesaContext context;
+static std::vector<unsigned char> osmesaBuffer;
+
+static bool createContext(int width, int height)
+{
+   const int attribs[] = {
+      OSMESA_FORMAT, OSMESA_RGBA, OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+      OSMESA_CONTEXT_MAJOR_VERSION, 3, OSMESA_CONTEXT_MINOR_VERSION, 3, 0
+   };
+
+   context = OSMesaCreateContextAttribs(attribs, NULL);
+   if(context == NULL)
+      return false;
+   osmesaBuffer.resize((size_t) width * height * 4);
+   return OSMesaMakeCurrent(context, &osmesaBuffer[0], GL_UNSIGNED_BYTE,
+                            width, height);
+}
+
+static void destroyContext(void)
+{
+   OSMesaDestroyContext(context);
+}
+
+#else
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+/* Everything is drawn into a framebuffer object, so the context needs
+ * no surface at all, nor a config where the driver allows that; Mesa's
+ * surfaceless platform (EGL_PLATFORM=surfaceless) works with no display
+ * server.
+ */
+
+static bool createContext(int width, int height)
+{
+   const EGLint configAttribs[] = {
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+      EGL_NONE
+   };
+   const EGLint contextAttribs[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE
+   };
+   EGLConfig config;
+   EGLint configs;
+
+   display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+   if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+      return false;
+   if(!eglBindAPI(EGL_OPENGL_API))
+      return false;
+   if(!eglChooseConfig(display, configAttribs, &config, 1, &configs) ||
+      configs < 1)
+      config = EGL_NO_CONFIG_KHR;
+
+   context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                              contextAttribs);
+   if(context == EGL_NO_CONTEXT)
+      return false;
+   return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+static void destroyContext(void)
+{
+   eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   eglDestroyContext(display, context);
+   eglTerminate(display);
+}
+
+#endif
+
+
+/***********************************************************************
+ * Writer thread.  Takes finished frames, bottom row first as GL reads
+ * them, flips and packs them to RGB24 and writes them.  Frame buffers
+ * go back on a free list, so after the first few frames nothing is
+ * allocated.
+ ***********************************************************************/
+
+class FrameWriter
+{
+public:
+   FrameWriter(const char* output, bool images, int width, int height)
+      : output(output), images(images), width(width), height(height),
+        file(NULL), frames(0), failed(false), done(false), waits(0),
+        busy(0.0)
+   {
+      if(!images)
+      {
+         file = fopen(output, "wb");
+         failed = file == NULL;
+      }
+      worker = std::thread(&FrameWriter::run, this);
+   }
+
+   ~FrameWriter()
+   {
+      finish();
+   }
+
+   /* A buffer for the next frame, width * height * 4 bytes. */
+
+   std::vector<unsigned char> take(void)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(spare.empty())
+         return std::vector<unsigned char>((size_t) width * height * 4);
+      std::vector<unsigned char> frame;
+      frame.swap(spare.back());
+      spare.pop_back();
+      return frame;
+   }
+
+   /* Queue a frame, waiting if VIDEO_QUEUE are already queued. */
+
+   void push(std::vector<unsigned char>& frame)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(queue.size() >= (size_t) VIDEO_QUEUE)
+      {
+         waits++;
+         drained.wait(lock, [this] {
+            return queue.size() < (size_t) VIDEO_QUEUE; });
+      }
+      queue.push_back(std::vector<unsigned char>());
+      queue.back().swap(frame);
+      ready.notify_one();
+   }
+
+   /* Write out everything queued and stop.  Returns false if any write
+    * failed.
+    */
+
+   bool finish(void)
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         done = true;
+      }
+      ready.notify_one();
+      if(worker.joinable())
+         worker.join();
+      if(file != NULL)
+      {
+         failed |= fclose(file) != 0;
+         file = NULL;
+      }
+      return !failed;
+   }
+
+   const char* output;
+   bool images;
+   int width, height;
+
+   FILE* file;
+   long frames;
+   bool failed;
+
+   /* Times the render loop waited for room in the queue, and seconds
+    * the writer spent converting and writing.
+    */
+
+   bool done;
+   long waits;
+   double busy;
+
+private:
+   void run(void)
+   {
+      std::vector<unsigned char> frame, rgb((size_t) width * height * 3);
+
+      for(;;)
+      {
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return done || !queue.empty(); });
+            if(queue.empty())
+               return;
+            frame.swap(queue.front());
+            queue.pop_front();
+            drained.notify_one();
+         }
+
+         double start = now();
+         write(frame, rgb);
+         busy += now() - start;
+
+         std::lock_guard<std::mutex> lock(mutex);
+         spare.push_back(std::vector<unsigned char>());
+         spare.back().swap(frame);
+      }
+   }
+
+   void write(const std::vector<unsigned char>& rgba,
+              std::vector<unsigned char>& rgb)
+   {
+      for(int y = 0; y < height; y++)
+      {
+         const unsigned char* in = &rgba[(size_t) (height - 1 - y) * width * 4];
+         unsigned char* out = &rgb[(size_t) y * width * 3];
+         for(int x = 0; x < width; x++)
+         {
+            out[3 * x] = in[4 * x];
+            out[3 * x + 1] = in[4 * x + 1];
+            out[3 * x + 2] = in[4 * x + 2];
+         }
+      }
+
+      FILE* f = file;
+      if(images)
+      {
+         char name[1024];
+         snprintf(name, sizeof(name), "%s%05ld.ppm", output, frames);
+         f = fopen(name, "wb");
+         if(f == NULL)
+         {
+            failed = true;
+            return;
+         }
+         fprintf(f, "P6\n%d %d\n255\n", width, height);
+      }
+      if(f != NULL && fwrite(&rgb[0], 1, rgb.size(), f) != rgb.size())
+         failed = true;
+      if(images)
+         failed |= fclose(f) != 0;
+      frames++;
+   }
+
+   std::thread worker;
+   std::mutex mutex;
+   std::condition_variable ready, drained;
+   std::deque<std::vector<unsigned char> > queue;
+   std::vector<std::vector<unsigned char> > spare;
+};
+
+
+/***********************************************************************
+ * Renderer.  Draws the table as the game does, with every circle from
+ * the distance field in one instanced call, into a framebuffer object,
+ * and reads each frame back through the pixel buffer ring.
+ ***********************************************************************/
+
+class VideoRenderer
+{
+public:
+   bool init(const PoolWorld& table, int width, int height);
+   void release(void);
+
+   /* Draw world as it stands and start reading it back.  Frames come
+    * out of the ring VIDEO_PBOS - 1 frames later; flush() collects the
+    * rest at the end.
+    */
+
+   void draw(const PoolWorld& world, FrameWriter& writer);
+   void flush(FrameWriter& writer);
+
+   /* Frames read back, of which stalls had to wait for the GPU. */
+
+   long frames;
+   long stalls;
+
+private:
+   void collect(long frame, FrameWriter& writer);
+
+   int width, height;
+   GpuResources gpu;
+   GlState gl;
+   GLuint program, frameBlock, distanceField, vInstance, vColor;
+   GLuint framebuffer, colorBuffer;
+   GLuint instanceBuffer;
+   int boardMesh, quadMesh;
+   GLuint pbos[VIDEO_PBOS];
+   GLsync fences[VIDEO_PBOS];
+   std::vector<CircleInstance> circles;
+};
+
+bool VideoRenderer::init(const PoolWorld& table, int w, int h)
+{
+   width = w;
+   height = h;
+   frames = stalls = 0;
+
+   program = InitShader("vshader41.glsl", "fshader41.glsl");
+   distanceField = glGetUniformLocation(program, "distanceField");
+   vInstance = glGetAttribLocation(program, "vInstance");
+   vColor = glGetAttribLocation(program, "vColor");
+
+   const Table& t = table.table;
+   mat4 p = Ortho(t.ll.x - t.fringeWidth, t.ur.x + t.fringeWidth,
+                  t.ll.y - t.fringeWidth, t.ur.y + t.fringeWidth, -1.0, 1.0);
+   frameBlock = gl.createFrameBlock(gpu, program);
+   gl.frameConstants(frameBlock, p,
+                     (t.ur.x - t.ll.x + 2.0 * t.fringeWidth) / width);
+
+   glGenFramebuffers(1, &framebuffer);
+   glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+   glGenRenderbuffers(1, &colorBuffer);
+   glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+   glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_RENDERBUFFER, colorBuffer);
+   if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      return false;
+   glViewport(0, 0, width, height);
+   glClearColor(t.fringeColor.x, t.fringeColor.y, t.fringeColor.z, 1.0);
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+   int capacity = table.numBalls + table.pockets.size();
+   boardMesh = gpu.quad(program, vec2(t.ll), vec2(t.ur));
+   quadMesh = gpu.quad(program, vec2(-1.0, -1.0), vec2(1.0, 1.0));
+   instanceBuffer = gpu.createBuffer(GL_ARRAY_BUFFER,
+                                     capacity * sizeof(CircleInstance),
+                                     NULL, GL_STREAM_DRAW);
+   glBindVertexArray(gpu.mesh(quadMesh).vao);
+   bindCircleInstances(program, instanceBuffer);
+   circles.reserve(capacity);
+
+   for(int i = 0; i < VIDEO_PBOS; i++)
+   {
+      pbos[i] = gpu.createBuffer(GL_PIXEL_PACK_BUFFER,
+                                 (GLsizeiptr) width * height * 4, NULL,
+                                 GL_STREAM_READ);
+      fences[i] = NULL;
+   }
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+   /* Everything above bound behind gl's back. */
+
+   gl.reset();
+   gl.useProgram(program);
+   return true;
+}
+
+void VideoRenderer::release(void)
+{
+   for(int i = 0; i < VIDEO_PBOS; i++)
+   {
+      if(fences[i] != NULL)
+         glDeleteSync(fences[i]);
+      gpu.deleteBuffer(pbos[i]);
+   }
+   gpu.deleteBuffer(instanceBuffer);
+   gpu.deleteBuffer(frameBlock);
+   gpu.release(quadMesh);
+   gpu.release(boardMesh);
+   glDeleteRenderbuffers(1, &colorBuffer);
+   glDeleteFramebuffers(1, &framebuffer);
+   glDeleteProgram(program);
+}
+
+void VideoRenderer::draw(const PoolWorld& world, FrameWriter& writer)
+{
+   const Table& t = world.table;
+   const BallStore& balls = world.balls;
+
+   glClear(GL_COLOR_BUFFER_BIT);
+
+   const Mesh& board = gpu.mesh(boardMesh);
+   gl.bindVertexArray(board.vao);
+   gl.uniform1i(distanceField, GL_FALSE);
+   gl.vertexAttrib4f(vInstance, 0.0, 0.0, 1.0, 0.0);
+   gl.vertexAttrib4f(vColor, t.boardColor.x, t.boardColor.y, t.boardColor.z,
+                     1.0);
+   glDrawArrays(board.primitive, 0, board.numVertices);
+
+   /* Pockets, then the balls in play; no markers. */
+
+   circles.clear();
+   for(int p = 0; p < world.pockets.size(); p++)
+   {
+      const Color& color = world.pockets.color[p];
+      CircleInstance c = { (GLfloat) world.pockets.cx[p],
+                           (GLfloat) world.pockets.cy[p],
+                           (GLfloat) world.pockets.radius[p], 0.0,
+                           color.x, color.y, color.z, 1.0 };
+      circles.push_back(c);
+   }
+   for(int i = NUM_MARKERS; i < world.numBalls; i++)
+   {
+      if(world.isPocketed(i))
+         continue;
+
+      const Color& color = balls.info[i].color;
+      CircleInstance c = { (GLfloat) balls.px[i], (GLfloat) balls.py[i],
+                           (GLfloat) balls.r[i], 0.0,
+                           color.x, color.y, color.z, 1.0 };
+      circles.push_back(c);
+   }
+
+   /* With no pockets and every ball down there is nothing to draw. */
+
+   if(!circles.empty())
+   {
+      const Mesh& quad = gpu.mesh(quadMesh);
+      gl.bindVertexArray(quad.vao);
+      gl.uniform1i(distanceField, GL_TRUE);
+      gl.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+      glBufferData(GL_ARRAY_BUFFER,
+                   circles.capacity() * sizeof(CircleInstance), NULL,
+                   GL_STREAM_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0,
+                      circles.size() * sizeof(CircleInstance),
+                      circles.data());
+      glDrawArraysInstanced(quad.primitive, 0, quad.numVertices,
+                            circles.size());
+   }
+
+   /* Start the copy into this frame's pixel buffer; it is mapped when
+    * the ring comes round to it again.
+    */
+
+   int slot = frames % VIDEO_PBOS;
+   if(fences[slot] != NULL)
+      collect(frames - VIDEO_PBOS, writer);
+
+   gl.bindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+   glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                BUFFER_OFFSET(0));
+   gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   glFlush();
+   frames++;
+}
+
+void VideoRenderer::flush(FrameWriter& writer)
+{
+   for(long f = std::max(0L, frames - VIDEO_PBOS); f < frames; f++)
+      collect(f, writer);
+}
+
+/* Map frame's pixel buffer, once its fence has passed, and queue a copy
+ * for the writer.
+ */
+
+void VideoRenderer::collect(long frame, FrameWriter& writer)
+{
+   int slot = frame % VIDEO_PBOS;
+   if(fences[slot] == NULL)
+      return;
+
+   if(glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+   {
+      stalls++;
+      while(glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+                             1000000000) == GL_TIMEOUT_EXPIRED)
+         ;
+   }
+   glDeleteSync(fences[slot]);
+   fences[slot] = NULL;
+
+   size_t bytes = (size_t) width * height * 4;
+   gl.bindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+   const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                                         GL_MAP_READ_BIT);
+   if(pixels != NULL)
+   {
+      std::vector<unsigned char> copy = writer.take();
+      memcpy(&copy[0], pixels, bytes);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      writer.push(copy);
+   }
+   gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+
+/***********************************************************************
+ * Driver.  Plays the log's inputs back tick by tick, session after
+ * session, and draws a frame whenever the video clock passes one.
+ ***********************************************************************/
+
+int main(int argc, char** argv)
+{
+   const char* logName = NULL;
+   const char* fileName = "poolData.txt";
+   const char* output = NULL;
+   double fps = 60.0, seconds = HUGE_VAL;
+   int width = 900, height = 450;
+   bool images = false;
+
+   for(int a = 1; a < argc; a++)
+   {
+      if(strcmp(argv[a], "-o") == 0 && a + 1 < argc)
+         output = argv[++a];
+      else if(strcmp(argv[a], "-r") == 0 && a + 1 < argc)
+         fps = atof(argv[++a]);
+      else if(strcmp(argv[a], "-t") == 0 && a + 1 < argc)
+         seconds = atof(argv[++a]);
+      else if(strcmp(argv[a], "-s") == 0 && a + 1 < argc)
+         sscanf(argv[++a], "%dx%d", &width, &height);
+      else if(strcmp(argv[a], "-p") == 0)
+         images = true;
+      else if(logName == NULL)
+         logName = argv[a];
+      else
+         fileName = argv[a];
+   }
+   if(logName == NULL || fps <= 0.0 || width <= 0 || height <= 0)
+   {
+      std::cerr << "Usage: poolVideo logFile [dataFile] [-o output] [-r fps]"
+                << " [-t seconds] [-s widthxheight] [-p]" << std::endl;
+      return 1;
+   }
+   if(output == NULL)
+      output = images ? "pool" : "pool.rgb";
+
+   PoolWorld table;
+   if(!table.readFile(fileName))
+   {
+      std::cerr << "Could not open " << fileName << std::endl;
+      return 1;
+   }
+
+   ReplayReader log;
+   if(!log.open(logName))
+   {
+      std::cerr << "Could not open " << logName << std::endl;
+      return 1;
+   }
+
+   if(!createContext(width, height))
+   {
+      std::cerr << "Could not create an offscreen GL context" << std::endl;
+      return 1;
+   }
+   glewExperimental = GL_TRUE;
+   glewInit();
+
+   VideoRenderer renderer;
+   if(!renderer.init(table, width, height))
+   {
+      std::cerr << "Could not set up offscreen rendering" << std::endl;
+      return 1;
+   }
+
+   FrameWriter writer(output, images, width, height);
+   if(writer.failed)
+   {
+      std::cerr << "Could not write " << output << std::endl;
+      return 1;
+   }
+
+   /* The video clock runs on through every session; a frame is drawn
+    * each time it passes the next 1 / fps.
+    */
+
+   PoolWorld world;
+   ReplayRecord record;
+   bool inSession = false, more = true;
+   double clock = 0.0, end = seconds;
+   long frame = 0;
+   double start = now();
+
+   while(clock < end)
+   {
+      more = more && log.next(record);
+
+      if(more && record.type == RECORD_SESSION)
+      {
+         if(record.numBalls != table.numBalls)
+         {
+            std::cerr << logName << " was not recorded on " << fileName
+                      << std::endl;
+            return 1;
+         }
+         world = table;
+         world.tickDt = record.tickDt;
+         world.substeps = record.substeps;
+         world.ticks = record.tick;
+         inSession = true;
+         continue;
+      }
+      if(!inSession)
+         break;
+
+      /* Play up to the next input, or once the log is done, until the
+       * table comes to rest.
+       */
+
+      while(clock < end &&
+            (more ? world.ticks < record.tick : world.awakeCount() > 0))
+      {
+         while(clock >= frame / fps && clock < end)
+         {
+            renderer.draw(world, writer);
+            frame++;
+         }
+         world.tick();
+         clock += world.tickDt;
+      }
+      if(!more)
+         break;
+      applyRecord(world, record);
+   }
+
+   renderer.flush(writer);
+   double rendered = now() - start;
+   bool written = writer.finish();
+   double elapsed = now() - start;
+
+   renderer.release();
+   destroyContext();
+
+   std::cout << frame << " frames (" << frame / fps << " s of video) at "
+             << width << "x" << height << " in " << elapsed << " s, "
+             << frame / fps / elapsed << "x real time" << std::endl;
+   std::cout << "Render loop " << rendered << " s, " << renderer.stalls
+             << " readback stalls, " << writer.waits
+             << " waits for the writer; writer busy " << writer.busy << " s"
+             << std::endl;
+   if(!written)
+   {
+      std::cerr << "Could not write " << output << std::endl;
+      return 1;
+   }
+   return 0;
+}
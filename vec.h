@@ -13,66 +13,75 @@ namespace Angel {
 
 //////////////////////////////////////////////////////////////////////////////
 //
-//  vec2.h - 2D vector
+//  vec2.h - 2D vector, templated on its scalar type.  vec2 is the GLfloat
+//    version the shaders take; dvec2 is the double version PoolWorld's
+//    positions, velocities, aims and table corners go through, so
+//    nothing the simulation is given or gives back is rounded to float.
+//    Converting between the two must be asked for.
 //
 
-struct vec2 {
+template <class T>
+struct tvec2 {
 
-    GLfloat  x;
-    GLfloat  y;
+    T  x;
+    T  y;
 
     //
     //  --- Constructors and Destructors ---
     //
 
-    vec2( GLfloat s = GLfloat(0.0) ) :
+    tvec2( T s = T(0.0) ) :
 	x(s), y(s) {}
 
-    vec2( GLfloat x, GLfloat y ) :
+    tvec2( T x, T y ) :
 	x(x), y(y) {}
 
-    vec2( const vec2& v )
+    tvec2( const tvec2& v )
 	{ x = v.x;  y = v.y;  }
 
+    template <class U>
+    explicit tvec2( const tvec2<U>& v ) :
+	x(T(v.x)), y(T(v.y)) {}
+
     //
     //  --- Indexing Operator ---
     //
 
-    GLfloat& operator [] ( int i ) { return *(&x + i); }
-    const GLfloat operator [] ( int i ) const { return *(&x + i); }
+    T& operator [] ( int i ) { return *(&x + i); }
+    const T operator [] ( int i ) const { return *(&x + i); }
 
     //
     //  --- (non-modifying) Arithematic Operators ---
     //
 
-    vec2 operator - () const // unary minus operator
-	{ return vec2( -x, -y ); }
+    tvec2 operator - () const // unary minus operator
+	{ return tvec2( -x, -y ); }
 
-    vec2 operator + ( const vec2& v ) const
-	{ return vec2( x + v.x, y + v.y ); }
+    tvec2 operator + ( const tvec2& v ) const
+	{ return tvec2( x + v.x, y + v.y ); }
 
-    vec2 operator - ( const vec2& v ) const
-	{ return vec2( x - v.x, y - v.y ); }
+    tvec2 operator - ( const tvec2& v ) const
+	{ return tvec2( x - v.x, y - v.y ); }
 
-    vec2 operator * ( const GLfloat s ) const
-	{ return vec2( s*x, s*y ); }
+    tvec2 operator * ( const T s ) const
+	{ return tvec2( s*x, s*y ); }
 
-    vec2 operator * ( const vec2& v ) const
-	{ return vec2( x*v.x, y*v.y ); }
+    tvec2 operator * ( const tvec2& v ) const
+	{ return tvec2( x*v.x, y*v.y ); }
 
-    friend vec2 operator * ( const GLfloat s, const vec2& v )
+    friend tvec2 operator * ( const T s, const tvec2& v )
 	{ return v * s; }
 
-    vec2 operator / ( const GLfloat s ) const {
+    tvec2 operator / ( const T s ) const {
 #ifdef DEBUG
 	if ( std::fabs(s) < DivideByZeroTolerance ) {
 	    std::cerr << "[" << __FILE__ << ":" << __LINE__ << "] "
 		      << "Division by zero" << std::endl;
-	    return vec2();
+	    return tvec2();
 	}
 #endif // DEBUG
 
-	GLfloat r = GLfloat(1.0) / s;
+	T r = T(1.0) / s;
 	return *this * r;
     }
 
@@ -80,19 +89,19 @@ struct vec2 {
     //  --- (modifying) Arithematic Operators ---
     //
 
-    vec2& operator += ( const vec2& v )
+    tvec2& operator += ( const tvec2& v )
 	{ x += v.x;  y += v.y;   return *this; }
 
-    vec2& operator -= ( const vec2& v )
+    tvec2& operator -= ( const tvec2& v )
 	{ x -= v.x;  y -= v.y;  return *this; }
 
-    vec2& operator *= ( const GLfloat s )
+    tvec2& operator *= ( const T s )
 	{ x *= s;  y *= s;   return *this; }
 
-    vec2& operator *= ( const vec2& v )
+    tvec2& operator *= ( const tvec2& v )
 	{ x *= v.x;  y *= v.y; return *this; }
 
-    vec2& operator /= ( const GLfloat s ) {
+    tvec2& operator /= ( const T s ) {
 #ifdef DEBUG
 	if ( std::fabs(s) < DivideByZeroTolerance ) {
 	    std::cerr << "[" << __FILE__ << ":" << __LINE__ << "] "
@@ -100,7 +109,7 @@ struct vec2 {
 	}
 #endif // DEBUG
 
-	GLfloat r = GLfloat(1.0) / s;
+	T r = T(1.0) / s;
 	*this *= r;
 
 	return *this;
@@ -110,41 +119,47 @@ struct vec2 {
     //  --- Insertion and Extraction Operators ---
     //
 
-    friend std::ostream& operator << ( std::ostream& os, const vec2& v ) {
+    friend std::ostream& operator << ( std::ostream& os, const tvec2& v ) {
 	return os << "( " << v.x << ", " << v.y <<  " )";
     }
 
-    friend std::istream& operator >> ( std::istream& is, vec2& v )
+    friend std::istream& operator >> ( std::istream& is, tvec2& v )
 	{ return is >> v.x >> v.y ; }
 
     //
     //  --- Conversion Operators ---
     //
 
-    operator const GLfloat* () const
-	{ return static_cast<const GLfloat*>( &x ); }
+    operator const T* () const
+	{ return static_cast<const T*>( &x ); }
 
-    operator GLfloat* ()
-	{ return static_cast<GLfloat*>( &x ); }
+    operator T* ()
+	{ return static_cast<T*>( &x ); }
 };
 
+typedef tvec2<GLfloat>   vec2;
+typedef tvec2<GLdouble>  dvec2;
+
 //----------------------------------------------------------------------------
 //
 //  Non-class vec2 Methods
 //
 
+template <class T>
 inline
-GLfloat dot( const vec2& u, const vec2& v ) {
+T dot( const tvec2<T>& u, const tvec2<T>& v ) {
     return u.x * v.x + u.y * v.y;
 }
 
+template <class T>
 inline
-GLfloat length( const vec2& v ) {
+T length( const tvec2<T>& v ) {
     return std::sqrt( dot(v,v) );
 }
 
+template <class T>
 inline
-vec2 normalize( const vec2& v ) {
+tvec2<T> normalize( const tvec2<T>& v ) {
     return v / length(v);
 }
 
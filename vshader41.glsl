@@ -1,14 +1,46 @@
 #version 150 
 
+// One vertex of the shared unit circle: xy is its direction from the
+// centre, z is 1 on the rim and 0 at the hub.  For the distance field
+// the mesh is the square around the circle, every corner on the "rim".
 in  vec4 vPosition;
+
+// Per circle: centre (xy), radius (z), and 1 in w for just the rim.
+in  vec4 vInstance;
 in  vec4 vColor;
 out vec4 color;
 
-uniform mat4 model_view;
-uniform mat4 projection;
+// For the distance field: the fragment's offset from the centre, and
+// the circle's radius and rim flag.
+out vec2 offset;
+flat out float radius;
+flat out float outline;
+
+// Per frame, shared with the fragment shader; see GlState.h.
+layout(std140, row_major) uniform Frame
+{
+    mat4 projection;
+    float outlineWidth;
+};
+uniform bool distanceField;
 
 void main() 
 {
-    gl_Position = projection * model_view * vPosition;
+    radius = vInstance.z;
+    outline = vInstance.w;
+
+    float reach;
+    if (distanceField)
+    {
+        reach = radius + outlineWidth;
+    }
+    else
+    {
+        float hub = outline * max(radius - outlineWidth, 0.0);
+        reach = mix(hub, radius, vPosition.z);
+    }
+
+    offset = vPosition.xy * reach;
+    gl_Position = projection * vec4(vInstance.xy + offset, 0.0, 1.0);
     color = vColor;
 } 